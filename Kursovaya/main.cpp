@@ -9,464 +9,7085 @@
 #include <thread>
 #include <chrono>
 #include <limits>
-#include <windows.h>
 #include <locale.h>
 #include <cstdlib>
 #include <random>
 #include <sstream>
+#include <queue>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
+#include <string_view>
+#include <tuple>
+#include <atomic>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <functional>
+#include <type_traits>
+#include <cstdio>
+#ifdef _WIN32
+#define NOMINMAX // иначе макросы min и max из windows.h ломают std::min и numeric_limits::max
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
+// MAC-адрес, упакованный в младшие 48 бит uint64_t: сравнение, хеширование и
+// копирование - одна машинная операция вместо работы со строкой "AA:BB:CC:DD:EE:FF"
+class MacAddress {
+private:
+    uint64_t value;
+
+    static int hexDigit(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    }
+
+public:
+    static constexpr uint64_t mask = 0xFFFFFFFFFFFFULL;
+
+    constexpr MacAddress() : value(0) {}
+    constexpr explicit MacAddress(uint64_t raw) : value(raw & mask) {}
+
+    // Разбирает "AA:BB:CC:DD:EE:FF", "aa-bb-cc-dd-ee-ff" или "AABBCCDDEEFF"
+    static bool tryParse(string_view text, MacAddress& result) {
+        bool separated = text.size() == 17;
+        if (!separated && text.size() != 12) return false;
+
+        uint64_t raw = 0;
+        size_t pos = 0;
+        for (int octet = 0; octet < 6; ++octet) {
+            if (separated && octet > 0) {
+                if (text[pos] != ':' && text[pos] != '-') return false;
+                ++pos;
+            }
+            int hi = hexDigit(text[pos]);
+            int lo = hexDigit(text[pos + 1]);
+            if (hi < 0 || lo < 0) return false;
+            raw = (raw << 8) | static_cast<uint64_t>(hi << 4 | lo);
+            pos += 2;
+        }
+        result = MacAddress(raw);
+        return true;
+    }
+
+    static MacAddress parse(string_view text) {
+        MacAddress result;
+        if (!tryParse(text, result)) {
+            throw runtime_error("Неверный формат MAC-адреса: " + string(text));
+        }
+        return result;
+    }
+
+    // Записывает 17 символов "AA:BB:CC:DD:EE:FF" в out (без завершающего нуля)
+    void format(char* out) const {
+        static const char digits[] = "0123456789ABCDEF";
+        for (int octet = 0; octet < 6; ++octet) {
+            unsigned byte = static_cast<unsigned>(value >> (40 - 8 * octet)) & 0xFF;
+            if (octet > 0) *out++ = ':';
+            *out++ = digits[byte >> 4];
+            *out++ = digits[byte & 0xF];
+        }
+    }
+
+    string toString() const {
+        string result(17, '\0');
+        format(&result[0]);
+        return result;
+    }
+
+    uint64_t toUint64() const { return value; }
+    bool isBroadcast() const { return value == mask; }
+    bool isMulticast() const { return (value >> 40) & 0x01; }
+
+    bool operator==(const MacAddress& other) const { return value == other.value; }
+    bool operator!=(const MacAddress& other) const { return value != other.value; }
+    bool operator<(const MacAddress& other) const { return value < other.value; }
+};
+
+inline ostream& operator<<(ostream& os, const MacAddress& mac) {
+    char text[17];
+    mac.format(text);
+    return os.write(text, sizeof(text));
+}
+
+namespace std {
+template<>
+struct hash<MacAddress> {
+    size_t operator()(const MacAddress& mac) const {
+        // Перемешивание Фибоначчи: у соседних адресов одного производителя различаются
+        // только младшие биты, а таблицам нужны хорошо распределённые старшие
+        uint64_t x = mac.toUint64() * 0x9E3779B97F4A7C15ULL;
+        return static_cast<size_t>(x ^ (x >> 32));
+    }
+};
+}
+
+// IPv4-адрес хранится как uint32_t в порядке байт "слева направо": 10.0.0.1 -> 0x0A000001.
+// Адрес 0.0.0.0 означает, что у пакета нет IP-заголовка
+inline bool tryParseIpv4(string_view text, uint32_t& result) {
+    uint32_t value = 0;
+    size_t pos = 0;
+    for (int octet = 0; octet < 4; ++octet) {
+        if (octet > 0) {
+            if (pos >= text.size() || text[pos] != '.') return false;
+            ++pos;
+        }
+        size_t start = pos;
+        unsigned part = 0;
+        while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9' && pos - start < 3) {
+            part = part * 10 + (text[pos] - '0');
+            ++pos;
+        }
+        if (pos == start || part > 255) return false;
+        value = (value << 8) | part;
+    }
+    if (pos != text.size()) return false;
+    result = value;
+    return true;
+}
+
+inline uint32_t parseIpv4(string_view text) {
+    uint32_t result;
+    if (!tryParseIpv4(text, result)) {
+        throw runtime_error("Неверный формат IP-адреса: " + string(text));
+    }
+    return result;
+}
+
+inline string formatIpv4(uint32_t ip) {
+    return to_string(ip >> 24) + "." + to_string((ip >> 16) & 0xFF) + "."
+         + to_string((ip >> 8) & 0xFF) + "." + to_string(ip & 0xFF);
+}
+
+// Маска сети для длины префикса 0..32
+inline uint32_t prefixMask(int length) {
+    return length == 0 ? 0 : ~0U << (32 - length);
+}
+
+// Разбирает "a.b.c.d/len"; биты адреса за пределами префикса обнуляются
+inline void parseCidr(string_view text, uint32_t& prefix, int& length) {
+    size_t slash = text.find('/');
+    if (slash == string_view::npos) {
+        throw runtime_error("Ожидается префикс вида a.b.c.d/длина: " + string(text));
+    }
+    uint32_t address = parseIpv4(text.substr(0, slash));
+    string_view lengthText = text.substr(slash + 1);
+    if (lengthText.empty() || lengthText.size() > 2 ||
+        !all_of(lengthText.begin(), lengthText.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+        throw runtime_error("Неверная длина префикса: " + string(text));
+    }
+    length = stoi(string(lengthText));
+    if (length > 32) {
+        throw runtime_error("Длина префикса больше 32: " + string(text));
+    }
+    prefix = address & prefixMask(length);
+}
+
+class PacketPool;
+class CheckpointWriter;
+class CheckpointReader;
+
+// Неизменяемое содержимое пакета. Байты лежат в одном разделяемом буфере, поэтому
+// пересылка, копирование пакета между потоками и постановка в очередь печати не
+// копируют полезную нагрузку, а читается она через string_view
+class Payload {
+private:
+    shared_ptr<const string> bytes;
+
+public:
+    Payload() = default;
+    explicit Payload(string data) : bytes(make_shared<const string>(move(data))) {}
+
+    string_view view() const { return bytes ? string_view(*bytes) : string_view(); }
+    size_t size() const { return bytes ? bytes->size() : 0; }
+    bool empty() const { return size() == 0; }
+
+    // Адрес общего буфера: пакеты с одним и тем же содержимым дают одно значение
+    const void* identity() const { return bytes.get(); }
+};
+
 // Класс для представления сетевого пакета
 class DataPacket {
 private:
-    string content;
+    Payload content;
     int size;
-    string sourceMac;
-    string destinationMac;
+    int flowId;             // номер потока нагрузки, -1 - пакет не из потока
+    MacAddress sourceMac;
+    MacAddress destinationMac;
+    uint32_t sourceIp;      // 0 - пакет без IP-заголовка
+    uint32_t destinationIp;
+    int ttl;
+    int destinationNode;    // индекс получателя в таблицах RoutingService, -1 - не задан
+    uint64_t traceId;       // ID пакета в журнале трассировки, 0 - не записывался
+    int64_t sentAt;         // модельное время отправки источником (нс), -1 - неизвестно
+
+    // Служебные поля пула: счётчик ссылок PacketRef, пул-владелец и звено списка свободных
+    uint32_t refCount;
+    PacketPool* pool;
+    DataPacket* nextFree;
+
+    friend class PacketRef;
+    friend class PacketPool;
 
 public:
-    DataPacket(const string& content, int size, const string& srcMac, const string& destMac)
-        : content(content), size(size), sourceMac(srcMac), destinationMac(destMac) {}
+    static constexpr int defaultTtl = 64;
+
+    DataPacket()
+        : size(0), flowId(-1), sourceIp(0), destinationIp(0), ttl(defaultTtl), destinationNode(-1), traceId(0), sentAt(-1),
+          refCount(0), pool(nullptr), nextFree(nullptr) {}
+
+    DataPacket(const Payload& content, int size, MacAddress srcMac, MacAddress destMac)
+        : content(content), size(size), flowId(-1), sourceMac(srcMac), destinationMac(destMac),
+          sourceIp(0), destinationIp(0), ttl(defaultTtl), destinationNode(-1), traceId(0), sentAt(-1),
+          refCount(0), pool(nullptr), nextFree(nullptr) {}
+
+    // Копируется только содержимое пакета, но не принадлежность пулу
+    DataPacket(const DataPacket& other)
+        : content(other.content), size(other.size), flowId(other.flowId), sourceMac(other.sourceMac),
+          destinationMac(other.destinationMac), sourceIp(other.sourceIp),
+          destinationIp(other.destinationIp), ttl(other.ttl), destinationNode(other.destinationNode),
+          traceId(other.traceId), sentAt(other.sentAt), refCount(0), pool(nullptr), nextFree(nullptr) {}
+
+    DataPacket& operator=(const DataPacket& other) {
+        assign(other.content, other.size, other.sourceMac, other.destinationMac);
+        setIpHeader(other.sourceIp, other.destinationIp, other.ttl);
+        destinationNode = other.destinationNode;
+        traceId = other.traceId;
+        sentAt = other.sentAt;
+        flowId = other.flowId;
+        return *this;
+    }
+
+    // Заполняет пакет заново, не обращаясь к куче
+    void assign(const Payload& newContent, int newSize, MacAddress srcMac, MacAddress destMac) {
+        content = newContent;
+        size = newSize;
+        flowId = -1;
+        sourceMac = srcMac;
+        destinationMac = destMac;
+        sourceIp = 0;
+        destinationIp = 0;
+        ttl = defaultTtl;
+        destinationNode = -1;
+        traceId = 0;
+        sentAt = -1;
+    }
+
+    void setIpHeader(uint32_t srcIp, uint32_t destIp, int newTtl = defaultTtl) {
+        sourceIp = srcIp;
+        destinationIp = destIp;
+        ttl = newTtl;
+    }
+
+    void setDestinationNode(int node) { destinationNode = node; }
+    void setTraceId(uint64_t id) { traceId = id; }
+    void setSentAt(int64_t time) { sentAt = time; }
+    void setFlowId(int flow) { flowId = flow; }
 
-    string getContent() const { return content; }
+    // Уменьшает TTL при прохождении маршрутизатора; false - время жизни истекло
+    bool decrementTtl() { return --ttl > 0; }
+
+    string_view getContent() const { return content.view(); }
+    const Payload& getPayload() const { return content; }
     int getSize() const { return size; }
-    string getSourceMac() const { return sourceMac; }
-    string getDestinationMac() const { return destinationMac; }
+    const PacketPool* getPool() const { return pool; }
+    MacAddress getSourceMac() const { return sourceMac; }
+    MacAddress getDestinationMac() const { return destinationMac; }
+    uint32_t getSourceIp() const { return sourceIp; }
+    uint32_t getDestinationIp() const { return destinationIp; }
+    bool hasIpHeader() const { return destinationIp != 0; }
+    int getTtl() const { return ttl; }
+    int getDestinationNode() const { return destinationNode; }
+    uint64_t getTraceId() const { return traceId; }
+    int64_t getSentAt() const { return sentAt; }
+    int getFlowId() const { return flowId; }
 };
 
-class NetworkConnection; // Forward declaration
+// Ссылка на пакет из PacketPool с неатомарным счётчиком ссылок. Пакет живёт в одном
+// потоке моделирования; между логическими процессами он передаётся копией
+// (см. Simulator::push), поэтому атомарные операции shared_ptr здесь не нужны.
+class PacketRef {
+private:
+    DataPacket* ptr;
 
-class NetworkDevice : public enable_shared_from_this<NetworkDevice> {
-protected:
-    int id;
-    string name;
-    string macAddress;
-    vector<shared_ptr<class NetworkConnection>> connections;
+    void retain() {
+        if (ptr) ++ptr->refCount;
+    }
+
+    // Определяется после PacketPool
+    void release();
 
 public:
-    NetworkDevice(int id, const string& name, const string& mac)
-        : id(id), name(name), macAddress(mac) {}
+    PacketRef() : ptr(nullptr) {}
+    explicit PacketRef(DataPacket* packet) : ptr(packet) { retain(); }
+    PacketRef(const PacketRef& other) : ptr(other.ptr) { retain(); }
+    PacketRef(PacketRef&& other) noexcept : ptr(other.ptr) { other.ptr = nullptr; }
+    ~PacketRef() { release(); }
 
-    virtual ~NetworkDevice() = default;
+    PacketRef& operator=(const PacketRef& other) {
+        if (ptr != other.ptr) {
+            release();
+            ptr = other.ptr;
+            retain();
+        }
+        return *this;
+    }
 
-    void addConnection(shared_ptr<class NetworkConnection> conn) {
-        connections.push_back(conn);
+    PacketRef& operator=(PacketRef&& other) noexcept {
+        if (this != &other) {
+            release();
+            ptr = other.ptr;
+            other.ptr = nullptr;
+        }
+        return *this;
     }
 
-    virtual void processPacket(shared_ptr<DataPacket> packet) = 0;
+    DataPacket* get() const { return ptr; }
+    bool unique() const { return ptr && ptr->refCount == 1; }
+    DataPacket* operator->() const { return ptr; }
+    DataPacket& operator*() const { return *ptr; }
+    explicit operator bool() const { return ptr != nullptr; }
+};
 
-    // Объявляем метод, но определяем его после класса NetworkConnection
-    virtual void displayInfo() const;
+// Пул пакетов одного потока моделирования. Пакеты выделяются блоками и после
+// освобождения последней ссылки возвращаются в список свободных, поэтому в
+// установившемся режиме создание пакета не обращается к куче. Пул должен пережить все ссылки на свои пакеты.
+class PacketPool {
+private:
+    static constexpr size_t blockSize = 256;
 
-    int getId() const { return id; }
-    string getName() const { return name; }
-    string getMac() const { return macAddress; }
-    vector<shared_ptr<class NetworkConnection>> getConnections() const { return connections; }
+    vector<unique_ptr<DataPacket[]>> blocks;
+    DataPacket* freeList;
+    size_t inUse;
+
+    DataPacket* take() {
+        if (!freeList) {
+            blocks.push_back(make_unique<DataPacket[]>(blockSize));
+            DataPacket* block = blocks.back().get();
+            for (size_t i = 0; i < blockSize; ++i) {
+                block[i].pool = this;
+                block[i].nextFree = freeList;
+                freeList = &block[i];
+            }
+        }
+        DataPacket* packet = freeList;
+        freeList = packet->nextFree;
+        packet->nextFree = nullptr;
+        ++inUse;
+        return packet;
+    }
+
+public:
+    PacketPool() : freeList(nullptr), inUse(0) {}
+
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    PacketRef acquire(const Payload& content, int size, MacAddress srcMac, MacAddress destMac) {
+        DataPacket* packet = take();
+        packet->assign(content, size, srcMac, destMac);
+        return PacketRef(packet);
+    }
+
+    PacketRef acquire(const DataPacket& original) {
+        DataPacket* packet = take();
+        *packet = original;
+        return PacketRef(packet);
+    }
+
+    void release(DataPacket* packet) {
+        packet->nextFree = freeList;
+        freeList = packet;
+        --inUse;
+    }
+
+    size_t getInUse() const { return inUse; }
+    size_t getCapacity() const { return blocks.size() * blockSize; }
+};
+
+inline void PacketRef::release() {
+    if (ptr && --ptr->refCount == 0) {
+        if (ptr->pool) {
+            ptr->pool->release(ptr);
+        } else {
+            delete ptr;
+        }
+    }
+    ptr = nullptr;
+}
+
+// Пачка кадров, пришедших устройству в один момент модельного времени
+struct BurstEntry {
+    PacketRef packet;
+    int ingressPort;
 };
 
-class NetworkConnection {
+// Непрерывный диапазон записей пачки (аналог span, который появился только в C++20)
+class PacketBurst {
 private:
-    weak_ptr<NetworkDevice> device1;
-    weak_ptr<NetworkDevice> device2;
-    float bandwidth;
-    int latency;
-    vector<shared_ptr<DataPacket>> packetQueue;
+    BurstEntry* first;
+    size_t count;
 
 public:
-    NetworkConnection(shared_ptr<NetworkDevice> dev1, 
-                     shared_ptr<NetworkDevice> dev2, 
-                     float bw, int lat)
-        : device1(dev1), device2(dev2), bandwidth(bw), latency(lat) {}
+    PacketBurst(BurstEntry* first, size_t count) : first(first), count(count) {}
 
-    void transferPacket(shared_ptr<DataPacket> packet, shared_ptr<NetworkDevice> sender) {
-        packetQueue.push_back(packet);
-        cout << "Пакет поставлен в очередь (" << bandwidth << "Мбит/с, " 
-             << latency << "мс задержки): " << packet->getContent() << endl;
-        
-        this_thread::sleep_for(chrono::milliseconds(latency));
-        
-        auto dev1 = this->device1.lock();
-        auto dev2 = this->device2.lock();
-        
-        if (sender == dev1 && dev2) {
-            dev2->processPacket(packet);
-        } else if (sender == dev2 && dev1) {
-            dev1->processPacket(packet);
-        }
+    BurstEntry* begin() const { return first; }
+    BurstEntry* end() const { return first + count; }
+    size_t size() const { return count; }
+    BurstEntry& operator[](size_t i) const { return first[i]; }
+    PacketBurst subburst(size_t offset, size_t length) const { return PacketBurst(first + offset, length); }
+};
+
+// Сколько кадров пачки обрабатывается за один проход предзагрузки: больше - и
+// загруженные строки кэша начинают вытесняться до использования
+constexpr size_t maxBurstSize = 64;
+
+// Модельное время в наносекундах
+using SimTime = int64_t;
+
+inline SimTime fromMilliseconds(double ms) { return static_cast<SimTime>(ms * 1000000.0); }
+inline double toMilliseconds(SimTime t) { return t / 1000000.0; }
+
+const SimTime SIM_TIME_INFINITY = numeric_limits<SimTime>::max();
+
+// Уровень подробности журнала трассировки, задаётся при сборке (-DNETSIM_TRACE_LEVEL=N):
+// 0 - журнал не собирается вовсе, 1 - только отбрасывания пакетов, 2 - каждый шаг пакета
+#ifndef NETSIM_TRACE_LEVEL
+#define NETSIM_TRACE_LEVEL 2
+#endif
+
+constexpr int traceLevel = NETSIM_TRACE_LEVEL;
+constexpr int traceDrops = 1;
+constexpr int traceHops = 2;
+
+// Тип записи журнала. Значения записываются в файл: новые добавлять только в конец
+enum class TraceEvent : uint16_t {
+    PacketContent,      // кусок содержимого пакета (служебная)
+    DeviceName,         // кусок имени устройства (служебная)
+    LinkDownDrop,
+    LinkTransmit,       // a - пропускная способность (биты float), b - задержка, мс
+    LinkQueueDrop,
+    LinkRedDrop,
+    LinkQueued,         // a, b - как у LinkTransmit
+    HostSend,           // a - ID получателя
+    HostSendViaPort,    // a - ID получателя, b - порт
+    HostSendViaGateway, // a - ID получателя, b - ID шлюза
+    HostNoRoute,        // a - ID получателя
+    HostReceived,
+    SwitchFlood,        // a - MAC назначения
+    SwitchFilter,       // a - MAC назначения
+    SwitchForward,      // a - MAC назначения, b - порт
+    PhoneSend,          // a - ID получателя
+    PhoneNoLink,        // a - ID получателя
+    PhoneReceived,
+    RouterNoRoute,      // a - IP назначения
+    RouterTtlExpired,   // a - IP назначения
+    RouterRouted,       // a - IP источника << 32 | IP назначения, b - порт
+    RouterSwitched,     // a - MAC источника, b - MAC назначения
+    PrinterJob,
+    PrinterPrinting,
+    PrinterOffline,
+    ServerRequest       // a - загрузка CPU, %
+};
+
+// Запись журнала фиксированного размера. Текст (имена устройств и содержимое пакетов)
+// передаётся служебными записями: до 16 байт в полях a и b, ключ - в packetId
+struct TraceRecord {
+    SimTime time;
+    uint64_t packetId; // 0 - запись не относится к пакету
+    uint64_t a;
+    uint64_t b;
+    int32_t device;    // ID устройства, от имени которого сделана запись
+    uint16_t type;     // TraceEvent
+    uint16_t text;     // служебные записи: длина куска, старший бит - первый кусок строки
+
+    static constexpr uint16_t firstChunk = 0x8000;
+    static constexpr size_t chunkBytes = 16;
+};
+
+static_assert(sizeof(TraceRecord) == 40, "формат файла журнала зависит от размера записи");
+
+// Расшифровка записей журнала в текстовые сообщения модели. Используется и для вывода
+// на консоль во время работы, и для разбора файла журнала (--decode)
+class TraceDecoder {
+private:
+    unordered_map<int32_t, string> names;
+    unordered_map<uint64_t, string> contents; // ID пакета -> содержимое
+
+    string nameOf(uint64_t id) const {
+        auto it = names.find(static_cast<int32_t>(id));
+        return it != names.end() ? it->second : "#" + to_string(static_cast<int32_t>(id));
     }
 
-    bool connects(shared_ptr<NetworkDevice> dev) const {
-        auto dev1 = this->device1.lock();
-        auto dev2 = this->device2.lock();
-        return (dev1 == dev || dev2 == dev);
+    string_view contentOf(uint64_t packetId) const {
+        auto it = contents.find(packetId);
+        return it != contents.end() ? string_view(it->second) : string_view();
     }
 
-    shared_ptr<NetworkDevice> getOtherDevice(shared_ptr<NetworkDevice> dev) const {
-        auto dev1 = this->device1.lock();
-        auto dev2 = this->device2.lock();
-        
-        // Если передан nullptr, возвращаем первое устройство
-        if (!dev) {
-            return dev1;
+    static float bandwidthOf(uint64_t bits) {
+        uint32_t raw = static_cast<uint32_t>(bits);
+        float value;
+        memcpy(&value, &raw, sizeof(value));
+        return value;
+    }
+
+    static void appendChunk(string& target, const TraceRecord& r) {
+        if (r.text & TraceRecord::firstChunk) target.clear();
+        char chunk[TraceRecord::chunkBytes];
+        memcpy(chunk, &r.a, sizeof(r.a));
+        memcpy(chunk + sizeof(r.a), &r.b, sizeof(r.b));
+        target.append(chunk, min<size_t>(r.text & ~TraceRecord::firstChunk, TraceRecord::chunkBytes));
+    }
+
+public:
+    void setName(int32_t id, string_view name) { names[id] = string(name); }
+
+    // Печатает сообщение записи; служебные записи только запоминаются
+    void render(const TraceRecord& r, ostream& out) {
+        if (r.type == static_cast<uint16_t>(TraceEvent::PacketContent)) {
+            appendChunk(contents[r.packetId], r);
+            return;
         }
-        
-        if (dev == dev1) return dev2;
-        if (dev == dev2) return dev1;
-        return nullptr;
+        if (r.type == static_cast<uint16_t>(TraceEvent::DeviceName)) {
+            appendChunk(names[static_cast<int32_t>(r.packetId)], r);
+            return;
+        }
+        string name = nameOf(static_cast<uint64_t>(r.device));
+        switch (static_cast<TraceEvent>(r.type)) {
+            case TraceEvent::LinkDownDrop:
+                out << "Пакет отброшен: соединение отключено: " << contentOf(r.packetId); break;
+            case TraceEvent::LinkTransmit:
+                out << "Пакет передаётся (" << bandwidthOf(r.a) << "Мбит/с, " << r.b
+                    << "мс задержки): " << contentOf(r.packetId); break;
+            case TraceEvent::LinkQueueDrop:
+                out << "Пакет отброшен: очередь соединения переполнена: " << contentOf(r.packetId); break;
+            case TraceEvent::LinkRedDrop:
+                out << "Пакет отброшен (RED): " << contentOf(r.packetId); break;
+            case TraceEvent::LinkQueued:
+                out << "Пакет поставлен в очередь (" << bandwidthOf(r.a) << "Мбит/с, " << r.b
+                    << "мс задержки): " << contentOf(r.packetId); break;
+            case TraceEvent::HostSend:
+                out << name << " отправляет пакет на " << nameOf(r.a); break;
+            case TraceEvent::HostSendViaPort:
+                out << name << " отправляет пакет для " << nameOf(r.a) << " через порт " << r.b; break;
+            case TraceEvent::HostSendViaGateway:
+                out << name << " отправляет пакет для " << nameOf(r.a) << " через шлюз " << nameOf(r.b); break;
+            case TraceEvent::HostNoRoute:
+                out << "Нет маршрута к " << nameOf(r.a); break;
+            case TraceEvent::HostReceived:
+                out << name << " получил пакет: " << contentOf(r.packetId); break;
+            case TraceEvent::SwitchFlood:
+                out << name << " выполняет flooding (MAC " << MacAddress(r.a) << " неизвестен)"; break;
+            case TraceEvent::SwitchFilter:
+                out << name << " отбрасывает кадр для " << MacAddress(r.a) << ": получатель за входным портом"; break;
+            case TraceEvent::SwitchForward:
+                out << name << " пересылает пакет на известный MAC: " << MacAddress(r.a) << " (порт " << r.b << ")"; break;
+            case TraceEvent::PhoneSend:
+                out << name << " отправляет сообщение на " << nameOf(r.a); break;
+            case TraceEvent::PhoneNoLink:
+                out << "Нет связи с " << nameOf(r.a); break;
+            case TraceEvent::PhoneReceived:
+                out << name << " получил сообщение: " << contentOf(r.packetId); break;
+            case TraceEvent::RouterNoRoute:
+                out << name << ": нет маршрута к " << formatIpv4(static_cast<uint32_t>(r.a)) << ", пакет отброшен"; break;
+            case TraceEvent::RouterTtlExpired:
+                out << name << ": истёк TTL пакета для " << formatIpv4(static_cast<uint32_t>(r.a)); break;
+            case TraceEvent::RouterRouted:
+                out << name << " маршрутизирует пакет от " << formatIpv4(static_cast<uint32_t>(r.a >> 32))
+                    << " к " << formatIpv4(static_cast<uint32_t>(r.a)) << " через порт " << r.b; break;
+            case TraceEvent::RouterSwitched:
+                out << name << " маршрутизирует пакет от " << MacAddress(r.a) << " к " << MacAddress(r.b); break;
+            case TraceEvent::PrinterJob:
+                out << name << " получил задание на печать: " << contentOf(r.packetId); break;
+            case TraceEvent::PrinterPrinting:
+                out << name << " печатает документ..."; break;
+            case TraceEvent::PrinterOffline:
+                out << name << " недоступен для печати"; break;
+            case TraceEvent::ServerRequest:
+                out << name << " обрабатывает запрос: " << contentOf(r.packetId)
+                    << " (Загрузка CPU: " << r.a << "%)"; break;
+            default:
+                out << "Неизвестная запись журнала (тип " << r.type << ")"; break;
+        }
+        out << '\n';
     }
 
-    // Добавим методы для безопасного получения устройств
-    shared_ptr<NetworkDevice> getFirstDevice() const {
-        return device1.lock();
+    void clear() {
+        names.clear();
+        contents.clear();
     }
-    
-    shared_ptr<NetworkDevice> getSecondDevice() const {
-        return device2.lock();
+};
+
+// Кольцевой буфер записей журнала одного потока моделирования: один писатель (поток
+// моделирования) и один читатель. Без блокировок: позиции - атомарные счётчики, каждый
+// из которых меняет только одна сторона
+class TraceRing {
+private:
+    static constexpr size_t capacity = size_t(1) << 16;
+
+    unique_ptr<TraceRecord[]> records;
+    alignas(64) atomic<size_t> head; // следующая позиция записи
+    alignas(64) atomic<size_t> tail; // следующая позиция чтения
+
+public:
+    TraceRing() : records(new TraceRecord[capacity]), head(0), tail(0) {}
+
+    bool tryPush(const TraceRecord& record) {
+        size_t h = head.load(memory_order_relaxed);
+        if (h - tail.load(memory_order_acquire) == capacity) return false;
+        records[h & (capacity - 1)] = record;
+        head.store(h + 1, memory_order_release);
+        return true;
     }
 
-    float getBandwidth() const { return bandwidth; }
-    int getLatency() const { return latency; }
+    // Передаёт накопленные записи consume(первая, количество) не более чем двумя кусками
+    template <typename Consumer>
+    size_t drain(Consumer&& consume) {
+        size_t t = tail.load(memory_order_relaxed);
+        size_t h = head.load(memory_order_acquire);
+        size_t count = h - t;
+        if (count == 0) return 0;
+        size_t first = t & (capacity - 1);
+        size_t firstPart = min(count, capacity - first);
+        consume(&records[first], firstPart);
+        if (firstPart < count) consume(&records[0], count - firstPart);
+        tail.store(h, memory_order_release);
+        return count;
+    }
+
+    bool empty() const { return head.load(memory_order_acquire) == tail.load(memory_order_acquire); }
 };
 
-class Computer : public NetworkDevice {
+// Журнал трассировки. Потоки моделирования пишут записи в свои кольца (см.
+// Simulator::trace), а читаются они одним из двух способов:
+//  - в файл: фоновый поток переносит записи из колец в двоичный файл (openFile);
+//  - на консоль: без файла записи расшифровываются в текст при flush() или
+//    при заполнении кольца, в потоке моделирования.
+// Журнал один на процесс, как и консоль
+class TraceLog {
 private:
-    string ipAddress;
-    vector<shared_ptr<DataPacket>> receivedPackets;
+    static constexpr char fileMagic[8] = {'N', 'E', 'T', 'T', 'R', 'C', '0', '1'};
+
+    mutex ringsMutex; // защищает список колец, файл и декодер консоли
+    vector<unique_ptr<TraceRing>> rings;
+    ofstream file;
+    thread writer;
+    atomic<bool> stopWriter;
+    bool console;
+    TraceDecoder consoleDecoder;
+    atomic<uint64_t> lastPacketId;
+
+    TraceLog() : stopWriter(false), console(true), lastPacketId(0) { updateActive(); }
+
+    ~TraceLog() { closeFile(); }
+
+    void updateActive() { activeFlag() = console || file.is_open(); }
+
+    // Начальное значение соответствует конструктору: по умолчанию журнал идёт на консоль
+    static bool& activeFlag() {
+        static bool value = true;
+        return value;
+    }
+
+    // Переносит записи кольца в файл или на консоль; вызывается под ringsMutex
+    size_t consume(TraceRing& ring) {
+        if (file.is_open()) {
+            return ring.drain([this](const TraceRecord* first, size_t count) {
+                file.write(reinterpret_cast<const char*>(first), static_cast<streamsize>(count * sizeof(TraceRecord)));
+            });
+        }
+        ostringstream text;
+        size_t count = ring.drain([&](const TraceRecord* first, size_t n) {
+            if (!console) return;
+            for (size_t i = 0; i < n; ++i) consoleDecoder.render(first[i], text);
+        });
+        if (text.tellp() > 0) {
+            cout << text.str();
+            cout.flush();
+        }
+        return count;
+    }
+
+    void writerLoop() {
+        while (!stopWriter.load(memory_order_acquire)) {
+            size_t moved = 0;
+            {
+                lock_guard<mutex> lock(ringsMutex);
+                for (auto& ring : rings) moved += consume(*ring);
+            }
+            if (moved == 0) this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+
+    void writeText(TraceEvent type, uint64_t key, string_view text, TraceRing* ring) {
+        TraceRecord r{};
+        r.type = static_cast<uint16_t>(type);
+        r.packetId = key;
+        r.device = -1;
+        size_t offset = 0;
+        do {
+            size_t length = min(TraceRecord::chunkBytes, text.size() - offset);
+            char chunk[TraceRecord::chunkBytes] = {};
+            memcpy(chunk, text.data() + offset, length);
+            memcpy(&r.a, chunk, sizeof(r.a));
+            memcpy(&r.b, chunk + sizeof(r.a), sizeof(r.b));
+            r.text = static_cast<uint16_t>(length | (offset == 0 ? TraceRecord::firstChunk : 0));
+            if (ring) {
+                push(*ring, r);
+            } else {
+                file.write(reinterpret_cast<const char*>(&r), sizeof(r));
+            }
+            offset += length;
+        } while (offset < text.size());
+    }
 
 public:
-    Computer(int id, const string& name, const string& mac, const string& ip)
-        : NetworkDevice(id, name, mac), ipAddress(ip) {}
+    // Содержимое пакета попадает в журнал не длиннее этого
+    static constexpr size_t maxContentBytes = 256;
 
-    void sendPacket(const string& content, shared_ptr<NetworkDevice> target) {
-        if (!target) {
-            cout << "Ошибка: Неверное целевое устройство" << endl;
-            return;
+    static TraceLog& instance() {
+        static TraceLog log;
+        return log;
+    }
+
+    // Пишется ли журнал (консоль или файл): проверка на горячем пути без блокировок
+    static bool active() { return activeFlag(); }
+
+    TraceRing* createRing() {
+        lock_guard<mutex> lock(ringsMutex);
+        rings.push_back(make_unique<TraceRing>());
+        return rings.back().get();
+    }
+
+    // Забирает оставшиеся записи кольца и удаляет его
+    void releaseRing(TraceRing* ring) {
+        lock_guard<mutex> lock(ringsMutex);
+        consume(*ring);
+        rings.erase(remove_if(rings.begin(), rings.end(),
+                              [ring](const unique_ptr<TraceRing>& r) { return r.get() == ring; }),
+                    rings.end());
+    }
+
+    // Кольцо заполнено: при работающем фоновом потоке ждём его, иначе разбираем
+    // кольцо сами - это единственный читатель
+    void push(TraceRing& ring, const TraceRecord& record) {
+        while (!ring.tryPush(record)) {
+            if (writer.joinable()) {
+                this_thread::yield();
+            } else {
+                lock_guard<mutex> lock(ringsMutex);
+                consume(ring);
+            }
+        }
+    }
+
+    // ID для нового пакета и его содержимое в журнал
+    uint64_t registerPacket(TraceRing& ring, string_view content) {
+        uint64_t id = lastPacketId.fetch_add(1, memory_order_relaxed) + 1;
+        writeText(TraceEvent::PacketContent, id, content.substr(0, maxContentBytes), &ring);
+        return id;
+    }
+
+    void describeDevice(int id, string_view name) {
+        lock_guard<mutex> lock(ringsMutex);
+        consoleDecoder.setName(id, name);
+        if (file.is_open()) writeText(TraceEvent::DeviceName, static_cast<uint64_t>(id), name, nullptr);
+    }
+
+    // Переносит все накопленные записи. Вызывать, когда потоки моделирования стоят
+    void flush() {
+        if (writer.joinable()) {
+            while (true) {
+                {
+                    lock_guard<mutex> lock(ringsMutex);
+                    if (all_of(rings.begin(), rings.end(), [](const unique_ptr<TraceRing>& r) { return r->empty(); })) {
+                        file.flush();
+                        return;
+                    }
+                }
+                this_thread::yield();
+            }
         }
+        lock_guard<mutex> lock(ringsMutex);
+        for (auto& ring : rings) consume(*ring);
+    }
 
-        auto packet = make_shared<DataPacket>(content, content.size(), macAddress, target->getMac());
-        
-        for (auto& conn : connections) {
-            if (conn->connects(target)) {
-                cout << name << " отправляет пакет на " << target->getName() << endl;
-                conn->transferPacket(packet, shared_from_this());
-                return;
+    // Начинает запись журнала в файл; консольный вывод на это время отключается
+    void openFile(const string& path) {
+        closeFile();
+        flush();
+        lock_guard<mutex> lock(ringsMutex);
+        file.open(path, ios::binary | ios::trunc);
+        if (!file) {
+            throw runtime_error("Не удалось открыть файл журнала " + path);
+        }
+        file.write(fileMagic, sizeof(fileMagic));
+        updateActive();
+        stopWriter.store(false, memory_order_release);
+        writer = thread(&TraceLog::writerLoop, this);
+    }
+
+    void closeFile() {
+        if (!writer.joinable()) return;
+        flush();
+        stopWriter.store(true, memory_order_release);
+        writer.join();
+        lock_guard<mutex> lock(ringsMutex);
+        for (auto& ring : rings) consume(*ring);
+        file.close();
+        updateActive();
+    }
+
+    bool isWritingFile() const { return writer.joinable(); }
+
+    void setConsole(bool enabled) {
+        flush();
+        lock_guard<mutex> lock(ringsMutex);
+        console = enabled;
+        updateActive();
+    }
+
+    bool isConsole() const { return console; }
+
+    // Печатает сообщения из файла журнала в порядке записи. Файл читается дважды:
+    // содержимое пакета, созданного одним потоком, может попасть в файл позже сообщений
+    // другого потока об этом пакете, поэтому сначала собираются все служебные записи
+    static void decodeFile(const string& path, ostream& out) {
+        TraceDecoder decoder;
+        for (int pass = 0; pass < 2; ++pass) {
+            ifstream in(path, ios::binary);
+            char magic[sizeof(fileMagic)];
+            if (!in.read(magic, sizeof(magic)) || memcmp(magic, fileMagic, sizeof(magic)) != 0) {
+                throw runtime_error("Файл " + path + " не является журналом трассировки");
+            }
+            TraceRecord r;
+            while (in.read(reinterpret_cast<char*>(&r), sizeof(r))) {
+                bool service = r.type == static_cast<uint16_t>(TraceEvent::PacketContent) ||
+                               r.type == static_cast<uint16_t>(TraceEvent::DeviceName);
+                if (service == (pass == 0)) decoder.render(r, out);
             }
         }
-        cout << "Нет маршрута к " << target->getName() << endl;
+    }
+};
+
+// Запись трафика в формате pcap с наносекундными метками времени и канальным уровнем
+// Ethernet - для Wireshark и tcpdump. Заголовки Ethernet и IPv4 синтезируются из полей
+// DataPacket, за ними идут байты содержимого (не больше snapLength на кадр всего), а
+// исходной длиной кадра считаются заголовки плюс размер пакета. Запись собирается прямо
+// в большом буфере и уходит в файл блоками, без промежуточных строк. В параллельном
+// прогоне пишут потоки разных ЛП, поэтому запись идёт под спин-блокировкой: в
+// последовательном режиме она всегда свободна и стоит одну атомарную операцию.
+// Кадры разных ЛП при этом ложатся в файл не строго по времени
+class PcapWriter {
+private:
+    static constexpr size_t bufferBytes = 4 << 20;
+    static constexpr uint32_t magicNanoseconds = 0xA1B23C4D;
+    static constexpr uint32_t linkTypeEthernet = 1;
+    static constexpr uint16_t etherTypeIpv4 = 0x0800;
+    static constexpr uint16_t etherTypeLocal = 0x88B5; // IEEE 802 Local Experimental: кадр без IP
+    static constexpr uint8_t ipProtocolExperimental = 253;
+    static constexpr size_t recordHeaderBytes = 16;
+    static constexpr size_t ethernetBytes = 14;
+    static constexpr size_t ipv4Bytes = 20;
+
+    ofstream out;
+    vector<char> buffer;
+    size_t used;
+    uint32_t snapLength;
+    uint64_t frames;
+    atomic_flag busy = ATOMIC_FLAG_INIT;
+
+    template <typename T>
+    static char* put(char* p, T value) {
+        memcpy(p, &value, sizeof(value));
+        return p + sizeof(value);
     }
 
-    void processPacket(shared_ptr<DataPacket> packet) override {
-        cout << name << " получил пакет: " << packet->getContent() << endl;
-        receivedPackets.push_back(packet);
+    static char* putBig16(char* p, uint16_t value) {
+        p[0] = static_cast<char>(value >> 8);
+        p[1] = static_cast<char>(value);
+        return p + 2;
     }
 
-    void displayInfo() const override {
-        NetworkDevice::displayInfo();
-        cout << "IP: " << ipAddress 
-             << "\nПолучено пакетов: " << receivedPackets.size() << endl;
+    static char* putBig32(char* p, uint32_t value) {
+        p = putBig16(p, static_cast<uint16_t>(value >> 16));
+        return putBig16(p, static_cast<uint16_t>(value));
+    }
+
+    static char* putMac(char* p, MacAddress mac) {
+        uint64_t raw = mac.toUint64();
+        for (int i = 0; i < 6; ++i) {
+            *p++ = static_cast<char>(raw >> (40 - 8 * i));
+        }
+        return p;
+    }
+
+    // Заголовок IPv4 без опций; протокол 253 зарезервирован для экспериментов
+    static char* putIpv4(char* p, const DataPacket& packet) {
+        char* header = p;
+        uint16_t totalLength = static_cast<uint16_t>(min<size_t>(ipv4Bytes + packet.getSize(), 0xFFFF));
+        p = putBig16(p, 0x4500);                   // версия 4, длина заголовка 5 слов, TOS 0
+        p = putBig16(p, totalLength);
+        p = putBig16(p, static_cast<uint16_t>(packet.getTraceId())); // идентификатор
+        p = putBig16(p, 0);                        // флаги и смещение фрагмента
+        *p++ = static_cast<char>(max(0, min(packet.getTtl(), 255)));
+        *p++ = static_cast<char>(ipProtocolExperimental);
+        p = putBig16(p, 0);                        // контрольная сумма, считается ниже
+        p = putBig32(p, packet.getSourceIp());
+        p = putBig32(p, packet.getDestinationIp());
+
+        uint32_t sum = 0;
+        for (size_t i = 0; i < ipv4Bytes; i += 2) {
+            sum += (static_cast<uint8_t>(header[i]) << 8) | static_cast<uint8_t>(header[i + 1]);
+        }
+        while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+        putBig16(header + 10, static_cast<uint16_t>(~sum));
+        return p;
+    }
+
+    void flushBuffer() {
+        out.write(buffer.data(), static_cast<streamsize>(used));
+        used = 0;
+    }
+
+public:
+    // Кадр короче 64 байт не вместил бы синтезированные заголовки
+    static constexpr uint32_t minSnapLength = 64;
+
+    PcapWriter(const string& path, uint32_t snapLength)
+        : out(path, ios::binary | ios::trunc), buffer(bufferBytes), used(0), snapLength(snapLength), frames(0) {
+        if (!out) {
+            throw runtime_error("Не удалось создать файл " + path);
+        }
+        if (snapLength < minSnapLength || snapLength > 0xFFFF) {
+            throw runtime_error("Длина захвата кадра должна быть от " + to_string(minSnapLength) + " до 65535 байт");
+        }
+        char* p = buffer.data();
+        p = put<uint32_t>(p, magicNanoseconds);
+        p = put<uint16_t>(p, 2); // версия формата 2.4
+        p = put<uint16_t>(p, 4);
+        p = put<int32_t>(p, 0);  // часовой пояс
+        p = put<uint32_t>(p, 0); // точность меток
+        p = put<uint32_t>(p, snapLength);
+        p = put<uint32_t>(p, linkTypeEthernet);
+        used = static_cast<size_t>(p - buffer.data());
+    }
+
+    ~PcapWriter() { close(); }
+
+    PcapWriter(const PcapWriter&) = delete;
+    PcapWriter& operator=(const PcapWriter&) = delete;
+
+    void write(SimTime time, const DataPacket& packet) {
+        bool ip = packet.hasIpHeader();
+        size_t headerBytes = ethernetBytes + (ip ? ipv4Bytes : 0);
+        string_view content = packet.getContent();
+        size_t contentBytes = min<size_t>(min<size_t>(content.size(), static_cast<size_t>(max(packet.getSize(), 0))),
+                                          snapLength - headerBytes);
+        size_t recordBytes = recordHeaderBytes + headerBytes + contentBytes;
+
+        while (busy.test_and_set(memory_order_acquire)) {
+        }
+        if (used + recordBytes > buffer.size()) flushBuffer();
+        char* p = buffer.data() + used;
+        p = put<uint32_t>(p, static_cast<uint32_t>(time / 1000000000));
+        p = put<uint32_t>(p, static_cast<uint32_t>(time % 1000000000));
+        p = put<uint32_t>(p, static_cast<uint32_t>(headerBytes + contentBytes));
+        p = put<uint32_t>(p, static_cast<uint32_t>(headerBytes + max(packet.getSize(), 0)));
+        p = putMac(p, packet.getDestinationMac());
+        p = putMac(p, packet.getSourceMac());
+        p = putBig16(p, ip ? etherTypeIpv4 : etherTypeLocal);
+        if (ip) p = putIpv4(p, packet);
+        memcpy(p, content.data(), contentBytes);
+        used += recordBytes;
+        frames++;
+        busy.clear(memory_order_release);
+    }
+
+    // Дописывает буфер в файл: после этого файл можно открывать, не останавливая захват
+    void flush() {
+        if (used > 0) flushBuffer();
+        out.flush();
+    }
+
+    void close() {
+        if (out.is_open()) {
+            flush();
+            out.close();
+        }
     }
 
-    string getIp() const { return ipAddress; }
+    uint64_t getFrames() const { return frames; }
 };
 
-class Switch : public NetworkDevice {
-private:
-    int portCount;
-    map<string, shared_ptr<NetworkConnection>> macTable;
+// Гистограмма задержек в духе HdrHistogram: значения меньше 2 * subBuckets хранятся
+// точно, выше - по subBuckets корзин на каждую степень двойки, то есть с относительной
+// погрешностью не больше 1/subBuckets (~3%) на всём диапазоне SimTime. Запись - поиск
+// старшего бита и инкремент. Гистограммы разных потоков складываются поэлементно
+class LatencyHistogram {
+private:
+    static constexpr int subBucketBits = 5;
+    static constexpr uint64_t subBuckets = uint64_t(1) << subBucketBits;
+    static constexpr size_t bucketCount = (65 - subBucketBits) * subBuckets;
+
+    vector<uint64_t> counts; // пуст, пока ничего не записано
+    uint64_t total;
+    SimTime minValue;
+    SimTime maxValue;
+    double sum;
+
+    static int highestBit(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+        return 63 - __builtin_clzll(v);
+#else
+        int bit = 0;
+        while (v >>= 1) ++bit;
+        return bit;
+#endif
+    }
+
+    static size_t indexOf(uint64_t v) {
+        if (v < 2 * subBuckets) return static_cast<size_t>(v);
+        int shift = highestBit(v) - subBucketBits;
+        return static_cast<size_t>((shift + 1) * subBuckets + ((v >> shift) - subBuckets));
+    }
+
+    static uint64_t lowestValue(size_t index) {
+        if (index < 2 * subBuckets) return index;
+        int shift = static_cast<int>(index / subBuckets) - 1;
+        return (subBuckets + index % subBuckets) << shift;
+    }
+
+    static uint64_t highestValue(size_t index) {
+        return index + 1 < bucketCount ? lowestValue(index + 1) - 1 : numeric_limits<uint64_t>::max();
+    }
+
+public:
+    LatencyHistogram() : total(0), minValue(0), maxValue(0), sum(0.0) {}
+
+    void record(SimTime value) {
+        if (value < 0) value = 0;
+        if (counts.empty()) counts.assign(bucketCount, 0);
+        counts[indexOf(static_cast<uint64_t>(value))]++;
+        minValue = total ? min(minValue, value) : value;
+        maxValue = total ? max(maxValue, value) : value;
+        sum += static_cast<double>(value);
+        total++;
+    }
+
+    void merge(const LatencyHistogram& other) {
+        if (other.total == 0) return;
+        if (counts.empty()) counts.assign(bucketCount, 0);
+        for (size_t i = 0; i < bucketCount; ++i) counts[i] += other.counts[i];
+        minValue = total ? min(minValue, other.minValue) : other.minValue;
+        maxValue = total ? max(maxValue, other.maxValue) : other.maxValue;
+        sum += other.sum;
+        total += other.total;
+    }
+
+    void clear() {
+        counts.clear();
+        total = 0;
+        minValue = maxValue = 0;
+        sum = 0.0;
+    }
+
+    uint64_t getCount() const { return total; }
+    SimTime getMin() const { return minValue; }
+    SimTime getMax() const { return maxValue; }
+    double getMean() const { return total ? sum / total : 0.0; }
+
+    // Значение, не меньше которого percent процентов записей (верхняя граница корзины)
+    SimTime percentile(double percent) const {
+        if (total == 0) return 0;
+        uint64_t rank = max<uint64_t>(1, static_cast<uint64_t>(ceil(percent / 100.0 * total)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucketCount; ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return min(static_cast<SimTime>(min<uint64_t>(highestValue(i), numeric_limits<SimTime>::max())), maxValue);
+            }
+        }
+        return maxValue;
+    }
+
+    // Запись в контрольную точку: итоги и непустые корзины (определяются после CheckpointReader)
+    void saveState(CheckpointWriter& out) const;
+    void loadState(CheckpointReader& in);
+
+    // visit(нижняя граница, верхняя граница, число записей) для непустых корзин
+    template <typename Visitor>
+    void forEachBucket(Visitor visit) const {
+        for (size_t i = 0; i < counts.size(); ++i) {
+            if (counts[i]) visit(lowestValue(i), highestValue(i), counts[i]);
+        }
+    }
+};
+
+// Доставка потоков нагрузки по их номерам: сколько байт дошло до получателя и когда
+// пришёл последний пакет. Ведётся только по запросу (NetworkManager::measureFlowCompletion);
+// журналы логических процессов складываются так же, как гистограммы задержек
+class FlowCompletionLog {
+private:
+    vector<uint64_t> bytes;
+    vector<SimTime> lastArrival; // -1 - ни один пакет потока не дошёл
+
+public:
+    void resize(size_t flows) {
+        bytes.assign(flows, 0);
+        lastArrival.assign(flows, -1);
+    }
+
+    void clear() {
+        bytes.clear();
+        lastArrival.clear();
+    }
+
+    size_t size() const { return bytes.size(); }
+
+    void record(int flow, int size, SimTime time) {
+        if (flow < 0 || static_cast<size_t>(flow) >= bytes.size()) return;
+        bytes[flow] += static_cast<uint64_t>(size);
+        lastArrival[flow] = max(lastArrival[flow], time);
+    }
+
+    void merge(const FlowCompletionLog& other) {
+        if (bytes.size() < other.bytes.size()) {
+            bytes.resize(other.bytes.size(), 0);
+            lastArrival.resize(other.bytes.size(), -1);
+        }
+        for (size_t i = 0; i < other.bytes.size(); ++i) {
+            bytes[i] += other.bytes[i];
+            lastArrival[i] = max(lastArrival[i], other.lastArrival[i]);
+        }
+    }
+
+    uint64_t getBytes(size_t flow) const { return bytes[flow]; }
+    SimTime getLastArrival(size_t flow) const { return lastArrival[flow]; }
+};
+
+// Источник событий: устройство или одно направление соединения.
+// События упорядочиваются по ключу (время, uid источника, номер события у источника).
+// Ключ не зависит от того, как модель разбита на логические процессы, поэтому
+// параллельный прогон обрабатывает события каждого объекта в том же порядке,
+// что и последовательный, и даёт тот же результат.
+struct EventSource {
+    uint64_t uid;
+    uint64_t nextSeq;
+
+    explicit EventSource(uint64_t uid = 0) : uid(uid), nextSeq(0) {}
+};
+
+class NetworkConnection; // Forward declaration
+class NetworkDevice;
+class Simulator;
+
+// Поколенческий дескриптор объекта в SlotArray: номер слота и поколение. Слот после
+// удаления объекта переиспользуется с новым поколением, поэтому устаревший дескриптор
+// распознаётся сравнением двух чисел, без атомарных операций weak_ptr::lock
+template <typename T>
+struct Handle {
+    static constexpr uint32_t invalidIndex = numeric_limits<uint32_t>::max();
+
+    uint32_t index = invalidIndex;
+    uint32_t generation = 0;
+
+    bool isNull() const { return index == invalidIndex; }
+    bool operator==(const Handle& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const Handle& other) const { return !(*this == other); }
+};
+
+using DeviceHandle = Handle<NetworkDevice>;
+using LinkHandle = Handle<NetworkConnection>;
+
+// Массив слотов со списком свободных: объект по дескриптору - одна проверка поколения
+// и одно чтение указателя. Слот владеет объектом
+template <typename T>
+class SlotArray {
+private:
+    struct Slot {
+        shared_ptr<T> item;
+        uint32_t generation = 0;
+    };
+
+    vector<Slot> slots;
+    vector<uint32_t> freeSlots;
+    size_t live = 0;
+
+public:
+    Handle<T> insert(shared_ptr<T> item) {
+        uint32_t index;
+        if (!freeSlots.empty()) {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            index = static_cast<uint32_t>(slots.size());
+            slots.emplace_back();
+        }
+        slots[index].item = move(item);
+        ++live;
+        return {index, slots[index].generation};
+    }
+
+    // Освобождает слот; все выданные на него дескрипторы становятся недействительными
+    bool erase(Handle<T> handle) {
+        if (!get(handle)) return false;
+        Slot& slot = slots[handle.index];
+        slot.item.reset();
+        slot.generation++;
+        freeSlots.push_back(handle.index);
+        --live;
+        return true;
+    }
+
+    // nullptr, если объект удалён или дескриптор пуст
+    T* get(Handle<T> handle) const {
+        if (handle.index >= slots.size()) return nullptr;
+        const Slot& slot = slots[handle.index];
+        return slot.generation == handle.generation ? slot.item.get() : nullptr;
+    }
+
+    void clear() {
+        for (uint32_t i = 0; i < slots.size(); ++i) {
+            if (slots[i].item) {
+                slots[i].item.reset();
+                slots[i].generation++;
+                freeSlots.push_back(i);
+            }
+        }
+        live = 0;
+    }
+
+    void reserve(size_t count) { slots.reserve(count); }
+    size_t size() const { return live; }
+    size_t capacity() const { return slots.size(); }
+};
+
+// Владелец устройств и соединений модели. События и соединения ссылаются на объекты
+// дескрипторами, поэтому удаление устройства безопасно: события для него отбрасываются
+struct NetworkRegistry {
+    SlotArray<NetworkDevice> devices;
+    SlotArray<NetworkConnection> links;
+};
+
+// Запись состояния модели для контрольной точки (см. CheckpointStore). Числа пишутся в
+// порядке байтов машины, как и в файле топологии. Полезная нагрузка и пакет попадают в
+// сегмент один раз, повторные ссылки на них - номера уже записанных, поэтому пакет,
+// разосланный в несколько очередей, и после восстановления остаётся одним пакетом.
+// Без shareContent каждая ссылка пишется полностью: байты тогда зависят только от
+// содержимого, а не от того, какие пакеты разделяют память (сверка состояний)
+class CheckpointWriter {
+private:
+    string bytes;
+    bool shareContent;
+    unordered_map<const void*, uint32_t> payloads;
+    unordered_map<const DataPacket*, uint32_t> packets;
+
+public:
+    static constexpr uint32_t none = numeric_limits<uint32_t>::max();
+
+    explicit CheckpointWriter(bool shareContent = true) : shareContent(shareContent) {}
+
+    template <typename T>
+    void put(const T& value) {
+        static_assert(is_trivially_copyable<T>::value, "в контрольную точку пишутся только простые типы");
+        bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void putString(string_view s) {
+        put<uint64_t>(s.size());
+        bytes.append(s.data(), s.size());
+    }
+
+    template <typename T>
+    void putVector(const vector<T>& items) {
+        static_assert(is_trivially_copyable<T>::value, "в контрольную точку пишутся только простые типы");
+        put<uint64_t>(items.size());
+        bytes.append(reinterpret_cast<const char*>(items.data()), items.size() * sizeof(T));
+    }
+
+    // Ссылка на устройство или соединение по ID; present = false - объекта уже нет
+    void putReference(bool present, int32_t id) {
+        put<uint8_t>(present);
+        put<int32_t>(present ? id : 0);
+    }
+
+    void putPayload(const Payload& payload) {
+        if (payload.empty()) {
+            put(none);
+            return;
+        }
+        if (!shareContent) {
+            put(static_cast<uint32_t>(0));
+            putString(payload.view());
+            return;
+        }
+        auto [it, added] = payloads.emplace(payload.identity(), static_cast<uint32_t>(payloads.size()));
+        put(it->second);
+        if (added) putString(payload.view());
+    }
+
+    void putPacket(const DataPacket* packet) {
+        if (!packet) {
+            put(none);
+            return;
+        }
+        if (shareContent) {
+            auto [it, added] = packets.emplace(packet, static_cast<uint32_t>(packets.size()));
+            put(it->second);
+            if (!added) return;
+        } else {
+            put(static_cast<uint32_t>(0));
+        }
+        putPayload(packet->getPayload());
+        put<int32_t>(packet->getSize());
+        put<int32_t>(packet->getFlowId());
+        put(packet->getSourceMac().toUint64());
+        put(packet->getDestinationMac().toUint64());
+        put(packet->getSourceIp());
+        put(packet->getDestinationIp());
+        put<int32_t>(packet->getTtl());
+        put<int32_t>(packet->getDestinationNode());
+        put(packet->getTraceId());
+        put(packet->getSentAt());
+    }
+
+    // Генератор стандартной библиотеки - в его текстовом представлении
+    template <typename Engine>
+    void putEngine(const Engine& engine) {
+        ostringstream text;
+        text << engine;
+        putString(text.str());
+    }
+
+    const string& data() const { return bytes; }
+    size_t size() const { return bytes.size(); }
+};
+
+// Чтение сегмента контрольной точки. Каждое чтение проверяет границы, так что
+// повреждённый сегмент даёт исключение, а не чтение чужой памяти. Пакеты создаются в
+// пуле pool; ID устройств и соединений переводятся в дескрипторы через device и link
+class CheckpointReader {
+private:
+    const char* position;
+    const char* end;
+    PacketPool& pool;
+    vector<Payload> payloads;
+    vector<PacketRef> packets;
+
+    const char* take(size_t count) {
+        if (count > static_cast<size_t>(end - position)) corrupted("данные обрываются");
+        const char* start = position;
+        position += count;
+        return start;
+    }
+
+public:
+    function<DeviceHandle(int32_t)> device; // пустой дескриптор - устройства нет
+    function<LinkHandle(int32_t)> link;
+
+    CheckpointReader(string_view data, PacketPool& pool)
+        : position(data.data()), end(data.data() + data.size()), pool(pool) {}
+
+    [[noreturn]] static void corrupted(const string& what) {
+        throw runtime_error("Контрольная точка повреждена: " + what);
+    }
+
+    template <typename T>
+    T get() {
+        static_assert(is_trivially_copyable<T>::value, "из контрольной точки читаются только простые типы");
+        T value;
+        memcpy(&value, take(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    // Строка остаётся в буфере сегмента (отображённом файле)
+    string_view getBytes() {
+        uint64_t length = get<uint64_t>();
+        if (length > remaining()) corrupted("строка выходит за границы сегмента");
+        return string_view(take(static_cast<size_t>(length)), static_cast<size_t>(length));
+    }
+
+    template <typename T>
+    vector<T> getVector() {
+        uint64_t count = get<uint64_t>();
+        if (count > remaining() / sizeof(T)) corrupted("массив выходит за границы сегмента");
+        vector<T> items(static_cast<size_t>(count));
+        memcpy(items.data(), take(items.size() * sizeof(T)), items.size() * sizeof(T));
+        return items;
+    }
+
+    DeviceHandle getDevice() {
+        bool present = get<uint8_t>() != 0;
+        int32_t id = get<int32_t>();
+        return present ? device(id) : DeviceHandle();
+    }
+
+    LinkHandle getLink() {
+        bool present = get<uint8_t>() != 0;
+        int32_t id = get<int32_t>();
+        return present ? link(id) : LinkHandle();
+    }
+
+    Payload getPayload() {
+        uint32_t index = get<uint32_t>();
+        if (index == CheckpointWriter::none) return Payload();
+        if (index < payloads.size()) return payloads[index];
+        if (index != payloads.size()) corrupted("ссылка на незаписанное содержимое пакета");
+        payloads.emplace_back(string(getBytes()));
+        return payloads.back();
+    }
+
+    PacketRef getPacket() {
+        uint32_t index = get<uint32_t>();
+        if (index == CheckpointWriter::none) return PacketRef();
+        if (index < packets.size()) return packets[index];
+        if (index != packets.size()) corrupted("ссылка на незаписанный пакет");
+        Payload content = getPayload();
+        int size = get<int32_t>();
+        int flowId = get<int32_t>();
+        MacAddress sourceMac(get<uint64_t>());
+        MacAddress destinationMac(get<uint64_t>());
+        PacketRef packet = pool.acquire(content, size, sourceMac, destinationMac);
+        packet->setFlowId(flowId);
+        uint32_t sourceIp = get<uint32_t>();
+        uint32_t destinationIp = get<uint32_t>();
+        packet->setIpHeader(sourceIp, destinationIp, get<int32_t>());
+        packet->setDestinationNode(get<int32_t>());
+        packet->setTraceId(get<uint64_t>());
+        packet->setSentAt(get<int64_t>());
+        packets.push_back(packet);
+        return packet;
+    }
+
+    template <typename Engine>
+    void getEngine(Engine& engine) {
+        istringstream text{string(getBytes())};
+        text >> engine;
+        if (!text) corrupted("неверное состояние генератора случайных чисел");
+    }
+
+    size_t remaining() const { return static_cast<size_t>(end - position); }
+    bool done() const { return position == end; }
+};
+
+void LatencyHistogram::saveState(CheckpointWriter& out) const {
+    out.put(total);
+    if (total == 0) return;
+    out.put(minValue);
+    out.put(maxValue);
+    out.put(sum);
+    uint32_t used = static_cast<uint32_t>(count_if(counts.begin(), counts.end(), [](uint64_t c) { return c != 0; }));
+    out.put(used);
+    for (size_t i = 0; i < counts.size(); ++i) {
+        if (!counts[i]) continue;
+        out.put(static_cast<uint32_t>(i));
+        out.put(counts[i]);
+    }
+}
+
+void LatencyHistogram::loadState(CheckpointReader& in) {
+    clear();
+    uint64_t recorded = in.get<uint64_t>();
+    if (recorded == 0) return;
+    minValue = in.get<SimTime>();
+    maxValue = in.get<SimTime>();
+    sum = in.get<double>();
+    counts.assign(bucketCount, 0);
+    uint32_t used = in.get<uint32_t>();
+    for (uint32_t k = 0; k < used; ++k) {
+        uint32_t index = in.get<uint32_t>();
+        if (index >= bucketCount) CheckpointReader::corrupted("неверная корзина гистограммы задержек");
+        counts[index] = in.get<uint64_t>();
+    }
+    total = recorded;
+}
+
+// Замкнутый набор типов устройств. По тегу типа обработчик выбирается на этапе
+// компиляции (см. visitDevice), без виртуального вызова и dynamic_cast
+enum class DeviceKind : uint8_t { Computer, Switch, Phone, Router, Printer, Server };
+constexpr size_t deviceKindCount = 6;
+
+// Счётчики устройства для метрик; поля, которые тип устройства не ведёт, равны нулю
+struct DeviceCounters {
+    uint64_t received = 0;  // пакетов доставлено самому устройству
+    uint64_t sent = 0;      // пакетов отправлено как источник
+    uint64_t forwarded = 0; // переслано дальше (коммутатор, роутер)
+    uint64_t flooded = 0;   // разослано на все порты
+    uint64_t filtered = 0;  // не переслано: получатель в сегменте отправителя
+    uint64_t dropped = 0;   // отброшено устройством (нет маршрута, истёк TTL, офлайн)
+};
+
+class NetworkDevice : public enable_shared_from_this<NetworkDevice> {
+protected:
+    int id;
+    string name;
+    MacAddress macAddress;
+    DeviceKind kind;
+    vector<shared_ptr<class NetworkConnection>> connections;
+    Simulator* simulator;
+    EventSource eventSource;
+    DeviceHandle handle;          // дескриптор в NetworkRegistry
+    int routingIndex;             // номер устройства в RoutingService, -1 - маршруты не считались
+    vector<int16_t> nextHopPorts; // nextHopPorts[индекс получателя] - порт, -1 - недостижим
+    PcapWriter* ingressCapture;   // захват принятых кадров, nullptr - не захватываются
+    bool stateChanged;            // состояние менялось после последней контрольной точки
+
+public:
+    NetworkDevice(int id, const string& name, MacAddress mac, DeviceKind kind)
+        : id(id), name(name), macAddress(mac), kind(kind), simulator(nullptr),
+          eventSource(static_cast<uint32_t>(id)), routingIndex(-1), ingressCapture(nullptr), stateChanged(true) {}
+
+    virtual ~NetworkDevice() = default;
+
+    // Подключает соединение к следующему свободному порту и возвращает номер порта
+    int addConnection(shared_ptr<class NetworkConnection> conn) {
+        if (!hasFreePort()) {
+            throw runtime_error("У устройства " + name + " нет свободных портов");
+        }
+        connections.push_back(conn);
+        return static_cast<int>(connections.size()) - 1;
+    }
+
+    // IPv4-адрес устройства; 0 - у устройства нет IP
+    virtual uint32_t getIpAddress() const { return 0; }
+
+    // Может ли устройство служить шлюзом для пакетов к удалённым IP-адресам
+    virtual bool forwardsIp() const { return false; }
+
+    // Пропускает ли устройство через себя транзитный трафик (учитывается при расчёте путей)
+    virtual bool canTransit() const { return false; }
+
+    // Число портов устройства; 0 - без ограничения
+    virtual int getPortLimit() const { return 0; }
+
+    // Счётчики для метрик. Устройство меняет их только из потока своего логического
+    // процесса, поэтому счётчики не атомарные, а читаются между прогонами
+    virtual DeviceCounters getCounters() const { return {}; }
+
+    // Заранее выделяет место под count соединений (массовое построение сети)
+    void reserveConnections(size_t count) { connections.reserve(count); }
+
+    bool hasFreePort() const {
+        return getPortLimit() <= 0 || static_cast<int>(connections.size()) < getPortLimit();
+    }
+
+    // ingressPort - номер порта (индекс в connections), на который пришёл пакет
+    virtual void processPacket(PacketRef packet, int ingressPort) = 0;
+
+    // Срабатывание таймера, запланированного устройством через Simulator::scheduleTimer
+    virtual void onTimer(int timerId) { (void)timerId; }
+
+    // Состояние для контрольной точки: то, что меняется во время моделирования (счётчики,
+    // изученные адреса, потоки). Параметры устройства хранит образ топологии
+    virtual void saveState(CheckpointWriter& out) const { out.put(eventSource.nextSeq); }
+    virtual void loadState(CheckpointReader& in) { eventSource.nextSeq = in.get<uint64_t>(); }
+
+    // Изменения отмечает симулятор при доставке события устройству и методы, меняющие
+    // состояние вне прогона; в очередную контрольную точку попадают только отмеченные
+    void markChanged() { stateChanged = true; }
+    bool takeChanged() {
+        bool changed = stateChanged;
+        stateChanged = false;
+        return changed;
+    }
+
+    void setRoutingIndex(int index) { routingIndex = index; }
+    int getRoutingIndex() const { return routingIndex; }
+    void installRoutes(vector<int16_t> table) { nextHopPorts = move(table); }
+    const vector<int16_t>& getRouteTable() const { return nextHopPorts; }
+
+    void setRoutePort(int destinationNode, int16_t port) {
+        if (destinationNode >= static_cast<int>(nextHopPorts.size())) {
+            nextHopPorts.resize(destinationNode + 1, -1);
+        }
+        nextHopPorts[destinationNode] = port;
+    }
+
+    // Порт к получателю по таблице следующих переходов; -1 - маршрута нет
+    int routePort(int destinationNode) const {
+        if (destinationNode < 0 || destinationNode >= static_cast<int>(nextHopPorts.size())) return -1;
+        return nextHopPorts[destinationNode];
+    }
+
+    void setHandle(DeviceHandle h) { handle = h; }
+    DeviceHandle getHandle() const { return handle; }
+
+    void setIngressCapture(PcapWriter* writer) { ingressCapture = writer; }
+    PcapWriter* getIngressCapture() const { return ingressCapture; }
+
+    void attachSimulator(Simulator* sim) { simulator = sim; }
+    Simulator* getSimulator() const { return simulator; }
+    EventSource& getEventSource() { return eventSource; }
+
+    // Объявляем метод, но определяем его после класса NetworkConnection
+    virtual void displayInfo() const;
+
+    int getId() const { return id; }
+    const string& getName() const { return name; }
+    MacAddress getMac() const { return macAddress; }
+    DeviceKind getKind() const { return kind; }
+    vector<shared_ptr<class NetworkConnection>> getConnections() const { return connections; }
+    size_t getConnectionCount() const { return connections.size(); }
+};
+
+// Приведение к конкретному типу устройства по тегу; nullptr, если тип другой
+template <typename T>
+shared_ptr<T> deviceCast(const shared_ptr<NetworkDevice>& device) {
+    return device && device->getKind() == T::staticKind ? static_pointer_cast<T>(device) : nullptr;
+}
+
+// Событие модели: доставка пакета устройству, срабатывание таймера устройства
+// или окончание передачи кадра в одном из направлений соединения
+enum class EventType { PacketArrival, DeviceTimer, LinkTxComplete };
+
+// Поля упорядочены так, чтобы событие занимало 64 байта без выравнивающих пропусков:
+// очередь событий перемещает их при каждой вставке и извлечении
+struct SimEvent {
+    SimTime time;
+    uint64_t sourceUid;
+    uint64_t sourceSeq;
+    PacketRef packet;
+    DeviceHandle target;
+    LinkHandle link;
+    EventType type;
+    int timerId;
+    int direction;
+    int ingressPort;
+};
+
+// Событие, адресованное устройству другого логического процесса. Пакет едет копией:
+// пулы и счётчики ссылок PacketRef принадлежат своим потокам
+struct OutboundEvent {
+    SimEvent event;
+    DataPacket packet;
+    bool hasPacket;
+};
+
+struct SimEventLater {
+    bool operator()(const SimEvent& a, const SimEvent& b) const {
+        if (a.time != b.time) return a.time > b.time;
+        if (a.sourceUid != b.sourceUid) return a.sourceUid > b.sourceUid;
+        return a.sourceSeq > b.sourceSeq;
+    }
+};
+
+// Очередь событий с доступом к куче для контрольной точки: события читаются и заменяются
+// без извлечения. Ключи событий различны, поэтому порядок извлечения задаётся ими
+// однозначно и от расположения событий в куче не зависит
+class EventQueue : public priority_queue<SimEvent, vector<SimEvent>, SimEventLater> {
+public:
+    const vector<SimEvent>& items() const { return c; }
+
+    void assign(vector<SimEvent> heap) {
+        c = move(heap);
+        make_heap(c.begin(), c.end(), comp);
+    }
+};
+
+// Ядро дискретно-событийного моделирования: модельные часы и очередь событий.
+// Устройства и соединения не блокируются, а планируют будущие события;
+// run() обрабатывает их итеративно в порядке модельного времени.
+// В параллельном режиме каждый логический процесс имеет свой Simulator, а события
+// для устройств чужого процесса складываются в outbox и передаются на барьере.
+class Simulator {
+private:
+    EventQueue events;
+    SimTime currentTime;
+    uint64_t processedEvents;
+    EventSource externalSource; // события, запланированные вне обработчиков (из меню, генераторов)
+    EventSource* currentSource;
+    PacketPool* packetPool;
+    const NetworkRegistry* registry; // разрешает дескрипторы событий
+    int partition;
+    vector<vector<OutboundEvent>>* outbox; // outbox[p] - события для логического процесса p
+    bool pendingCleared;           // очередь очищалась после последней контрольной точки
+    uint64_t checkpointExternalSeq; // externalSource.nextSeq на момент последней контрольной точки
+
+    // Пакетная обработка: события устройств одного момента времени раскладываются по
+    // типам устройств, и обработчики каждого типа вызываются напрямую в цикле по своей пачке
+    struct DeviceWork {
+        NetworkDevice* target;
+        PacketRef packet; // пусто - срабатывание таймера
+        int ingressPort;
+        int timerId;
+        uint32_t order; // позиция в пачке своего типа
+    };
+    bool batchDispatch;
+    vector<DeviceWork> deviceBatches[deviceKindCount];
+    vector<BurstEntry> burstBuffer; // кадры одного устройства для processBurst
+
+    void handleLinkTxComplete(const SimEvent& ev);
+    uint64_t runBatch(uint64_t maxEvents);
+
+    TraceRing* traceRing; // кольцо журнала трассировки, создаётся при первой записи
+    LatencyHistogram latency; // задержки доставки, записанные устройствами этого симулятора
+    FlowCompletionLog flowLog; // доставка потоков нагрузки, пуст - не ведётся
+
+    TraceRing& ring() {
+        if (!traceRing) traceRing = TraceLog::instance().createRing();
+        return *traceRing;
+    }
+
+    // Определяются после классов устройств
+    template <typename T>
+    void dispatchBatch(vector<DeviceWork>& batch);
+    template <typename T>
+    void dispatchBursts(vector<DeviceWork>& batch);
+    void dispatchDeviceBatches();
+
+    // Проставляет время и ключ упорядочивания от текущего источника. Событие для устройства,
+    // принадлежащего другому логическому процессу (owner), уходит в outbox
+    void push(SimEvent ev, SimTime delay, Simulator* owner = nullptr) {
+        if (delay < 0) {
+            throw runtime_error("Нельзя планировать событие в прошлом");
+        }
+        ev.time = currentTime + delay;
+        ev.sourceUid = currentSource->uid;
+        ev.sourceSeq = currentSource->nextSeq++;
+        if (owner && owner != this && outbox) {
+            OutboundEvent out;
+            out.hasPacket = static_cast<bool>(ev.packet);
+            if (out.hasPacket) {
+                out.packet = *ev.packet;
+                ev.packet = PacketRef();
+            }
+            out.event = move(ev);
+            (*outbox)[owner->partition].push_back(move(out));
+        } else {
+            events.push(move(ev));
+        }
+    }
+
+public:
+    // Пакеты, создаваемые устройствами этого симулятора, берутся из pool
+    Simulator(PacketPool& pool, const NetworkRegistry& registry)
+        : currentTime(0), processedEvents(0), externalSource(numeric_limits<uint64_t>::max()),
+          currentSource(&externalSource), packetPool(&pool), registry(&registry), partition(0), outbox(nullptr),
+          pendingCleared(true), checkpointExternalSeq(0), batchDispatch(false), traceRing(nullptr) {}
+
+    ~Simulator() {
+        if (traceRing) TraceLog::instance().releaseRing(traceRing);
+    }
+
+    Simulator(const Simulator&) = delete;
+    Simulator& operator=(const Simulator&) = delete;
+
+    SimTime now() const { return currentTime; }
+    uint64_t getProcessedEvents() const { return processedEvents; }
+    // События, обработанные логическими процессами за этот симулятор
+    void addProcessedEvents(uint64_t count) { processedEvents += count; }
+    size_t pendingEvents() const { return events.size(); }
+    bool empty() const { return events.empty(); }
+    SimTime nextEventTime() const { return events.empty() ? SIM_TIME_INFINITY : events.top().time; }
+    PacketPool& getPacketPool() { return *packetPool; }
+
+    // Пакет, пришедший из чужого пула, заменяется копией из своего
+    PacketRef adoptPacket(PacketRef packet) {
+        if (packet && packet->getPool() != packetPool) {
+            return packetPool->acquire(*packet);
+        }
+        return packet;
+    }
+
+    void schedulePacketArrival(SimTime delay, const NetworkDevice& target, PacketRef packet, int ingressPort) {
+        SimEvent ev{};
+        ev.type = EventType::PacketArrival;
+        ev.ingressPort = ingressPort;
+        ev.target = target.getHandle();
+        ev.packet = move(packet);
+        push(move(ev), delay, target.getSimulator());
+    }
+
+    void scheduleTimer(SimTime delay, const NetworkDevice& target, int timerId) {
+        SimEvent ev{};
+        ev.type = EventType::DeviceTimer;
+        ev.target = target.getHandle();
+        ev.timerId = timerId;
+        push(move(ev), delay, target.getSimulator());
+    }
+
+    void scheduleLinkTxComplete(SimTime delay, LinkHandle link, int direction) {
+        SimEvent ev{};
+        ev.type = EventType::LinkTxComplete;
+        ev.link = link;
+        ev.direction = direction;
+        push(move(ev), delay);
+    }
+
+    const NetworkRegistry& getRegistry() const { return *registry; }
+
+    // Запись журнала трассировки от имени устройства device. Уровень level проверяется при
+    // компиляции: записи подробнее NETSIM_TRACE_LEVEL в код не попадают
+    template <int level>
+    void trace(TraceEvent event, int device, const DataPacket* packet = nullptr, uint64_t a = 0, uint64_t b = 0) {
+        if constexpr (level <= traceLevel) {
+            if (TraceLog::active()) {
+                TraceRecord r{currentTime, packet ? packet->getTraceId() : 0, a, b, device, static_cast<uint16_t>(event), 0};
+                TraceLog::instance().push(ring(), r);
+            }
+        } else {
+            (void)event, (void)device, (void)packet, (void)a, (void)b;
+        }
+    }
+
+    // Задержка от отправки до получения пакета. Каждый логический процесс пишет в свою
+    // гистограмму, а ParallelSimulator складывает их после прогона
+    void recordLatency(const DataPacket& packet) {
+        if (packet.getSentAt() >= 0) latency.record(currentTime - packet.getSentAt());
+    }
+
+    LatencyHistogram& getLatency() { return latency; }
+    const LatencyHistogram& getLatency() const { return latency; }
+
+    void recordFlowDelivery(const DataPacket& packet) {
+        if (packet.getFlowId() >= 0) flowLog.record(packet.getFlowId(), packet.getSize(), currentTime);
+    }
+
+    FlowCompletionLog& getFlowLog() { return flowLog; }
+
+    // ID нового пакета в журнале (0 - журнал не пишется)
+    uint64_t tracePacket(string_view content) {
+        if constexpr (traceLevel > 0) {
+            if (TraceLog::active()) return TraceLog::instance().registerPacket(ring(), content);
+        } else {
+            (void)content;
+        }
+        return 0;
+    }
+
+    // События одного момента модельного времени обрабатываются пачкой: сначала по
+    // порядку ключей освобождаются передатчики соединений, затем события устройств
+    // группируются по типам. События каждого устройства сохраняют свой порядок, а
+    // разные устройства одного момента общего состояния не имеют. Результат совпадает
+    // с обычным режимом, кроме одного: кадр, пришедший в момент освобождения
+    // передатчика, сразу уходит на линию, а не проходит через очередь (и RED)
+    void setBatchDispatch(bool enabled) { batchDispatch = enabled; }
+    bool isBatchDispatch() const { return batchDispatch; }
+
+    // Обрабатывает события до момента until или пока не будет обработано maxEvents событий.
+    // Возвращает количество обработанных за вызов событий.
+    // Определяется после NetworkConnection, так как вызывает его методы.
+    uint64_t run(SimTime until = SIM_TIME_INFINITY,
+                 uint64_t maxEvents = numeric_limits<uint64_t>::max());
+
+    // Вставляет уже спланированное событие (с готовым временем и ключом), например
+    // забранное у другого симулятора через takePending
+    void insert(SimEvent ev) {
+        ev.packet = adoptPacket(move(ev.packet));
+        events.push(move(ev));
+    }
+
+    // Принимает событие, пришедшее от другого логического процесса
+    void insert(OutboundEvent&& out) {
+        if (out.event.time < currentTime) {
+            throw runtime_error("Событие от другого логического процесса пришло в прошлое: " +
+                              to_string(out.event.time) + " < " + to_string(currentTime));
+        }
+        if (out.hasPacket) {
+            out.event.packet = packetPool->acquire(out.packet);
+        }
+        events.push(move(out.event));
+    }
+
+    // Забирает все запланированные события (для раздачи по логическим процессам)
+    vector<SimEvent> takePending() {
+        vector<SimEvent> result;
+        result.reserve(events.size());
+        while (!events.empty()) {
+            result.push_back(events.top());
+            events.pop();
+        }
+        return result;
+    }
+
+    void configurePartition(int index, vector<vector<OutboundEvent>>* out) {
+        partition = index;
+        outbox = out;
+    }
+
+    // Переводит часы вперёд, например после параллельного прогона
+    void advanceTo(SimTime t) {
+        currentTime = max(currentTime, t);
+    }
+
+    // Отбрасывает запланированные события, не трогая модельные часы
+    void clearPending() {
+        events = EventQueue();
+        pendingCleared = true;
+    }
+
+    void reset() {
+        clearPending();
+        currentTime = 0;
+        processedEvents = 0;
+        externalSource.nextSeq = 0;
+        latency.clear();
+        flowLog.clear();
+    }
+
+    // Часы, счётчики и гистограмма задержек. Определяются после классов устройств
+    void saveState(CheckpointWriter& out) const;
+    void loadState(CheckpointReader& in);
+
+    // Запланированные события с их пакетами в порядке ключей; адресаты записываются по ID.
+    // С changed пишутся только события, которые запланировал или должен обработать объект
+    // из changed (по uid источника событий), а также события удалённых адресатов: только
+    // они могли появиться или исчезнуть, пока остальные объекты не менялись. loadEvents
+    // с тем же changed заменяет ровно эти события, без него - всю очередь
+    void saveEvents(CheckpointWriter& out, const unordered_set<uint64_t>* changed) const;
+    void loadEvents(CheckpointReader& in, const unordered_set<uint64_t>* changed);
+
+    // Очищалась ли очередь после прошлой контрольной точки (тогда она пишется целиком)
+    // и планировались ли события извне; отметки снимаются
+    bool takePendingCleared() {
+        bool cleared = pendingCleared;
+        pendingCleared = false;
+        return cleared;
+    }
+
+    bool takeExternalChanged() {
+        bool changed = externalSource.nextSeq != checkpointExternalSeq;
+        checkpointExternalSeq = externalSource.nextSeq;
+        return changed;
+    }
+
+    uint64_t getExternalSourceUid() const { return externalSource.uid; }
+
+private:
+    // Источник событий адресата события; nullptr - адресат удалён
+    const EventSource* targetSource(const SimEvent& ev) const;
+    bool affectedBy(const SimEvent& ev, const unordered_set<uint64_t>& changed) const;
+};
+
+// Кольцевой буфер фиксированной ёмкости (FIFO без перераспределения памяти)
+template<typename T>
+class RingBuffer {
+private:
+    vector<T> slots; // выделяется при первой записи: у большинства соединений очередь не нужна
+    size_t limit;
+    size_t head;
+    size_t count;
+
+public:
+    explicit RingBuffer(size_t capacity) : limit(capacity), head(0), count(0) {}
+
+    bool push(T value) {
+        if (full()) return false;
+        if (slots.empty()) slots.resize(limit);
+        slots[(head + count) % slots.size()] = move(value);
+        ++count;
+        return true;
+    }
+
+    T pop() {
+        T value = move(slots[head]);
+        slots[head] = T();
+        head = (head + 1) % slots.size();
+        --count;
+        return value;
+    }
+
+    void clear() {
+        while (!empty()) pop();
+        head = 0;
+    }
+
+    // i-й элемент от начала очереди
+    T& at(size_t i) { return slots[(head + i) % slots.size()]; }
+    const T& at(size_t i) const { return slots[(head + i) % slots.size()]; }
+
+    size_t size() const { return count; }
+    size_t capacity() const { return limit; }
+    bool empty() const { return count == 0; }
+    bool full() const { return count == limit; }
+};
+
+// Политика отбрасывания при заполнении очереди соединения
+enum class DropPolicy { DropTail, RED };
+
+// Статистика одного направления соединения
+struct LinkStats {
+    uint64_t transmittedPackets = 0;
+    uint64_t transmittedBytes = 0;
+    uint64_t droppedTail = 0;   // отброшено из-за переполнения буфера
+    uint64_t droppedRed = 0;    // отброшено ранним обнаружением RED
+    uint64_t droppedDown = 0;   // отброшено, пока соединение отключено
+    size_t queueDepth = 0;
+    size_t maxQueueDepth = 0;
+    SimTime busyTime = 0;       // суммарное время сериализации: занятость = busyTime / время
+
+    uint64_t dropped() const { return droppedTail + droppedRed + droppedDown; }
+};
+
+class NetworkConnection : public enable_shared_from_this<NetworkConnection> {
+private:
+    // Передатчик одного направления: кадр на линии и очередь ожидающих
+    struct Direction {
+        RingBuffer<PacketRef> queue;
+        bool busy;
+        double averageDepth; // сглаженная длина очереди для RED
+        minstd_rand redRng;  // компактный генератор: соединений в модели могут быть миллионы
+        LinkStats stats;
+        EventSource eventSource;
+        bool changed; // менялось после последней контрольной точки
+
+        Direction(size_t capacity, unsigned seed, uint64_t sourceUid)
+            : queue(capacity), busy(false), averageDepth(0.0), redRng(seed), eventSource(sourceUid), changed(true) {}
+    };
+
+    // uid источников событий соединений не пересекаются с uid устройств
+    static uint64_t directionSourceUid(int linkId, int dirIndex) {
+        return (1ULL << 62) | (static_cast<uint64_t>(linkId) << 1) | static_cast<uint64_t>(dirIndex);
+    }
+
+    int id;
+    LinkHandle handle;      // дескриптор в NetworkRegistry
+    NetworkDevice* ends[2]; // первое и второе устройство; nullptr - устройство удалено
+    int ports[2];           // номера портов соединения на ends[0] и ends[1]
+    float bandwidth;
+    int latency;
+    bool up; // отключённое соединение не принимает новые пакеты
+    DropPolicy dropPolicy;
+    PcapWriter* capture; // захват кадров, выданных на линию; nullptr - не захватываются
+    Direction directions[2]; // 0: device1 -> device2, 1: device2 -> device1
+
+    // Параметры RED относительно ёмкости буфера
+    static constexpr double redWeight = 0.002;
+    static constexpr double redMinFraction = 0.25;
+    static constexpr double redMaxFraction = 0.75;
+    static constexpr double redMaxProbability = 0.1;
+
+    bool shouldDropEarly(Direction& dir) {
+        if (dropPolicy != DropPolicy::RED) return false;
+
+        dir.averageDepth = (1.0 - redWeight) * dir.averageDepth + redWeight * dir.queue.size();
+        double minThreshold = redMinFraction * dir.queue.capacity();
+        double maxThreshold = redMaxFraction * dir.queue.capacity();
+        if (dir.averageDepth < minThreshold) return false;
+        if (dir.averageDepth >= maxThreshold) return true;
+
+        double probability = redMaxProbability * (dir.averageDepth - minThreshold) / (maxThreshold - minThreshold);
+        return uniform_real_distribution<double>(0.0, 1.0)(dir.redRng) < probability;
+    }
+
+    // Выдаёт кадр на линию: через время сериализации передатчик освобождается,
+    // ещё через latency кадр приходит на другой конец
+    void startTransmission(int dirIndex, PacketRef packet, Simulator* sim) {
+        Direction& dir = directions[dirIndex];
+        NetworkDevice* receiver = ends[1 - dirIndex];
+        if (!receiver) return;
+
+        SimTime txTime = serializationDelay(packet->getSize());
+        dir.busy = true;
+        dir.stats.transmittedPackets++;
+        dir.stats.transmittedBytes += packet->getSize();
+        dir.stats.busyTime += txTime;
+        if (capture) capture->write(sim->now(), *packet);
+
+        sim->scheduleLinkTxComplete(txTime, handle, dirIndex);
+        sim->schedulePacketArrival(txTime + fromMilliseconds(latency), *receiver, move(packet), ports[1 - dirIndex]);
+    }
+
+public:
+    NetworkConnection(int id,
+                     shared_ptr<NetworkDevice> dev1, 
+                     shared_ptr<NetworkDevice> dev2, 
+                     float bw, int lat,
+                     size_t queueCapacity = 64, DropPolicy policy = DropPolicy::DropTail,
+                     unsigned seed = 0)
+        : id(id), ends{dev1.get(), dev2.get()}, ports{-1, -1}, bandwidth(bw), latency(lat), up(true), dropPolicy(policy),
+          capture(nullptr),
+          directions{Direction(queueCapacity, seed, directionSourceUid(id, 0)),
+                     Direction(queueCapacity, seed + 1, directionSourceUid(id, 1))} {
+        if (queueCapacity == 0) {
+            throw runtime_error("Ёмкость очереди соединения должна быть больше нуля");
+        }
+    }
+
+    // Время выдачи кадра на линию: размер в битах / пропускная способность (Мбит/с = бит/мкс)
+    SimTime serializationDelay(int sizeBytes) const { return serializationDelay(sizeBytes, bandwidth); }
+
+    // Пропускная способность в виде битов float - для записей журнала
+    uint64_t bandwidthBits() const {
+        uint32_t raw;
+        memcpy(&raw, &bandwidth, sizeof(raw));
+        return raw;
+    }
+
+    static SimTime serializationDelay(int sizeBytes, float bandwidthMbps) {
+        return static_cast<SimTime>(llround(sizeBytes * 8.0 * 1000.0 / bandwidthMbps));
+    }
+
+    // Передаёт пакет на другой конец соединения: если передатчик занят, пакет ждёт в
+    // очереди своего направления, а при её переполнении отбрасывается согласно dropPolicy
+    void transferPacket(PacketRef packet, NetworkDevice* sender) {
+        int dirIndex;
+        if (sender == ends[0]) {
+            dirIndex = 0;
+        } else if (sender == ends[1]) {
+            dirIndex = 1;
+        } else {
+            return;
+        }
+
+        Simulator* sim = sender->getSimulator();
+        if (!sim) {
+            throw runtime_error("Устройство " + sender->getName() + " не подключено к симулятору");
+        }
+
+        Direction& dir = directions[dirIndex];
+        dir.changed = true;
+        int senderId = sender->getId();
+        if (!up) {
+            dir.stats.droppedDown++;
+            sim->trace<traceDrops>(TraceEvent::LinkDownDrop, senderId, packet.get());
+            return;
+        }
+        if (!dir.busy) {
+            sim->trace<traceHops>(TraceEvent::LinkTransmit, senderId, packet.get(), bandwidthBits(), latency);
+            startTransmission(dirIndex, move(packet), sim);
+            return;
+        }
+
+        if (dir.queue.full()) {
+            dir.stats.droppedTail++;
+            sim->trace<traceDrops>(TraceEvent::LinkQueueDrop, senderId, packet.get());
+            return;
+        }
+        if (shouldDropEarly(dir)) {
+            dir.stats.droppedRed++;
+            sim->trace<traceDrops>(TraceEvent::LinkRedDrop, senderId, packet.get());
+            return;
+        }
+
+        sim->trace<traceHops>(TraceEvent::LinkQueued, senderId, packet.get(), bandwidthBits(), latency);
+        dir.queue.push(move(packet));
+        dir.stats.queueDepth = dir.queue.size();
+        dir.stats.maxQueueDepth = max(dir.stats.maxQueueDepth, dir.queue.size());
+    }
+
+    // Передатчик направления освободился: выдаём следующий кадр из очереди
+    void onTransmissionComplete(int dirIndex, Simulator* sim) {
+        Direction& dir = directions[dirIndex];
+        dir.changed = true;
+        dir.busy = false;
+        if (!dir.queue.empty()) {
+            startTransmission(dirIndex, dir.queue.pop(), sim);
+        }
+        dir.stats.queueDepth = dir.queue.size();
+    }
+
+    // Переводит ожидающие в очереди пакеты в пул симулятора, который будет обслуживать
+    // передатчик направления (при смене логического процесса)
+    void adoptQueuedPackets(int dirIndex, Simulator& sim) {
+        Direction& dir = directions[dirIndex];
+        for (size_t i = 0; i < dir.queue.size(); ++i) {
+            dir.queue.at(i) = sim.adoptPacket(move(dir.queue.at(i)));
+        }
+    }
+
+    // Сбрасывает очереди и состояние передатчиков (при очистке модели)
+    void resetQueues() {
+        for (auto& dir : directions) {
+            dir.queue.clear();
+            dir.busy = false;
+            dir.averageDepth = 0.0;
+            dir.stats.queueDepth = 0;
+            dir.changed = true;
+        }
+    }
+
+    // Состояние передатчиков для контрольной точки: очереди с пакетами, занятость,
+    // генераторы RED, статистика и ключи событий направлений
+    void saveState(CheckpointWriter& out) const {
+        for (const auto& dir : directions) {
+            out.put<uint8_t>(dir.busy);
+            out.put(dir.averageDepth);
+            out.putEngine(dir.redRng);
+            out.put(dir.stats);
+            out.put(dir.eventSource.nextSeq);
+            out.put<uint64_t>(dir.queue.size());
+            for (size_t i = 0; i < dir.queue.size(); ++i) {
+                out.putPacket(dir.queue.at(i).get());
+            }
+        }
+    }
+
+    void loadState(CheckpointReader& in) {
+        for (auto& dir : directions) {
+            dir.busy = in.get<uint8_t>() != 0;
+            dir.averageDepth = in.get<double>();
+            in.getEngine(dir.redRng);
+            dir.stats = in.get<LinkStats>();
+            dir.eventSource.nextSeq = in.get<uint64_t>();
+            dir.queue.clear();
+            uint64_t queued = in.get<uint64_t>();
+            for (uint64_t i = 0; i < queued; ++i) {
+                PacketRef packet = in.getPacket();
+                if (!packet || !dir.queue.push(move(packet))) {
+                    CheckpointReader::corrupted("неверная очередь соединения " + to_string(id));
+                }
+            }
+        }
+    }
+
+    // Менялось ли соединение после прошлой контрольной точки; отметка снимается
+    bool takeChanged() {
+        bool changed = directions[0].changed || directions[1].changed;
+        directions[0].changed = directions[1].changed = false;
+        return changed;
+    }
+
+    void setCapture(PcapWriter* writer) { capture = writer; }
+    PcapWriter* getCapture() const { return capture; }
+
+    void setDropPolicy(DropPolicy policy) { dropPolicy = policy; }
+    DropPolicy getDropPolicy() const { return dropPolicy; }
+    size_t getQueueCapacity() const { return directions[0].queue.capacity(); }
+
+    // Статистика направления: 0 - от первого устройства ко второму, 1 - обратно
+    const LinkStats& getStats(int dirIndex) const { return directions[dirIndex].stats; }
+
+    EventSource& getEventSource(int dirIndex) { return directions[dirIndex].eventSource; }
+
+    // Устройство, чей передатчик обслуживает направление (его логический процесс владеет очередью)
+    NetworkDevice* getSender(int dirIndex) const { return ends[dirIndex]; }
+
+    int getId() const { return id; }
+    void setHandle(LinkHandle h) { handle = h; }
+    LinkHandle getHandle() const { return handle; }
+
+    // Отсоединяет удаляемое устройство: соединение отключается, очереди сбрасываются,
+    // а порт уцелевшего соседа остаётся занят мёртвым соединением
+    void detach(const NetworkDevice* device) {
+        for (auto& end : ends) {
+            if (end == device) end = nullptr;
+        }
+        up = false;
+        resetQueues();
+    }
+
+    void setPorts(int port1, int port2) {
+        ports[0] = port1;
+        ports[1] = port2;
+    }
+
+    // Номер порта соединения на первом (side = 0) или втором (side = 1) устройстве
+    int getPort(int side) const { return ports[side]; }
+
+    void setUp(bool state) { up = state; }
+    bool isUp() const { return up; }
+
+    bool connects(const NetworkDevice* dev) const {
+        return dev && (ends[0] == dev || ends[1] == dev);
+    }
+
+    // Второй конец соединения без обращения к счётчикам ссылок
+    NetworkDevice* otherEnd(const NetworkDevice* dev) const {
+        if (dev == ends[0]) return ends[1];
+        if (dev == ends[1]) return ends[0];
+        return nullptr;
+    }
+
+    // Устройство на стороне side (0 - первое, 1 - второе) или nullptr
+    NetworkDevice* getEnd(int side) const { return ends[side]; }
+
+    shared_ptr<NetworkDevice> getOtherDevice(shared_ptr<NetworkDevice> dev) const {
+        // Если передан nullptr, возвращаем первое устройство
+        NetworkDevice* other = dev ? otherEnd(dev.get()) : ends[0];
+        return other ? other->shared_from_this() : nullptr;
+    }
+
+    shared_ptr<NetworkDevice> getFirstDevice() const {
+        return ends[0] ? ends[0]->shared_from_this() : nullptr;
+    }
+    
+    shared_ptr<NetworkDevice> getSecondDevice() const {
+        return ends[1] ? ends[1]->shared_from_this() : nullptr;
+    }
+
+    float getBandwidth() const { return bandwidth; }
+    int getLatency() const { return latency; }
+};
+
+uint64_t Simulator::run(SimTime until, uint64_t maxEvents) {
+    uint64_t handled = 0;
+    while (!events.empty() && handled < maxEvents) {
+        if (events.top().time > until) break;
+        if (batchDispatch) {
+            handled += runBatch(maxEvents - handled);
+            continue;
+        }
+
+        // Извлекаем событие до обработки: обработчик может планировать новые
+        SimEvent ev = events.top();
+        events.pop();
+        currentTime = ev.time;
+
+        // Всё, что планирует обработчик, получает ключи от объекта, которому адресовано событие.
+        // События для удалённых устройств и соединений отбрасываются
+        switch (ev.type) {
+            case EventType::PacketArrival:
+                if (NetworkDevice* target = registry->devices.get(ev.target)) {
+                    currentSource = &target->getEventSource();
+                    target->markChanged();
+                    if (PcapWriter* tap = target->getIngressCapture()) tap->write(currentTime, *ev.packet);
+                    target->processPacket(move(ev.packet), ev.ingressPort);
+                }
+                break;
+            case EventType::DeviceTimer:
+                if (NetworkDevice* target = registry->devices.get(ev.target)) {
+                    currentSource = &target->getEventSource();
+                    target->markChanged();
+                    target->onTimer(ev.timerId);
+                }
+                break;
+            case EventType::LinkTxComplete:
+                handleLinkTxComplete(ev);
+                break;
+        }
+        currentSource = &externalSource;
+        ++handled;
+    }
+    processedEvents += handled;
+    return handled;
+}
+
+void Simulator::handleLinkTxComplete(const SimEvent& ev) {
+    if (NetworkConnection* link = registry->links.get(ev.link)) {
+        currentSource = &link->getEventSource(ev.direction);
+        link->onTransmissionComplete(ev.direction, this);
+        currentSource = &externalSource;
+    }
+}
+
+// Извлекает события текущего момента: передатчики соединений обслуживаются сразу,
+// события устройств раскладываются по типам и обрабатываются после извлечения
+uint64_t Simulator::runBatch(uint64_t maxEvents) {
+    SimTime batchTime = events.top().time;
+    currentTime = batchTime;
+    uint64_t taken = 0;
+    while (taken < maxEvents && !events.empty() && events.top().time == batchTime) {
+        SimEvent ev = events.top();
+        events.pop();
+        ++taken;
+        if (ev.type == EventType::LinkTxComplete) {
+            handleLinkTxComplete(ev);
+        } else if (NetworkDevice* target = registry->devices.get(ev.target)) {
+            target->markChanged();
+            if (ev.packet) {
+                if (PcapWriter* tap = target->getIngressCapture()) tap->write(currentTime, *ev.packet);
+            }
+            vector<DeviceWork>& batch = deviceBatches[static_cast<size_t>(target->getKind())];
+            batch.push_back({target, move(ev.packet), ev.ingressPort, ev.timerId, static_cast<uint32_t>(batch.size())});
+        }
+    }
+    dispatchDeviceBatches();
+    return taken;
+}
+
+void Simulator::saveState(CheckpointWriter& out) const {
+    out.put(currentTime);
+    out.put(processedEvents);
+    out.put(externalSource.nextSeq);
+    latency.saveState(out);
+}
+
+void Simulator::loadState(CheckpointReader& in) {
+    currentTime = in.get<SimTime>();
+    processedEvents = in.get<uint64_t>();
+    externalSource.nextSeq = in.get<uint64_t>();
+    latency.loadState(in);
+}
+
+const EventSource* Simulator::targetSource(const SimEvent& ev) const {
+    if (ev.type == EventType::LinkTxComplete) {
+        NetworkConnection* link = registry->links.get(ev.link);
+        return link ? &link->getEventSource(ev.direction) : nullptr;
+    }
+    NetworkDevice* target = registry->devices.get(ev.target);
+    return target ? &target->getEventSource() : nullptr;
+}
+
+bool Simulator::affectedBy(const SimEvent& ev, const unordered_set<uint64_t>& changed) const {
+    const EventSource* target = targetSource(ev);
+    return !target || changed.count(target->uid) || changed.count(ev.sourceUid);
+}
+
+void Simulator::saveEvents(CheckpointWriter& out, const unordered_set<uint64_t>* changed) const {
+    vector<const SimEvent*> pending;
+    for (const SimEvent& ev : events.items()) {
+        if (!changed || affectedBy(ev, *changed)) pending.push_back(&ev);
+    }
+    sort(pending.begin(), pending.end(), [](const SimEvent* a, const SimEvent* b) { return SimEventLater()(*b, *a); });
+    out.put<uint64_t>(pending.size());
+    for (const SimEvent* ev : pending) {
+        out.put(ev->time);
+        out.put(ev->sourceUid);
+        out.put(ev->sourceSeq);
+        out.put(static_cast<uint8_t>(ev->type));
+        if (ev->type == EventType::LinkTxComplete) {
+            const NetworkConnection* link = registry->links.get(ev->link);
+            out.putReference(link != nullptr, link ? link->getId() : 0);
+            out.put<int32_t>(ev->direction);
+        } else {
+            const NetworkDevice* target = registry->devices.get(ev->target);
+            out.putReference(target != nullptr, target ? target->getId() : 0);
+            out.put<int32_t>(ev->type == EventType::PacketArrival ? ev->ingressPort : ev->timerId);
+            if (ev->type == EventType::PacketArrival) out.putPacket(ev->packet.get());
+        }
+    }
+}
+
+void Simulator::loadEvents(CheckpointReader& in, const unordered_set<uint64_t>* changed) {
+    vector<SimEvent> pending;
+    if (changed) {
+        for (const SimEvent& ev : events.items()) {
+            if (!affectedBy(ev, *changed)) pending.push_back(ev);
+        }
+    }
+    uint64_t count = in.get<uint64_t>();
+    if (count > in.remaining() / 32) CheckpointReader::corrupted("неверное число событий");
+    pending.reserve(pending.size() + static_cast<size_t>(count));
+    for (uint64_t i = 0; i < count; ++i) {
+        SimEvent ev{};
+        ev.time = in.get<SimTime>();
+        ev.sourceUid = in.get<uint64_t>();
+        ev.sourceSeq = in.get<uint64_t>();
+        uint8_t type = in.get<uint8_t>();
+        if (type > static_cast<uint8_t>(EventType::LinkTxComplete)) {
+            CheckpointReader::corrupted("неизвестный тип события " + to_string(type));
+        }
+        ev.type = static_cast<EventType>(type);
+        if (ev.type == EventType::LinkTxComplete) {
+            ev.link = in.getLink();
+            ev.direction = in.get<int32_t>();
+            if (ev.direction != 0 && ev.direction != 1) CheckpointReader::corrupted("неверное направление соединения");
+        } else {
+            ev.target = in.getDevice();
+            int32_t argument = in.get<int32_t>();
+            if (ev.type == EventType::PacketArrival) {
+                ev.ingressPort = argument;
+                ev.packet = in.getPacket();
+                if (!ev.packet) CheckpointReader::corrupted("доставка без пакета");
+            } else {
+                ev.timerId = argument;
+            }
+        }
+        pending.push_back(move(ev));
+    }
+    events.assign(move(pending));
+}
+
+class Computer final : public NetworkDevice {
+private:
+    // Поток нагрузки: пакеты по packetBytes байт уходят по таймеру через interval,
+    // пока не отправлено remainingBytes (см. NetworkManager::scheduleWorkload)
+    struct Flow {
+        DeviceHandle target;
+        uint64_t remainingBytes;
+        SimTime interval;
+        int packetBytes;
+        int flowId; // номер потока в нагрузке, им помечаются пакеты
+        Payload content;
+    };
+
+    uint32_t ipAddress;
+    uint64_t receivedPackets;
+    uint64_t sentPackets;
+    uint64_t noRouteDrops;
+    vector<Flow> flows; // номер потока - номер его таймера
+    size_t activeFlows;
+
+    // Отправляет готовый пакет: напрямую, по рассчитанному пути или через шлюз
+    void transmit(PacketRef packet, const NetworkDevice& target) {
+        packet->setIpHeader(ipAddress, target.getIpAddress());
+        packet->setDestinationNode(target.getRoutingIndex());
+        packet->setSentAt(simulator->now());
+        uint64_t targetId = static_cast<uint32_t>(target.getId());
+        sentPackets++;
+        stateChanged = true;
+
+        for (auto& conn : connections) {
+            if (conn->connects(&target)) {
+                simulator->trace<traceHops>(TraceEvent::HostSend, id, packet.get(), targetId);
+                conn->transferPacket(packet, this);
+                return;
+            }
+        }
+        // Многошаговый путь, рассчитанный RoutingService
+        int port = routePort(target.getRoutingIndex());
+        if (port >= 0) {
+            simulator->trace<traceHops>(TraceEvent::HostSendViaPort, id, packet.get(), targetId, port);
+            connections[port]->transferPacket(packet, this);
+            return;
+        }
+        // Удалённый узел с IP-адресом: отдаём пакет первому подключённому роутеру (шлюзу)
+        if (packet->hasIpHeader()) {
+            for (auto& conn : connections) {
+                NetworkDevice* gateway = conn->otherEnd(this);
+                if (gateway && gateway->forwardsIp()) {
+                    simulator->trace<traceHops>(TraceEvent::HostSendViaGateway, id, packet.get(), targetId,
+                                                static_cast<uint32_t>(gateway->getId()));
+                    conn->transferPacket(packet, this);
+                    return;
+                }
+            }
+        }
+        noRouteDrops++;
+        simulator->trace<traceDrops>(TraceEvent::HostNoRoute, id, packet.get(), targetId);
+    }
+
+public:
+    static constexpr DeviceKind staticKind = DeviceKind::Computer;
+
+    Computer(int id, const string& name, MacAddress mac, const string& ip)
+        : NetworkDevice(id, name, mac, staticKind), ipAddress(ip.empty() ? 0 : parseIpv4(ip)), receivedPackets(0),
+          sentPackets(0), noRouteDrops(0), activeFlows(0) {}
+
+    Computer(int id, const string& name, MacAddress mac, uint32_t ip)
+        : NetworkDevice(id, name, mac, staticKind), ipAddress(ip), receivedPackets(0), sentPackets(0),
+          noRouteDrops(0), activeFlows(0) {}
+
+    void sendPacket(const string& content, shared_ptr<NetworkDevice> target) {
+        sendPacket(Payload(content), target);
+    }
+
+    // Одно и то же содержимое можно отправлять многократно без копирования байтов
+    void sendPacket(const Payload& content, shared_ptr<NetworkDevice> target) {
+        if (!target) {
+            cout << "Ошибка: Неверное целевое устройство" << endl;
+            return;
+        }
+
+        auto packet = simulator->getPacketPool().acquire(content, static_cast<int>(content.size()),
+                                                         macAddress, target->getMac());
+        packet->setTraceId(simulator->tracePacket(content.view()));
+        transmit(move(packet), *target);
+    }
+
+    // Запускает поток из bytes байт к target: первый пакет уходит через delay, следующие -
+    // с темпом rateMbps. Размер пакетов задаётся отдельно от содержимого, поэтому все
+    // пакеты потока разделяют одну короткую полезную нагрузку
+    void startFlow(SimTime delay, const NetworkDevice& target, uint64_t bytes, int packetBytes,
+                   double rateMbps, Payload content, int flowId = -1) {
+        if (bytes == 0) return;
+        if (packetBytes <= 0 || rateMbps <= 0) {
+            throw runtime_error("Размер пакета и скорость потока должны быть положительными");
+        }
+        if (flows.size() >= static_cast<size_t>(numeric_limits<int>::max())) {
+            throw runtime_error("Слишком много потоков у компьютера " + name);
+        }
+        SimTime interval = NetworkConnection::serializationDelay(packetBytes, static_cast<float>(rateMbps));
+        flows.push_back(Flow{target.getHandle(), bytes, interval, packetBytes, flowId, move(content)});
+        activeFlows++;
+        stateChanged = true;
+        simulator->scheduleTimer(delay, *this, static_cast<int>(flows.size() - 1));
+    }
+
+    // Очередной пакет потока timerId
+    void onTimer(int timerId) override {
+        Flow& flow = flows[timerId];
+        const NetworkDevice* target = simulator->getRegistry().devices.get(flow.target);
+        int size = static_cast<int>(min<uint64_t>(flow.remainingBytes, flow.packetBytes));
+        flow.remainingBytes = target ? flow.remainingBytes - size : 0; // получатель удалён - поток прекращается
+        if (target) {
+            auto packet = simulator->getPacketPool().acquire(flow.content, size, macAddress, target->getMac());
+            packet->setTraceId(simulator->tracePacket(flow.content.view()));
+            packet->setFlowId(flow.flowId);
+            transmit(move(packet), *target);
+        }
+        if (flow.remainingBytes > 0) {
+            simulator->scheduleTimer(flow.interval, *this, timerId);
+        } else if (--activeFlows == 0) {
+            flows.clear(); // таймеров потоков больше нет, номера можно выдавать заново
+        }
+    }
+
+    // Забывает потоки, чьи таймеры отброшены вместе с очередью событий
+    void cancelFlows() {
+        flows.clear();
+        activeFlows = 0;
+        stateChanged = true;
+    }
+
+    // Потоки записываются вместе с завершёнными: номер потока - номер его таймера
+    void saveState(CheckpointWriter& out) const override {
+        NetworkDevice::saveState(out);
+        out.put(receivedPackets);
+        out.put(sentPackets);
+        out.put(noRouteDrops);
+        out.put<uint64_t>(activeFlows);
+        out.put<uint64_t>(flows.size());
+        for (const Flow& flow : flows) {
+            const NetworkDevice* target = simulator->getRegistry().devices.get(flow.target);
+            out.putReference(target != nullptr, target ? target->getId() : 0);
+            out.put(flow.remainingBytes);
+            out.put(flow.interval);
+            out.put<int32_t>(flow.packetBytes);
+            out.put<int32_t>(flow.flowId);
+            out.putPayload(flow.content);
+        }
+    }
+
+    void loadState(CheckpointReader& in) override {
+        NetworkDevice::loadState(in);
+        receivedPackets = in.get<uint64_t>();
+        sentPackets = in.get<uint64_t>();
+        noRouteDrops = in.get<uint64_t>();
+        activeFlows = in.get<uint64_t>();
+        uint64_t count = in.get<uint64_t>();
+        if (activeFlows > count) CheckpointReader::corrupted("неверное число потоков компьютера " + name);
+        flows.clear();
+        for (uint64_t i = 0; i < count; ++i) {
+            Flow flow;
+            flow.target = in.getDevice();
+            flow.remainingBytes = in.get<uint64_t>();
+            flow.interval = in.get<SimTime>();
+            flow.packetBytes = in.get<int32_t>();
+            flow.flowId = in.get<int32_t>();
+            flow.content = in.getPayload();
+            flows.push_back(move(flow));
+        }
+    }
+
+    uint64_t getReceivedPackets() const { return receivedPackets; }
+    uint64_t getSentPackets() const { return sentPackets; }
+
+    DeviceCounters getCounters() const override {
+        DeviceCounters c;
+        c.received = receivedPackets;
+        c.sent = sentPackets;
+        c.dropped = noRouteDrops;
+        return c;
+    }
+
+    void processPacket(PacketRef packet, int ingressPort) override {
+        (void)ingressPort;
+        simulator->trace<traceHops>(TraceEvent::HostReceived, id, packet.get());
+        simulator->recordLatency(*packet);
+        simulator->recordFlowDelivery(*packet);
+        receivedPackets++;
+    }
+
+    void displayInfo() const override {
+        NetworkDevice::displayInfo();
+        cout << "IP: " << formatIpv4(ipAddress) 
+             << "\nПолучено пакетов: " << receivedPackets << endl;
+    }
+
+    string getIp() const { return formatIpv4(ipAddress); }
+    uint32_t getIpAddress() const override { return ipAddress; }
+};
+
+// Подсказка процессору заранее загрузить строку кэша с адресом p
+inline void prefetchRead(const void* p) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(p);
+#else
+    (void)p;
+#endif
+}
+
+// Таблица коммутации: открытая адресация с линейным пробированием в одном плоском
+// массиве, ключ - MAC. Запись хранит порт и время последнего появления адреса;
+// записи старше agingTime считаются отсутствующими и удаляются при обращении.
+class MacTable {
+private:
+    struct Entry {
+        uint64_t mac;
+        int port;
+        SimTime lastSeen;
+    };
+
+    static constexpr uint64_t emptyKey = ~0ULL; // вне 48-битного диапазона MAC
+    static constexpr size_t initialSlots = 16;
+
+    vector<Entry> slots;
+    size_t count;
+    size_t maxEntries;
+    SimTime agingTime;
+
+    size_t slotFor(uint64_t mac) const {
+        return hash<MacAddress>()(MacAddress(mac)) & (slots.size() - 1);
+    }
+
+    bool expired(const Entry& e, SimTime now) const {
+        return now - e.lastSeen > agingTime;
+    }
+
+    // Удаление со сдвигом назад: цепочки пробирования остаются непрерывными без надгробий
+    void eraseAt(size_t i) {
+        size_t mask = slots.size() - 1;
+        size_t hole = i;
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & mask;
+            if (slots[j].mac == emptyKey) break;
+            size_t home = slotFor(slots[j].mac);
+            // Запись j можно перенести в дыру, если её домашний слот не лежит в (hole, j]
+            if (((j - home) & mask) >= ((j - hole) & mask)) {
+                slots[hole] = slots[j];
+                hole = j;
+            }
+        }
+        slots[hole].mac = emptyKey;
+        --count;
+    }
+
+    void grow() {
+        vector<Entry> old;
+        old.swap(slots);
+        slots.assign(old.size() * 2, Entry{emptyKey, -1, 0});
+        count = 0;
+        for (const auto& e : old) {
+            if (e.mac != emptyKey) insertNew(e);
+        }
+    }
+
+    void insertNew(const Entry& e) {
+        size_t mask = slots.size() - 1;
+        size_t i = slotFor(e.mac);
+        while (slots[i].mac != emptyKey) i = (i + 1) & mask;
+        slots[i] = e;
+        ++count;
+    }
+
+public:
+    explicit MacTable(size_t maxEntries = 8192, SimTime agingTime = fromMilliseconds(300000))
+        : slots(initialSlots, Entry{emptyKey, -1, 0}), count(0), maxEntries(maxEntries), agingTime(agingTime) {}
+
+    // Запоминает, что mac виден за портом port. Возвращает false, если таблица
+    // заполнена и места не нашлось даже после удаления устаревших записей
+    bool learn(MacAddress mac, int port, SimTime now) {
+        size_t mask = slots.size() - 1;
+        uint64_t key = mac.toUint64();
+        for (size_t i = slotFor(key); slots[i].mac != emptyKey; i = (i + 1) & mask) {
+            if (slots[i].mac == key) {
+                slots[i].port = port;
+                slots[i].lastSeen = now;
+                return true;
+            }
+        }
+        if (count >= maxEntries) {
+            age(now);
+            if (count >= maxEntries) return false;
+        }
+        if ((count + 1) * 2 > slots.size()) grow();
+        insertNew(Entry{key, port, now});
+        return true;
+    }
+
+    // Загружает в кэш начало цепочки пробирования mac перед learn/lookup
+    void prefetch(MacAddress mac) const {
+        prefetchRead(&slots[slotFor(mac.toUint64())]);
+    }
+
+    // Порт, за которым виден mac, или -1
+    int lookup(MacAddress mac, SimTime now) {
+        size_t mask = slots.size() - 1;
+        uint64_t key = mac.toUint64();
+        for (size_t i = slotFor(key); slots[i].mac != emptyKey; i = (i + 1) & mask) {
+            if (slots[i].mac == key) {
+                if (expired(slots[i], now)) {
+                    eraseAt(i);
+                    return -1;
+                }
+                return slots[i].port;
+            }
+        }
+        return -1;
+    }
+
+    // Удаляет все устаревшие записи
+    void age(SimTime now) {
+        for (size_t i = 0; i < slots.size();) {
+            if (slots[i].mac != emptyKey && expired(slots[i], now)) {
+                eraseAt(i); // на место i мог сдвинуться следующий элемент - проверяем его же
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    // Забывает адреса, изученные на порту (например, при отключении соединения)
+    void flushPort(int port) {
+        for (size_t i = 0; i < slots.size();) {
+            if (slots[i].mac != emptyKey && slots[i].port == port) {
+                eraseAt(i);
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    size_t size() const { return count; }
+    size_t getMaxEntries() const { return maxEntries; }
+    SimTime getAgingTime() const { return agingTime; }
+
+    // Записи сохраняются на своих слотах, поэтому цепочки пробирования после
+    // восстановления те же, что и до него
+    void saveState(CheckpointWriter& out) const {
+        out.put<uint64_t>(maxEntries);
+        out.put(agingTime);
+        out.put<uint64_t>(slots.size());
+        out.put<uint64_t>(count);
+        for (size_t i = 0; i < slots.size(); ++i) {
+            if (slots[i].mac == emptyKey) continue;
+            out.put(static_cast<uint64_t>(i));
+            out.put(slots[i].mac);
+            out.put<int32_t>(slots[i].port);
+            out.put(slots[i].lastSeen);
+        }
+    }
+
+    // ports - число портов коммутатора: записи с другими портами считаются повреждением
+    void loadState(CheckpointReader& in, int ports) {
+        maxEntries = in.get<uint64_t>();
+        agingTime = in.get<SimTime>();
+        uint64_t slotCount = in.get<uint64_t>();
+        uint64_t entries = in.get<uint64_t>();
+        if (slotCount < initialSlots || (slotCount & (slotCount - 1)) != 0 || entries * 2 > slotCount ||
+            slotCount > in.remaining()) {
+            CheckpointReader::corrupted("неверный размер таблицы коммутации");
+        }
+        slots.assign(static_cast<size_t>(slotCount), Entry{emptyKey, -1, 0});
+        for (uint64_t k = 0; k < entries; ++k) {
+            uint64_t index = in.get<uint64_t>();
+            if (index >= slotCount) CheckpointReader::corrupted("запись таблицы коммутации вне таблицы");
+            Entry& e = slots[static_cast<size_t>(index)];
+            e.mac = in.get<uint64_t>();
+            e.port = in.get<int32_t>();
+            e.lastSeen = in.get<SimTime>();
+            if (e.mac == emptyKey || e.port < 0 || e.port >= ports) {
+                CheckpointReader::corrupted("неверная запись таблицы коммутации");
+            }
+        }
+        count = static_cast<size_t>(entries);
+    }
+};
+
+class Switch final : public NetworkDevice {
+private:
+    int portCount;
+    MacTable macTable;
+    uint64_t forwardedFrames;
+    uint64_t floodedFrames;
+    uint64_t filteredFrames;
+
+    void flood(const PacketRef& packet, int ingressPort) {
+        floodedFrames++;
+        for (size_t port = 0; port < connections.size(); ++port) {
+            if (static_cast<int>(port) != ingressPort) {
+                connections[port]->transferPacket(packet, this);
+            }
+        }
+    }
+
+    void forwardFrame(PacketRef packet, int ingressPort, SimTime now) {
+        if (ingressPort >= 0) {
+            macTable.learn(packet->getSourceMac(), ingressPort, now);
+        }
+
+        MacAddress dest = packet->getDestinationMac();
+        int egressPort = dest.isMulticast() ? -1 : macTable.lookup(dest, now);
+        if (egressPort < 0 && !dest.isMulticast()) {
+            // Неизученный адрес: вместо рассылки идём по рассчитанному пути, если он есть
+            egressPort = routePort(packet->getDestinationNode());
+        }
+        if (egressPort < 0) {
+            simulator->trace<traceHops>(TraceEvent::SwitchFlood, id, packet.get(), dest.toUint64());
+            flood(packet, ingressPort);
+        } else if (egressPort == ingressPort) {
+            // Получатель в том же сегменте, откуда пришёл кадр: пересылать некуда
+            filteredFrames++;
+            simulator->trace<traceHops>(TraceEvent::SwitchFilter, id, packet.get(), dest.toUint64());
+        } else {
+            forwardedFrames++;
+            simulator->trace<traceHops>(TraceEvent::SwitchForward, id, packet.get(), dest.toUint64(), egressPort);
+            connections[egressPort]->transferPacket(packet, this);
+        }
+    }
+
+public:
+    static constexpr DeviceKind staticKind = DeviceKind::Switch;
+
+    Switch(int id, const string& name, MacAddress mac, int ports)
+        : NetworkDevice(id, name, mac, staticKind), portCount(ports),
+          forwardedFrames(0), floodedFrames(0), filteredFrames(0) {}
+
+    int getPortLimit() const override { return portCount; }
+    bool canTransit() const override { return true; }
+
+    DeviceCounters getCounters() const override {
+        DeviceCounters c;
+        c.forwarded = forwardedFrames;
+        c.flooded = floodedFrames;
+        c.filtered = filteredFrames;
+        return c;
+    }
+
+    void saveState(CheckpointWriter& out) const override {
+        NetworkDevice::saveState(out);
+        out.put(forwardedFrames);
+        out.put(floodedFrames);
+        out.put(filteredFrames);
+        macTable.saveState(out);
+    }
+
+    void loadState(CheckpointReader& in) override {
+        NetworkDevice::loadState(in);
+        forwardedFrames = in.get<uint64_t>();
+        floodedFrames = in.get<uint64_t>();
+        filteredFrames = in.get<uint64_t>();
+        macTable.loadState(in, static_cast<int>(connections.size()));
+    }
+
+    // Пачка обрабатывается в два прохода: сначала загружаются в кэш слоты таблицы
+    // коммутации для всех адресов, затем кадры пересылаются по порядку, как поодиночке
+    void processBurst(PacketBurst burst) {
+        SimTime now = simulator->now();
+        for (size_t offset = 0; offset < burst.size(); offset += maxBurstSize) {
+            PacketBurst part = burst.subburst(offset, min(maxBurstSize, burst.size() - offset));
+            for (const BurstEntry& entry : part) {
+                macTable.prefetch(entry.packet->getSourceMac());
+                macTable.prefetch(entry.packet->getDestinationMac());
+            }
+            for (BurstEntry& entry : part) {
+                forwardFrame(move(entry.packet), entry.ingressPort, now);
+            }
+        }
+    }
+
+    void processPacket(PacketRef packet, int ingressPort) override {
+        BurstEntry entry{move(packet), ingressPort};
+        processBurst(PacketBurst(&entry, 1));
+    }
+
+    void displayInfo() const override {
+        NetworkDevice::displayInfo();
+        std::cout << "Портов: " << portCount 
+             << "\nИзучено MAC-адресов: " << macTable.size()
+             << "\nПереслано кадров: " << forwardedFrames
+             << ", flooding: " << floodedFrames
+             << ", отфильтровано: " << filteredFrames << std::endl;
+    }
+};
+
+class Phone final : public NetworkDevice {
+private:
+    string phoneNumber;
+    bool isConnected;
+    uint64_t receivedPackets;
+
+public:
+    static constexpr DeviceKind staticKind = DeviceKind::Phone;
+
+    Phone(int id, const string& name, MacAddress mac, const string& number)
+        : NetworkDevice(id, name, mac, staticKind), phoneNumber(number), isConnected(true), receivedPackets(0) {}
+
+    void sendPacket(const string& content, shared_ptr<NetworkDevice> target) {
+        sendPacket(Payload(content), target);
+    }
+
+    void sendPacket(const Payload& content, shared_ptr<NetworkDevice> target) {
+        if (!target) {
+            cout << "Ошибка: Неверное целевое устройство" << endl;
+            return;
+        }
+
+        auto packet = simulator->getPacketPool().acquire(content, static_cast<int>(content.size()),
+                                                         macAddress, target->getMac());
+        packet->setTraceId(simulator->tracePacket(content.view()));
+        packet->setSentAt(simulator->now());
+        uint64_t targetId = static_cast<uint32_t>(target->getId());
+        
+        for (auto& conn : connections) {
+            if (conn->connects(target.get())) {
+                simulator->trace<traceHops>(TraceEvent::PhoneSend, id, packet.get(), targetId);
+                conn->transferPacket(packet, this);
+                return;
+            }
+        }
+        simulator->trace<traceDrops>(TraceEvent::PhoneNoLink, id, packet.get(), targetId);
+    }
+
+    void processPacket(PacketRef packet, int ingressPort) override {
+        (void)ingressPort;
+        simulator->trace<traceHops>(TraceEvent::PhoneReceived, id, packet.get());
+        simulator->recordLatency(*packet);
+        receivedPackets++;
+    }
+
+    DeviceCounters getCounters() const override {
+        DeviceCounters c;
+        c.received = receivedPackets;
+        return c;
+    }
+
+    void saveState(CheckpointWriter& out) const override {
+        NetworkDevice::saveState(out);
+        out.put<uint8_t>(isConnected);
+        out.put(receivedPackets);
+    }
+
+    void loadState(CheckpointReader& in) override {
+        NetworkDevice::loadState(in);
+        isConnected = in.get<uint8_t>() != 0;
+        receivedPackets = in.get<uint64_t>();
+    }
+
+    void displayInfo() const override {
+        NetworkDevice::displayInfo();
+        cout << "Номер: " << phoneNumber 
+             << "\nСтатус: " << (isConnected ? "Подключен" : "Отключен")
+             << "\nПолучено сообщений: " << receivedPackets << endl;
+    }
+
+    string getPhoneNumber() const { return phoneNumber; }
+};
+
+// Таблица маршрутов с поиском по самому длинному префиксу (LPM). Устроена как
+// многобитное дерево с шагами 16-8-8 (вариант DIR-16-8-8): корневой массив на 2^16
+// записей индексируется старшими 16 битами адреса, а префиксы длиннее /16 и /24
+// раскрываются в блоки по 256 записей. Поиск - не более трёх обращений к памяти
+// без ветвлений по длине префикса. Рядом с каждой записью хранится длина префикса,
+// которым она заполнена, чтобы более длинные маршруты не затирались короткими.
+class LpmTable {
+private:
+    static constexpr uint32_t childFlag = 0x80000000U; // запись ссылается на блок
+    static constexpr uint32_t noRoute = 0;             // иначе запись - значение + 1
+    static constexpr size_t chunkSize = 256;
+
+    vector<uint32_t> root;
+    vector<uint8_t> rootDepth;
+    vector<uint32_t> chunks;     // блоки второго и третьего уровней подряд
+    vector<uint8_t> chunkDepth;
+    map<pair<uint32_t, int>, uint32_t> routes; // (префикс, длина) -> значение
+
+    static constexpr uint32_t rootChunk = ~0U; // «блок», которым считается корневой массив
+
+    uint32_t& entryAt(uint32_t chunk, uint32_t i) {
+        return chunk == rootChunk ? root[i] : chunks[chunk * chunkSize + i];
+    }
+
+    uint8_t& depthAt(uint32_t chunk, uint32_t i) {
+        return chunk == rootChunk ? rootDepth[i] : chunkDepth[chunk * chunkSize + i];
+    }
+
+    // Новый блок наследует запись родительского слота: до вставки более длинного
+    // префикса все 256 адресов блока маршрутизировались так же, как родитель
+    uint32_t newChunk(uint32_t fillEntry, uint8_t fillDepth) {
+        uint32_t index = static_cast<uint32_t>(chunks.size() / chunkSize);
+        if (index >= childFlag) {
+            throw runtime_error("Переполнение таблицы маршрутов");
+        }
+        chunks.resize(chunks.size() + chunkSize, fillEntry);
+        chunkDepth.resize(chunkDepth.size() + chunkSize, fillDepth);
+        return index;
+    }
+
+    // Записывает (entry, depth) во все слоты, покрытые префиксом, для которых
+    // shouldReplace(текущая глубина). level 0 - корень (биты 31..16), 1 - биты 15..8, 2 - биты 7..0.
+    // Работает с индексами, а не указателями: newChunk может переместить chunks
+    template<typename Predicate>
+    void paint(uint32_t chunk, int level, uint32_t prefix, int length,
+               uint32_t entry, uint8_t depth, Predicate shouldReplace) {
+        int levelEnd = 16 + 8 * level;
+        int levelBits = level == 0 ? 16 : 8;
+        uint32_t first = (prefix >> (32 - levelEnd)) & ((1U << levelBits) - 1);
+
+        if (length > levelEnd) {
+            // Префикс длиннее уровня: спускаемся в блок под единственным слотом
+            uint32_t slot = entryAt(chunk, first);
+            uint32_t child;
+            if (slot & childFlag) {
+                child = slot & ~childFlag;
+            } else {
+                child = newChunk(slot, depthAt(chunk, first));
+                entryAt(chunk, first) = childFlag | child;
+            }
+            paint(child, level + 1, prefix, length, entry, depth, shouldReplace);
+            return;
+        }
+
+        uint32_t count = 1U << (levelEnd - length);
+        for (uint32_t i = first; i < first + count; ++i) {
+            uint32_t current = entryAt(chunk, i);
+            if (current & childFlag) {
+                paintWhole(current & ~childFlag, entry, depth, shouldReplace);
+            } else if (shouldReplace(depthAt(chunk, i))) {
+                entryAt(chunk, i) = entry;
+                depthAt(chunk, i) = depth;
+            }
+        }
+    }
+
+    // Применяет замену ко всем слотам блока и его потомков
+    template<typename Predicate>
+    void paintWhole(uint32_t chunk, uint32_t entry, uint8_t depth, Predicate shouldReplace) {
+        for (uint32_t i = 0; i < chunkSize; ++i) {
+            uint32_t current = entryAt(chunk, i);
+            if (current & childFlag) {
+                paintWhole(current & ~childFlag, entry, depth, shouldReplace);
+            } else if (shouldReplace(depthAt(chunk, i))) {
+                entryAt(chunk, i) = entry;
+                depthAt(chunk, i) = depth;
+            }
+        }
+    }
+
+public:
+    // Корневой массив выделяется при первом маршруте: роутер без маршрутов ничего не занимает
+    LpmTable() {}
+
+    // Добавляет или заменяет маршрут prefix/length -> value (value < 2^31 - 1)
+    void insert(uint32_t prefix, int length, uint32_t value) {
+        if (length < 0 || length > 32) {
+            throw runtime_error("Длина префикса должна быть от 0 до 32");
+        }
+        if (value >= childFlag - 1) {
+            throw runtime_error("Слишком большое значение маршрута");
+        }
+        prefix &= prefixMask(length);
+        if (root.empty()) {
+            root.assign(1U << 16, noRoute);
+            rootDepth.assign(1U << 16, 0);
+        }
+        routes[{prefix, length}] = value;
+        // Длина 0 и «нет маршрута» различаются значением записи, глубина хранится как length + 1
+        uint8_t depth = static_cast<uint8_t>(length + 1);
+        paint(rootChunk, 0, prefix, length, value + 1, depth,
+              [depth](uint8_t current) { return current <= depth; });
+    }
+
+    // Удаляет маршрут; его слоты получают следующий по длине покрывающий маршрут
+    bool remove(uint32_t prefix, int length) {
+        prefix &= prefixMask(length);
+        auto it = routes.find({prefix, length});
+        if (it == routes.end()) return false;
+        routes.erase(it);
+
+        uint32_t coverEntry = noRoute;
+        uint8_t coverDepth = 0;
+        for (int shorter = length - 1; shorter >= 0; --shorter) {
+            auto cover = routes.find({prefix & prefixMask(shorter), shorter});
+            if (cover != routes.end()) {
+                coverEntry = cover->second + 1;
+                coverDepth = static_cast<uint8_t>(shorter + 1);
+                break;
+            }
+        }
+        uint8_t removedDepth = static_cast<uint8_t>(length + 1);
+        paint(rootChunk, 0, prefix, length, coverEntry, coverDepth,
+              [removedDepth](uint8_t current) { return current == removedDepth; });
+        return true;
+    }
+
+    // Значение самого длинного совпавшего префикса или -1
+    int64_t lookup(uint32_t address) const {
+        if (root.empty()) return -1;
+        uint32_t entry = root[address >> 16];
+        if (entry & childFlag) {
+            entry = chunks[(entry & ~childFlag) * chunkSize + ((address >> 8) & 0xFF)];
+            if (entry & childFlag) {
+                entry = chunks[(entry & ~childFlag) * chunkSize + (address & 0xFF)];
+            }
+        }
+        return static_cast<int64_t>(entry) - 1;
+    }
+
+    // Поиск для пачки адресов по уровням: обращения одного уровня ко всем адресам
+    // выдаются подряд с предзагрузкой, и промахи кэша перекрываются, а не идут цепочкой
+    void lookupBurst(const uint32_t* addresses, int64_t* results, size_t count) const {
+        if (root.empty()) {
+            fill(results, results + count, -1);
+            return;
+        }
+        uint32_t entries[maxBurstSize];
+        for (size_t offset = 0; offset < count; offset += maxBurstSize) {
+            size_t n = min(maxBurstSize, count - offset);
+            const uint32_t* addr = addresses + offset;
+            for (size_t i = 0; i < n; ++i) prefetchRead(&root[addr[i] >> 16]);
+            for (size_t i = 0; i < n; ++i) {
+                entries[i] = root[addr[i] >> 16];
+                if (entries[i] & childFlag) {
+                    prefetchRead(&chunks[(entries[i] & ~childFlag) * chunkSize + ((addr[i] >> 8) & 0xFF)]);
+                }
+            }
+            for (size_t i = 0; i < n; ++i) {
+                if (entries[i] & childFlag) {
+                    entries[i] = chunks[(entries[i] & ~childFlag) * chunkSize + ((addr[i] >> 8) & 0xFF)];
+                    if (entries[i] & childFlag) {
+                        prefetchRead(&chunks[(entries[i] & ~childFlag) * chunkSize + (addr[i] & 0xFF)]);
+                    }
+                }
+            }
+            for (size_t i = 0; i < n; ++i) {
+                if (entries[i] & childFlag) {
+                    entries[i] = chunks[(entries[i] & ~childFlag) * chunkSize + (addr[i] & 0xFF)];
+                }
+                results[offset + i] = static_cast<int64_t>(entries[i]) - 1;
+            }
+        }
+    }
+
+    // Массовая загрузка: маршруты вставляются от коротких к длинным, тогда короткий
+    // префикс закрашивает корень до появления блоков и не обходит их повторно
+    void insertAll(vector<tuple<uint32_t, int, uint32_t>> batch) {
+        stable_sort(batch.begin(), batch.end(),
+                    [](const auto& a, const auto& b) { return get<1>(a) < get<1>(b); });
+        for (const auto& route : batch) {
+            insert(get<0>(route), get<1>(route), get<2>(route));
+        }
+    }
+
+    void clear() {
+        fill(root.begin(), root.end(), noRoute);
+        fill(rootDepth.begin(), rootDepth.end(), 0);
+        chunks.clear();
+        chunkDepth.clear();
+        routes.clear();
+    }
+
+    size_t size() const { return routes.size(); }
+    const map<pair<uint32_t, int>, uint32_t>& getRoutes() const { return routes; }
+    size_t memoryBytes() const {
+        return root.size() * (sizeof(uint32_t) + 1) + chunks.capacity() * sizeof(uint32_t) + chunkDepth.capacity();
+    }
+};
+
+class Router final : public NetworkDevice {
+private:
+    string ipRange;
+    unordered_map<MacAddress, int> routingTable; // MAC -> порт, для кадров без IP-заголовка
+    LpmTable fib;                                // IP-префикс -> порт
+    int maxConnections;
+    uint64_t routedPackets;
+    uint64_t noRouteDrops;
+    uint64_t ttlDrops;
+
+    // port - результат поиска в FIB для адреса назначения пакета
+    void routeIp(PacketRef packet, int64_t port) {
+        if (port < 0) {
+            port = routePort(packet->getDestinationNode());
+        }
+        if (port < 0 || port >= static_cast<int64_t>(connections.size())) {
+            noRouteDrops++;
+            simulator->trace<traceDrops>(TraceEvent::RouterNoRoute, id, packet.get(), packet->getDestinationIp());
+            return;
+        }
+
+        // Пакет мог быть разослан нескольким получателям: TTL меняем только у своей копии
+        if (!packet.unique()) {
+            packet = simulator->getPacketPool().acquire(*packet);
+        }
+        if (!packet->decrementTtl()) {
+            ttlDrops++;
+            simulator->trace<traceDrops>(TraceEvent::RouterTtlExpired, id, packet.get(), packet->getDestinationIp());
+            return;
+        }
+
+        routedPackets++;
+        simulator->trace<traceHops>(TraceEvent::RouterRouted, id, packet.get(),
+                                    (static_cast<uint64_t>(packet->getSourceIp()) << 32) | packet->getDestinationIp(),
+                                    static_cast<uint64_t>(port));
+        connections[port]->transferPacket(move(packet), this);
+    }
+
+    // Кадр без IP-заголовка: пересылка по изученным MAC-адресам
+    void switchFrame(const PacketRef& packet, int ingressPort) {
+        simulator->trace<traceHops>(TraceEvent::RouterSwitched, id, packet.get(),
+                                    packet->getSourceMac().toUint64(), packet->getDestinationMac().toUint64());
+
+        auto it = routingTable.find(packet->getDestinationMac());
+        int egressPort = it != routingTable.end() ? it->second : routePort(packet->getDestinationNode());
+        if (egressPort >= 0) {
+            if (egressPort != ingressPort) {
+                connections[egressPort]->transferPacket(packet, this);
+            }
+        } else {
+            // Пересылаем на все порты кроме входного
+            for (size_t port = 0; port < connections.size(); ++port) {
+                if (static_cast<int>(port) != ingressPort) {
+                    connections[port]->transferPacket(packet, this);
+                }
+            }
+        }
+    }
+
+public:
+    static constexpr DeviceKind staticKind = DeviceKind::Router;
+
+    Router(int id, const string& name, MacAddress mac, const string& range, int maxConn)
+        : NetworkDevice(id, name, mac, staticKind), ipRange(range), maxConnections(maxConn),
+          routedPackets(0), noRouteDrops(0), ttlDrops(0) {}
+
+    int getPortLimit() const override { return maxConnections; }
+    bool forwardsIp() const override { return true; }
+    bool canTransit() const override { return true; }
+
+    DeviceCounters getCounters() const override {
+        DeviceCounters c;
+        c.forwarded = routedPackets;
+        c.dropped = noRouteDrops + ttlDrops;
+        return c;
+    }
+
+    // FIB входит в образ топологии, здесь - изученные MAC-адреса и счётчики
+    void saveState(CheckpointWriter& out) const override {
+        NetworkDevice::saveState(out);
+        out.put(routedPackets);
+        out.put(noRouteDrops);
+        out.put(ttlDrops);
+        // По возрастанию MAC: одинаковые таблицы дают одинаковые байты при любом порядке хеш-таблицы
+        vector<pair<uint64_t, int32_t>> learned;
+        learned.reserve(routingTable.size());
+        for (const auto& [mac, port] : routingTable) {
+            learned.emplace_back(mac.toUint64(), port);
+        }
+        sort(learned.begin(), learned.end());
+        out.put<uint64_t>(learned.size());
+        for (const auto& [mac, port] : learned) {
+            out.put(mac);
+            out.put(port);
+        }
+    }
+
+    void loadState(CheckpointReader& in) override {
+        NetworkDevice::loadState(in);
+        routedPackets = in.get<uint64_t>();
+        noRouteDrops = in.get<uint64_t>();
+        ttlDrops = in.get<uint64_t>();
+        uint64_t learned = in.get<uint64_t>();
+        routingTable.clear();
+        for (uint64_t i = 0; i < learned; ++i) {
+            MacAddress mac(in.get<uint64_t>());
+            int32_t port = in.get<int32_t>();
+            if (port < 0 || port >= static_cast<int32_t>(connections.size())) {
+                CheckpointReader::corrupted("неверный порт в таблице роутера " + name);
+            }
+            routingTable[mac] = port;
+        }
+    }
+
+    void addRoute(uint32_t prefix, int length, int port) {
+        if (port < 0 || port >= static_cast<int>(connections.size())) {
+            throw runtime_error("У роутера " + name + " нет порта " + to_string(port));
+        }
+        fib.insert(prefix, length, static_cast<uint32_t>(port));
+    }
+
+    void addRoute(const string& cidr, int port) {
+        uint32_t prefix;
+        int length;
+        parseCidr(cidr, prefix, length);
+        addRoute(prefix, length, port);
+    }
+
+    // Массовая загрузка маршрутов (префикс, длина, порт), см. LpmTable::insertAll
+    void addRoutes(vector<tuple<uint32_t, int, uint32_t>> batch) {
+        for (const auto& route : batch) {
+            if (get<2>(route) >= connections.size()) {
+                throw runtime_error("У роутера " + name + " нет порта " + to_string(get<2>(route)));
+            }
+        }
+        fib.insertAll(move(batch));
+    }
+
+    bool removeRoute(uint32_t prefix, int length) { return fib.remove(prefix, length); }
+
+    // Порт из FIB для адреса address, -1 - маршрута нет
+    int64_t lookupRoute(uint32_t address) const { return fib.lookup(address); }
+
+    const LpmTable& getFib() const { return fib; }
+    const string& getIpRange() const { return ipRange; }
+
+    // FIB не меняется во время обработки, поэтому маршруты всей пачки ищутся заранее
+    // одним проходом (LpmTable::lookupBurst), а затем пакеты обрабатываются по порядку
+    void processBurst(PacketBurst burst) {
+        uint32_t addresses[maxBurstSize];
+        int64_t ports[maxBurstSize];
+        for (size_t offset = 0; offset < burst.size(); offset += maxBurstSize) {
+            PacketBurst part = burst.subburst(offset, min(maxBurstSize, burst.size() - offset));
+            for (size_t i = 0; i < part.size(); ++i) {
+                addresses[i] = part[i].packet->hasIpHeader() ? part[i].packet->getDestinationIp() : 0;
+            }
+            fib.lookupBurst(addresses, ports, part.size());
+
+            for (size_t i = 0; i < part.size(); ++i) {
+                BurstEntry& entry = part[i];
+                if (entry.ingressPort >= 0) {
+                    routingTable[entry.packet->getSourceMac()] = entry.ingressPort;
+                }
+                if (entry.packet->hasIpHeader()) {
+                    routeIp(move(entry.packet), ports[i]);
+                } else {
+                    switchFrame(entry.packet, entry.ingressPort);
+                }
+            }
+        }
+    }
+
+    void processPacket(PacketRef packet, int ingressPort) override {
+        BurstEntry entry{move(packet), ingressPort};
+        processBurst(PacketBurst(&entry, 1));
+    }
+
+    void displayInfo() const override {
+        NetworkDevice::displayInfo();
+        cout << "IP-диапазон: " << ipRange 
+             << "\nМакс. подключений: " << maxConnections
+             << "\nИзучено MAC-адресов: " << routingTable.size()
+             << "\nМаршрутов в FIB: " << fib.size()
+             << "\nМаршрутизировано пакетов: " << routedPackets
+             << ", нет маршрута: " << noRouteDrops
+             << ", истёк TTL: " << ttlDrops << endl;
+    }
+};
+
+class Printer final : public NetworkDevice {
+private:
+    string printerModel;
+    vector<Payload> printQueue;
+    bool isOnline;
+    uint64_t offlineDrops;
+
+public:
+    static constexpr DeviceKind staticKind = DeviceKind::Printer;
+
+    Printer(int id, const string& name, MacAddress mac, const string& model)
+        : NetworkDevice(id, name, mac, staticKind), printerModel(model), isOnline(true), offlineDrops(0) {}
+
+    void processPacket(PacketRef packet, int ingressPort) override {
+        (void)ingressPort;
+        if (isOnline) {
+            simulator->trace<traceHops>(TraceEvent::PrinterJob, id, packet.get());
+            simulator->recordLatency(*packet);
+            printQueue.push_back(packet->getPayload());
+            simulator->trace<traceHops>(TraceEvent::PrinterPrinting, id, packet.get());
+        } else {
+            offlineDrops++;
+            simulator->trace<traceDrops>(TraceEvent::PrinterOffline, id, packet.get());
+        }
+    }
+
+    DeviceCounters getCounters() const override {
+        DeviceCounters c;
+        c.received = printQueue.size();
+        c.dropped = offlineDrops;
+        return c;
+    }
+
+    void saveState(CheckpointWriter& out) const override {
+        NetworkDevice::saveState(out);
+        out.put<uint8_t>(isOnline);
+        out.put(offlineDrops);
+        out.put<uint64_t>(printQueue.size());
+        for (const Payload& document : printQueue) {
+            out.putPayload(document);
+        }
+    }
+
+    void loadState(CheckpointReader& in) override {
+        NetworkDevice::loadState(in);
+        isOnline = in.get<uint8_t>() != 0;
+        offlineDrops = in.get<uint64_t>();
+        uint64_t documents = in.get<uint64_t>();
+        if (documents > in.remaining() / sizeof(uint32_t)) CheckpointReader::corrupted("неверная очередь печати");
+        printQueue.clear();
+        printQueue.reserve(static_cast<size_t>(documents));
+        for (uint64_t i = 0; i < documents; ++i) {
+            printQueue.push_back(in.getPayload());
+        }
+    }
+
+    void displayInfo() const override {
+        NetworkDevice::displayInfo();
+        cout << "Модель: " << printerModel 
+             << "\nСтатус: " << (isOnline ? "Онлайн" : "Офлайн")
+             << "\nВ очереди печати: " << printQueue.size() << " документов" << endl;
+    }
+
+    void setOnline(bool status) {
+        isOnline = status;
+        stateChanged = true;
+    }
+    const string& getModel() const { return printerModel; }
+};
+
+class Server final : public NetworkDevice {
+private:
+    string serverType;
+    vector<string> services;
+    int cpuLoad;
+    uint64_t requests;
+
+public:
+    static constexpr DeviceKind staticKind = DeviceKind::Server;
+
+    Server(int id, const string& name, MacAddress mac, const string& type)
+        : NetworkDevice(id, name, mac, staticKind), serverType(type), cpuLoad(0), requests(0) {
+        // Добавляем базовые сервисы
+        services.push_back("HTTP");
+        services.push_back("FTP");
+        if (type == "Database") {
+            services.push_back("MySQL");
+        } else if (type == "Web") {
+            services.push_back("Apache");
+        }
+    }
+
+    void processPacket(PacketRef packet, int ingressPort) override {
+        (void)ingressPort;
+        simulator->recordLatency(*packet);
+        requests++;
+        cpuLoad = min(100, cpuLoad + 5);
+        simulator->trace<traceHops>(TraceEvent::ServerRequest, id, packet.get(), static_cast<uint64_t>(cpuLoad));
+        
+        // Имитируем ответ: нагрузка спадает через 50 мс модельного времени
+        simulator->scheduleTimer(fromMilliseconds(50), *this, 0);
+    }
+
+    void onTimer(int timerId) override {
+        (void)timerId;
+        cpuLoad = max(0, cpuLoad - 3);
+    }
+
+    const string& getServerType() const { return serverType; }
+
+    DeviceCounters getCounters() const override {
+        DeviceCounters c;
+        c.received = requests;
+        return c;
+    }
+
+    void saveState(CheckpointWriter& out) const override {
+        NetworkDevice::saveState(out);
+        out.put<int32_t>(cpuLoad);
+        out.put(requests);
+    }
+
+    void loadState(CheckpointReader& in) override {
+        NetworkDevice::loadState(in);
+        cpuLoad = in.get<int32_t>();
+        requests = in.get<uint64_t>();
+    }
+
+    void displayInfo() const override {
+        NetworkDevice::displayInfo();
+        cout << "Тип сервера: " << serverType 
+             << "\nЗагрузка CPU: " << cpuLoad << "%"
+             << "\nСервисы: ";
+        for (size_t i = 0; i < services.size(); ++i) {
+            cout << services[i];
+            if (i < services.size() - 1) cout << ", ";
+        }
+        cout << endl;
+    }
+};
+
+// Классы устройств final, поэтому вызовы через T* не виртуальные и могут встраиваться
+template <typename T>
+void Simulator::dispatchBatch(vector<DeviceWork>& batch) {
+    for (DeviceWork& work : batch) {
+        T* device = static_cast<T*>(work.target);
+        currentSource = &device->getEventSource();
+        if (work.packet) {
+            device->processPacket(move(work.packet), work.ingressPort);
+        } else {
+            device->onTimer(work.timerId);
+        }
+    }
+    batch.clear();
+    currentSource = &externalSource;
+}
+
+// Для устройств с processBurst кадры одного устройства собираются в пачку. Порядок
+// между устройствами не важен, а внутри устройства сохраняется (ключ order)
+template <typename T>
+void Simulator::dispatchBursts(vector<DeviceWork>& batch) {
+    sort(batch.begin(), batch.end(), [](const DeviceWork& a, const DeviceWork& b) {
+        uint32_t ia = a.target->getHandle().index;
+        uint32_t ib = b.target->getHandle().index;
+        return ia != ib ? ia < ib : a.order < b.order;
+    });
+    for (size_t i = 0; i < batch.size();) {
+        T* device = static_cast<T*>(batch[i].target);
+        currentSource = &device->getEventSource();
+        auto flush = [&]() {
+            if (!burstBuffer.empty()) {
+                device->processBurst(PacketBurst(burstBuffer.data(), burstBuffer.size()));
+                burstBuffer.clear();
+            }
+        };
+        for (; i < batch.size() && batch[i].target == device; ++i) {
+            if (batch[i].packet) {
+                burstBuffer.push_back({move(batch[i].packet), batch[i].ingressPort});
+            } else {
+                flush();
+                device->onTimer(batch[i].timerId);
+            }
+        }
+        flush();
+    }
+    batch.clear();
+    currentSource = &externalSource;
+}
+
+void Simulator::dispatchDeviceBatches() {
+    dispatchBatch<Computer>(deviceBatches[static_cast<size_t>(DeviceKind::Computer)]);
+    dispatchBursts<Switch>(deviceBatches[static_cast<size_t>(DeviceKind::Switch)]);
+    dispatchBatch<Phone>(deviceBatches[static_cast<size_t>(DeviceKind::Phone)]);
+    dispatchBursts<Router>(deviceBatches[static_cast<size_t>(DeviceKind::Router)]);
+    dispatchBatch<Printer>(deviceBatches[static_cast<size_t>(DeviceKind::Printer)]);
+    dispatchBatch<Server>(deviceBatches[static_cast<size_t>(DeviceKind::Server)]);
+}
+
+// Неизменяемый снимок топологии в формате CSR (compressed sparse row): соседи всех
+// устройств лежат подряд в одном массиве, строка устройства v - это
+// [rowBegin(v), rowEnd(v)), а позиция внутри строки равна номеру порта. Атрибуты
+// соединений хранятся по столбцам (struct of arrays), поэтому обходы графа идут
+// линейно по памяти без shared_ptr и блокировок weak_ptr.
+// Устройства нумеруются позицией в NetworkManager::devices, соединения - своим ID.
+class TopologySnapshot {
+public:
+    // Диапазон индексов внутри одного из массивов снимка
+    struct IndexRange {
+        const uint32_t* first;
+        const uint32_t* last;
+
+        const uint32_t* begin() const { return first; }
+        const uint32_t* end() const { return last; }
+        size_t size() const { return static_cast<size_t>(last - first); }
+    };
+
+private:
+    vector<uint32_t> offsets;   // deviceCount + 1
+    vector<uint32_t> neighbors; // соседнее устройство для каждого порта
+    vector<uint32_t> edgeLinks; // соединение для каждого порта
+
+    vector<int> deviceIds;
+    vector<uint8_t> deviceTransit;
+
+    vector<uint32_t> linkFrom;  // первое устройство соединения
+    vector<uint32_t> linkTo;    // второе устройство соединения
+    vector<int32_t> linkPortFrom;
+    vector<int32_t> linkPortTo;
+    vector<float> linkBandwidth; // Мбит/с
+    vector<SimTime> linkLatency;
+    vector<uint8_t> linkUp;
+
+public:
+    TopologySnapshot() : offsets(1, 0) {}
+
+    // Соединение с ID i должно стоять в connections на позиции i
+    static TopologySnapshot build(const vector<shared_ptr<NetworkDevice>>& devices,
+                                  const vector<shared_ptr<NetworkConnection>>& connections) {
+        TopologySnapshot snap;
+        size_t n = devices.size();
+        unordered_map<const NetworkDevice*, uint32_t> indexOf;
+        indexOf.reserve(n);
+        snap.deviceIds.resize(n);
+        snap.deviceTransit.resize(n);
+        snap.offsets.assign(n + 1, 0);
+        for (size_t i = 0; i < n; ++i) {
+            indexOf[devices[i].get()] = static_cast<uint32_t>(i);
+            snap.deviceIds[i] = devices[i]->getId();
+            snap.deviceTransit[i] = devices[i]->canTransit();
+            snap.offsets[i + 1] = snap.offsets[i] + static_cast<uint32_t>(devices[i]->getConnectionCount());
+        }
+
+        size_t m = connections.size();
+        snap.linkFrom.resize(m);
+        snap.linkTo.resize(m);
+        snap.linkPortFrom.resize(m);
+        snap.linkPortTo.resize(m);
+        snap.linkBandwidth.resize(m);
+        snap.linkLatency.resize(m);
+        snap.linkUp.resize(m);
+        snap.neighbors.resize(snap.offsets[n]);
+        snap.edgeLinks.resize(snap.offsets[n]);
+        for (size_t l = 0; l < m; ++l) {
+            const NetworkConnection& link = *connections[l];
+            const NetworkDevice* end0 = link.getEnd(0);
+            const NetworkDevice* end1 = link.getEnd(1);
+            snap.linkPortFrom[l] = link.getPort(0);
+            snap.linkPortTo[l] = link.getPort(1);
+            snap.linkBandwidth[l] = link.getBandwidth();
+            snap.linkLatency[l] = fromMilliseconds(link.getLatency());
+            snap.linkUp[l] = link.isUp();
+            if (!end0 && !end1) {
+                snap.linkFrom[l] = snap.linkTo[l] = numeric_limits<uint32_t>::max();
+                continue;
+            }
+            // У соединения с удалённым устройством остаётся петля на уцелевший конец:
+            // его порт занят, но соединение отключено
+            uint32_t a = indexOf.at(end0 ? end0 : end1);
+            uint32_t b = indexOf.at(end1 ? end1 : end0);
+            snap.linkFrom[l] = a;
+            snap.linkTo[l] = b;
+
+            // Порт задаёт место в строке, поэтому сортировка не нужна
+            if (end0) {
+                snap.neighbors[snap.offsets[a] + link.getPort(0)] = b;
+                snap.edgeLinks[snap.offsets[a] + link.getPort(0)] = static_cast<uint32_t>(l);
+            }
+            if (end1) {
+                snap.neighbors[snap.offsets[b] + link.getPort(1)] = a;
+                snap.edgeLinks[snap.offsets[b] + link.getPort(1)] = static_cast<uint32_t>(l);
+            }
+        }
+        return snap;
+    }
+
+    size_t deviceCount() const { return offsets.size() - 1; }
+    size_t linkCount() const { return linkFrom.size(); }
+
+    uint32_t rowBegin(uint32_t device) const { return offsets[device]; }
+    uint32_t rowEnd(uint32_t device) const { return offsets[device + 1]; }
+    uint32_t degree(uint32_t device) const { return offsets[device + 1] - offsets[device]; }
+
+    // Соседи устройства в порядке портов и соединения, ведущие к ним
+    IndexRange neighborsOf(uint32_t device) const {
+        return {neighbors.data() + offsets[device], neighbors.data() + offsets[device + 1]};
+    }
+    IndexRange linksOf(uint32_t device) const {
+        return {edgeLinks.data() + offsets[device], edgeLinks.data() + offsets[device + 1]};
+    }
+    uint32_t neighborAt(uint32_t edge) const { return neighbors[edge]; }
+    uint32_t linkAt(uint32_t edge) const { return edgeLinks[edge]; }
+
+    int deviceId(uint32_t device) const { return deviceIds[device]; }
+    bool canTransit(uint32_t device) const { return deviceTransit[device] != 0; }
+
+    uint32_t linkSource(uint32_t link) const { return linkFrom[link]; }
+    uint32_t linkTarget(uint32_t link) const { return linkTo[link]; }
+    int linkSourcePort(uint32_t link) const { return linkPortFrom[link]; }
+    int linkTargetPort(uint32_t link) const { return linkPortTo[link]; }
+    float bandwidth(uint32_t link) const { return linkBandwidth[link]; }
+    SimTime latency(uint32_t link) const { return linkLatency[link]; }
+    bool isUp(uint32_t link) const { return linkUp[link] != 0; }
+    // false - оба устройства соединения удалены, концов у него нет
+    bool isAttached(uint32_t link) const { return linkFrom[link] != numeric_limits<uint32_t>::max(); }
+
+    // Второй конец соединения link относительно device
+    uint32_t otherEnd(uint32_t link, uint32_t device) const {
+        return linkFrom[link] == device ? linkTo[link] : linkFrom[link];
+    }
+
+    // Число переходов от source до каждого устройства по включённым соединениям; -1 - недостижимо
+    vector<int> hopDistances(uint32_t source) const {
+        vector<int> hops(deviceCount(), -1);
+        vector<uint32_t> frontier{source};
+        hops[source] = 0;
+        for (size_t head = 0; head < frontier.size(); ++head) {
+            uint32_t v = frontier[head];
+            for (uint32_t e = offsets[v]; e < offsets[v + 1]; ++e) {
+                uint32_t u = neighbors[e];
+                if (hops[u] < 0 && linkUp[edgeLinks[e]]) {
+                    hops[u] = hops[v] + 1;
+                    frontier.push_back(u);
+                }
+            }
+        }
+        return hops;
+    }
+
+    // Номер компоненты связности для каждого устройства (без учёта состояния соединений)
+    vector<int> connectedComponents(int* componentCount = nullptr) const {
+        vector<int> component(deviceCount(), -1);
+        vector<uint32_t> stack;
+        int count = 0;
+        for (uint32_t start = 0; start < deviceCount(); ++start) {
+            if (component[start] >= 0) continue;
+            component[start] = count;
+            stack.push_back(start);
+            while (!stack.empty()) {
+                uint32_t v = stack.back();
+                stack.pop_back();
+                for (uint32_t u : neighborsOf(v)) {
+                    if (component[u] < 0) {
+                        component[u] = count;
+                        stack.push_back(u);
+                    }
+                }
+            }
+            ++count;
+        }
+        if (componentCount) *componentCount = count;
+        return component;
+    }
+
+    size_t memoryBytes() const {
+        return offsets.capacity() * sizeof(uint32_t) + neighbors.capacity() * sizeof(uint32_t)
+             + edgeLinks.capacity() * sizeof(uint32_t) + deviceIds.capacity() * sizeof(int)
+             + deviceTransit.capacity() + linkCount() * (2 * sizeof(uint32_t) + 2 * sizeof(int32_t)
+             + sizeof(float) + sizeof(SimTime) + 1);
+    }
+};
+
+// Барьер для синхронизации потоков логических процессов
+class ThreadBarrier {
+private:
+    mutex lock;
+    condition_variable released;
+    size_t threadCount;
+    size_t waiting;
+    size_t generation;
+
+public:
+    explicit ThreadBarrier(size_t count) : threadCount(count), waiting(0), generation(0) {}
+
+    void wait() {
+        unique_lock<mutex> guard(lock);
+        size_t arrivedGeneration = generation;
+        if (++waiting == threadCount) {
+            waiting = 0;
+            ++generation;
+            released.notify_all();
+        } else {
+            released.wait(guard, [&] { return generation != arrivedGeneration; });
+        }
+    }
+};
+
+// Постоянные рабочие потоки для частых коротких задач: поток создаётся один раз, а не на
+// каждый вызов. run(work) выполняет work(0) в вызывающем потоке и work(1..size()-1) в
+// рабочих и возвращается, когда закончат все
+class WorkerPool {
+private:
+    vector<thread> threads;
+    mutex lock;
+    condition_variable wake;
+    condition_variable finished;
+    function<void(unsigned)> task;
+    uint64_t generation;
+    size_t pending;
+    bool stopping;
+
+    void loop(unsigned index) {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            task(index);
+            lock_guard<mutex> guard(lock);
+            if (--pending == 0) finished.notify_one();
+        }
+    }
+
+public:
+    explicit WorkerPool(unsigned workers) : generation(0), pending(0), stopping(false) {
+        for (unsigned i = 1; i < workers; ++i) {
+            threads.emplace_back([this, i] { loop(i); });
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    unsigned size() const { return static_cast<unsigned>(threads.size()) + 1; }
+
+    void run(function<void(unsigned)> work) {
+        {
+            lock_guard<mutex> guard(lock);
+            task = move(work);
+            pending = threads.size();
+            ++generation;
+        }
+        wake.notify_all();
+        task(0);
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [&] { return pending == 0; });
+    }
+};
+
+// Параллельное дискретно-событийное моделирование с консервативной синхронизацией.
+// Устройства разбиваются на логические процессы (ЛП), у каждого свой Simulator и поток.
+// Работа идёт окнами: на барьере ЛП публикуют время ближайшего события next, после чего
+// ЛП j обрабатывает события строго раньше min по всем i, включая сам j, (next_i +
+// lookahead(i, j)), где lookahead(i, j) - кратчайшая суммарная задержка разрезанных
+// соединений на пути сообщения из i в j, в том числе через другие ЛП (lookahead(j, j) -
+// путь туда и обратно). Раньше этой границы никакое событие, порождённое другими ЛП или
+// вернувшееся через них, прийти не может; события для чужих устройств копятся в outbox и
+// раздаются адресатам на следующем барьере.
+class ParallelSimulator {
+private:
+    const vector<shared_ptr<NetworkDevice>>& devices;
+    const vector<shared_ptr<NetworkConnection>>& connections;
+    const TopologySnapshot& topology;
+    const NetworkRegistry& registry;
+    int requestedThreads;
+    int partitionCount;
+    vector<unique_ptr<Simulator>> partitions;
+    unique_ptr<WorkerPool> pool; // потоки ЛП живут между вызовами run
+    vector<vector<vector<OutboundEvent>>> outboxes; // outboxes[from][to]
+    vector<vector<SimTime>> lookahead;         // lookahead[from][to]
+    vector<int> devicePartition;               // по индексу устройства в devices
+    unordered_map<const NetworkDevice*, int> deviceIndex;
+    size_t cutLinks;
+
+    static int findRoot(vector<int>& parent, int v) {
+        while (parent[v] != v) {
+            parent[v] = parent[parent[v]];
+            v = parent[v];
+        }
+        return v;
+    }
+
+    // Разбиение: обход в ширину даёт порядок, в котором соседи идут рядом, и он режется на
+    // куски по ~n/K устройств. Концы соединений с нулевой задержкой объединяются заранее:
+    // разрезать такое соединение нельзя, lookahead был бы нулевым.
+    void buildPartitions() {
+        int n = static_cast<int>(topology.deviceCount());
+        vector<int> parent(n);
+        iota(parent.begin(), parent.end(), 0);
+        for (uint32_t l = 0; l < topology.linkCount(); ++l) {
+            if (topology.isAttached(l) && topology.latency(l) == 0) {
+                parent[findRoot(parent, topology.linkSource(l))] = findRoot(parent, topology.linkTarget(l));
+            }
+        }
+
+        vector<int> componentSize(n, 0);
+        for (int v = 0; v < n; ++v) componentSize[findRoot(parent, v)]++;
+
+        vector<int> order;
+        order.reserve(n);
+        vector<bool> visited(n, false);
+        for (int start = 0; start < n; ++start) {
+            if (visited[start]) continue;
+            visited[start] = true;
+            size_t head = order.size();
+            order.push_back(start);
+            while (head < order.size()) {
+                int v = order[head++];
+                for (int u : topology.neighborsOf(v)) {
+                    if (!visited[u]) {
+                        visited[u] = true;
+                        order.push_back(u);
+                    }
+                }
+            }
+        }
+
+        vector<int> componentPartition(n, -1);
+        devicePartition.assign(n, 0);
+        int part = 0;
+        long long filled = 0;
+        for (int v : order) {
+            int root = findRoot(parent, v);
+            if (componentPartition[root] == -1) {
+                while (part < partitionCount - 1 && filled >= static_cast<long long>(part + 1) * n / partitionCount) {
+                    ++part;
+                }
+                componentPartition[root] = part;
+                filled += componentSize[root];
+            }
+            devicePartition[v] = componentPartition[root];
+        }
+
+        lookahead.assign(partitionCount, vector<SimTime>(partitionCount, SIM_TIME_INFINITY));
+        cutLinks = 0;
+        for (uint32_t l = 0; l < topology.linkCount(); ++l) {
+            if (!topology.isAttached(l)) continue;
+            int pa = devicePartition[topology.linkSource(l)];
+            int pb = devicePartition[topology.linkTarget(l)];
+            if (pa == pb) continue;
+            SimTime la = topology.latency(l);
+            lookahead[pa][pb] = min(lookahead[pa][pb], la);
+            lookahead[pb][pa] = min(lookahead[pb][pa], la);
+            ++cutLinks;
+        }
+        // Сообщение может дойти до ЛП через цепочку других ЛП, поэтому нужны кратчайшие
+        // пути по всем парам (Флойд - Уоршелл), включая диагональ - возврат в свой ЛП
+        for (int k = 0; k < partitionCount; ++k) {
+            for (int i = 0; i < partitionCount; ++i) {
+                if (lookahead[i][k] == SIM_TIME_INFINITY) continue;
+                for (int j = 0; j < partitionCount; ++j) {
+                    if (lookahead[k][j] == SIM_TIME_INFINITY) continue;
+                    lookahead[i][j] = min(lookahead[i][j], lookahead[i][k] + lookahead[k][j]);
+                }
+            }
+        }
+    }
+
+    // Конец окна ЛП p: события раньше ближайшего возможного сообщения от любого ЛП,
+    // в том числе от самого p через другие ЛП
+    SimTime windowEnd(const vector<SimTime>& nextTimes, int p, SimTime until) const {
+        SimTime bound = SIM_TIME_INFINITY;
+        for (int q = 0; q < partitionCount; ++q) {
+            if (nextTimes[q] == SIM_TIME_INFINITY || lookahead[q][p] == SIM_TIME_INFINITY) continue;
+            bound = min(bound, nextTimes[q] + lookahead[q][p]);
+        }
+        return min(bound == SIM_TIME_INFINITY ? bound : bound - 1, until);
+    }
+
+    // Доля ЛП p в оставшемся лимите событий на это окно. Остаток делится поровну между ЛП,
+    // у которых в окне есть события, излишек - по одному, начиная с ЛП с самым ранним
+    // событием (у него в окне события есть всегда, поэтому прогон продвигается). Так за окно
+    // все ЛП вместе обрабатывают не больше remaining событий, а доли зависят только от
+    // разбиения и состояния модели, но не от того, как потоки успели отработать
+    uint64_t budgetShare(const vector<SimTime>& nextTimes, int p, SimTime until, uint64_t remaining) const {
+        if (nextTimes[p] > windowEnd(nextTimes, p, until)) return 0;
+        int first = static_cast<int>(min_element(nextTimes.begin(), nextTimes.end()) - nextTimes.begin());
+        uint64_t eligible = 0, rank = 0;
+        for (int i = 0; i < partitionCount; ++i) {
+            int q = (first + i) % partitionCount;
+            if (nextTimes[q] > windowEnd(nextTimes, q, until)) continue;
+            if (q == p) rank = eligible;
+            eligible++;
+        }
+        return remaining / eligible + (rank < remaining % eligible ? 1 : 0);
+    }
+
+    int partitionOf(const SimEvent& ev) const {
+        const NetworkDevice* owner = nullptr;
+        if (ev.type == EventType::LinkTxComplete) {
+            if (const NetworkConnection* link = registry.links.get(ev.link)) owner = link->getSender(ev.direction);
+        } else {
+            owner = registry.devices.get(ev.target);
+        }
+        auto it = deviceIndex.find(owner);
+        return it != deviceIndex.end() ? devicePartition[it->second] : 0;
+    }
+
+public:
+    // pools - пулы пакетов логических процессов; принадлежат вызывающему, чтобы
+    // переиспользоваться между прогонами и пережить пакеты в очередях соединений
+    // topology - снимок, построенный по тем же devices и connections
+    ParallelSimulator(const vector<shared_ptr<NetworkDevice>>& devices,
+                      const vector<shared_ptr<NetworkConnection>>& connections,
+                      const TopologySnapshot& topology, const NetworkRegistry& registry,
+                      int threads, vector<unique_ptr<PacketPool>>& pools)
+        : devices(devices), connections(connections), topology(topology), registry(registry),
+          requestedThreads(threads), cutLinks(0) {
+        partitionCount = max(1, min(threads, static_cast<int>(devices.size())));
+        for (size_t i = 0; i < devices.size(); ++i) {
+            deviceIndex[devices[i].get()] = static_cast<int>(i);
+        }
+        buildPartitions();
+
+        while (pools.size() < static_cast<size_t>(partitionCount)) {
+            pools.push_back(make_unique<PacketPool>());
+        }
+        outboxes.assign(partitionCount, vector<vector<OutboundEvent>>(partitionCount));
+        for (int p = 0; p < partitionCount; ++p) {
+            partitions.push_back(make_unique<Simulator>(*pools[p], registry));
+            partitions[p]->configurePartition(p, &outboxes[p]);
+        }
+        pool = make_unique<WorkerPool>(static_cast<unsigned>(partitionCount));
+    }
+
+    int getPartitionCount() const { return partitionCount; }
+    int getThreads() const { return requestedThreads; }
+    size_t getCutLinks() const { return cutLinks; }
+
+    // Забирает события из source, моделирует их параллельно до момента until и возвращает
+    // устройства (и события, оставшиеся после until или исчерпания maxEvents) обратно в
+    // source, туда же добавляются гистограммы задержек и журналы потоков ЛП. Можно
+    // вызывать повторно. Возвращает количество обработанных событий.
+    // Лимит maxEvents не превышается: в каждом окне ЛП получают доли остатка (см.
+    // budgetShare). Пока лимит не достигнут, результат побайтно совпадает с
+    // последовательным прогоном. Если лимит срабатывает, точка остановки зависит от
+    // разбиения, то есть от числа потоков, но при том же числе потоков воспроизводится
+    uint64_t run(Simulator& source, uint64_t maxEvents, SimTime until = SIM_TIME_INFINITY) {
+        // Часы ЛП начинают с часов source: между вызовами их могли сбросить или перевести назад
+        for (auto& lp : partitions) {
+            lp->reset();
+        }
+        for (auto& ev : source.takePending()) {
+            int p = partitionOf(ev);
+            partitions[p]->insert(move(ev));
+        }
+        for (size_t i = 0; i < devices.size(); ++i) {
+            devices[i]->attachSimulator(partitions[devicePartition[i]].get());
+        }
+        for (auto& lp : partitions) {
+            lp->advanceTo(source.now());
+            lp->setBatchDispatch(source.isBatchDispatch());
+            if (source.getFlowLog().size()) lp->getFlowLog().resize(source.getFlowLog().size());
+        }
+        // Пока работают потоки, каждый ЛП должен видеть только пакеты своего пула
+        for (const auto& conn : connections) {
+            for (int dir = 0; dir < 2; ++dir) {
+                NetworkDevice* sender = conn->getSender(dir);
+                if (sender) {
+                    conn->adoptQueuedPackets(dir, *sender->getSimulator());
+                }
+            }
+        }
+
+        vector<SimTime> nextTimes(partitionCount, SIM_TIME_INFINITY);
+        vector<uint64_t> processed(partitionCount, 0);
+        ThreadBarrier barrier(partitionCount);
+
+        auto worker = [&](int p) {
+            Simulator& lp = *partitions[p];
+            nextTimes[p] = lp.nextEventTime();
+            while (true) {
+                barrier.wait();
+
+                // Решение об остановке все потоки принимают по одним и тем же данным
+                uint64_t total = accumulate(processed.begin(), processed.end(), uint64_t(0));
+                SimTime globalNext = *min_element(nextTimes.begin(), nextTimes.end());
+                if (globalNext == SIM_TIME_INFINITY || globalNext > until || total >= maxEvents) break;
+
+                uint64_t handled = lp.run(windowEnd(nextTimes, p, until), budgetShare(nextTimes, p, until, maxEvents - total));
+
+                barrier.wait();
+
+                for (int q = 0; q < partitionCount; ++q) {
+                    for (auto& ev : outboxes[q][p]) {
+                        lp.insert(move(ev));
+                    }
+                    outboxes[q][p].clear();
+                }
+                processed[p] += handled;
+                nextTimes[p] = lp.nextEventTime();
+            }
+        };
+
+        pool->run([&](unsigned p) { worker(static_cast<int>(p)); });
+
+        for (auto& dev : devices) {
+            dev->attachSimulator(&source);
+        }
+        for (auto& lp : partitions) {
+            source.advanceTo(lp->now());
+            for (auto& ev : lp->takePending()) {
+                source.insert(move(ev));
+            }
+            source.getLatency().merge(lp->getLatency());
+            lp->getLatency().clear();
+            source.getFlowLog().merge(lp->getFlowLog());
+            lp->getFlowLog().clear();
+        }
+        uint64_t total = accumulate(processed.begin(), processed.end(), uint64_t(0));
+        source.addProcessedEvents(total);
+        return total;
+    }
+};
+
+// Метрика стоимости соединения при поиске кратчайших путей
+enum class RouteMetric {
+    Latency,             // задержка распространения
+    InverseBandwidth,    // эталонная полоса / полоса соединения, как в OSPF
+    LatencyAndBandwidth  // задержка плюс время сериализации кадра максимального размера
+};
+
+// Служба маршрутизации: по графу устройств считает кратчайшие пути алгоритмом Дейкстры
+// от каждого устройства и раздаёт устройствам таблицы следующих переходов, в которых
+// порт к любому получателю находится за O(1) по его индексу. Транзит разрешён только
+// через устройства с canTransit().
+// После полного расчёта (rebuild) изменения топологии применяются инкрементально: для
+// каждого источника хранятся расстояния и предшественники на дереве кратчайших путей.
+// Новое или включённое соединение запускает Дейкстру только от улучшившихся узлов;
+// отключённое - пересчитывает лишь поддерево, которое через него проходило. Источники
+// независимы и обрабатываются параллельно.
+class RoutingService {
+private:
+    struct Arc {
+        int to;
+        int port;       // порт соединения на устройстве-владельце дуги
+        int remotePort; // порт того же соединения на устройстве to
+        int64_t cost;
+        int link;       // ID соединения
+        bool up;
+    };
+
+    static constexpr int64_t unreachable = numeric_limits<int64_t>::max();
+    static constexpr double referenceBandwidth = 100000.0; // Мбит/с
+    static constexpr int referenceFrameBytes = 1500;
+    static constexpr size_t parallelSources = 64; // меньше источников - без рабочих потоков
+
+    RouteMetric metric;
+    unsigned threads;
+    unique_ptr<WorkerPool> pool; // создаётся при первом параллельном расчёте
+    vector<shared_ptr<NetworkDevice>> nodes;
+    unordered_map<const NetworkDevice*, int> indexOf;
+    vector<vector<Arc>> adjacency;
+    vector<char> transit;
+    vector<vector<int64_t>> dist;  // dist[s][x] - длина кратчайшего пути от s до x
+    vector<vector<int32_t>> parent; // parent[s][x] - предшественник x на этом пути, -1 - нет
+    bool built;            // полный расчёт выполнен, изменения применяются инкрементально
+    uint64_t lastTouched;  // записей таблиц изменено последней операцией
+    uint64_t totalTouched;
+
+    int indexOfDevice(const NetworkDevice* device) const {
+        auto it = indexOf.find(device);
+        return it != indexOf.end() ? it->second : -1;
+    }
+
+    bool expands(int source, int node) const { return node == source || transit[node]; }
+
+    // Порт источника, с которого начинается путь к to через from
+    int16_t firstPort(int source, int from, const Arc& arc) const {
+        return static_cast<int16_t>(from == source ? arc.port : nodes[source]->routePort(from));
+    }
+
+    // Дейкстра от узлов, уже лежащих в куче; обновляет только строго улучшившиеся узлы
+    uint64_t propagate(int source, priority_queue<pair<int64_t, int>, vector<pair<int64_t, int>>, greater<>>& heap) {
+        vector<int64_t>& d = dist[source];
+        uint64_t touched = 0;
+        while (!heap.empty()) {
+            auto [du, u] = heap.top();
+            heap.pop();
+            if (du != d[u] || !expands(source, u)) continue;
+            for (const Arc& arc : adjacency[u]) {
+                if (!arc.up || du + arc.cost >= d[arc.to]) continue;
+                d[arc.to] = du + arc.cost;
+                parent[source][arc.to] = u;
+                nodes[source]->setRoutePort(arc.to, firstPort(source, u, arc));
+                heap.push({d[arc.to], arc.to});
+                touched++;
+            }
+        }
+        return touched;
+    }
+
+    void computeFull(int source) {
+        dist[source].assign(nodes.size(), unreachable);
+        parent[source].assign(nodes.size(), -1);
+        nodes[source]->installRoutes(vector<int16_t>(nodes.size(), -1));
+        priority_queue<pair<int64_t, int>, vector<pair<int64_t, int>>, greater<>> heap;
+        dist[source][source] = 0;
+        heap.push({0, source});
+        propagate(source, heap);
+    }
+
+    // Появилась дуга from -> arc.to: достаточно распространить улучшение от arc.to
+    uint64_t insertArc(int source, int from, const Arc& arc) {
+        vector<int64_t>& d = dist[source];
+        if (d[from] == unreachable || !expands(source, from) || d[from] + arc.cost >= d[arc.to]) return 0;
+        d[arc.to] = d[from] + arc.cost;
+        parent[source][arc.to] = from;
+        nodes[source]->setRoutePort(arc.to, firstPort(source, from, arc));
+        priority_queue<pair<int64_t, int>, vector<pair<int64_t, int>>, greater<>> heap;
+        heap.push({d[arc.to], arc.to});
+        return 1 + propagate(source, heap);
+    }
+
+    // Вершина ребра u - v, ниже которой оно висит на дереве путей от source, или -1
+    int cutBelow(int source, int u, int v) const {
+        const vector<int32_t>& par = parent[source];
+        return par[v] == u ? v : par[u] == v ? u : -1;
+    }
+
+    // Пропало ребро u - v: пересчитываются только узлы, чей путь от source шёл через него.
+    // Дети узла на дереве - его соседи, у которых он предшественник, поэтому поддерево
+    // обходится по смежности за время, пропорциональное его размеру
+    uint64_t removeEdge(int source, int u, int v) {
+        int cut = cutBelow(source, u, v);
+        if (cut < 0) return 0;
+        vector<int32_t>& par = parent[source];
+        vector<int64_t>& d = dist[source];
+
+        // Узлы поддерева отрываются от дерева по мере обхода: par = -1 и d = unreachable,
+        // так что повторная дуга к уже пройденному узлу его не находит
+        vector<int> affected{cut};
+        par[cut] = -1;
+        d[cut] = unreachable;
+        for (size_t i = 0; i < affected.size(); ++i) {
+            int x = affected[i];
+            nodes[source]->setRoutePort(x, -1);
+            for (const Arc& arc : adjacency[x]) {
+                if (par[arc.to] != x) continue;
+                par[arc.to] = -1;
+                d[arc.to] = unreachable;
+                affected.push_back(arc.to);
+            }
+        }
+
+        // Начальные расстояния - через лучших соседей вне поддерева (у всех узлов поддерева
+        // сейчас d = unreachable), дальше обычная Дейкстра
+        struct Seed {
+            int64_t distance;
+            int via;
+            int16_t port;
+        };
+        vector<Seed> seeds(affected.size(), {unreachable, -1, -1});
+        for (size_t i = 0; i < affected.size(); ++i) {
+            for (const Arc& arc : adjacency[affected[i]]) {
+                int w = arc.to;
+                if (!arc.up || d[w] == unreachable || !expands(source, w) || d[w] + arc.cost >= seeds[i].distance) continue;
+                seeds[i] = {d[w] + arc.cost, w,
+                            static_cast<int16_t>(w == source ? arc.remotePort : nodes[source]->routePort(w))};
+            }
+        }
+        priority_queue<pair<int64_t, int>, vector<pair<int64_t, int>>, greater<>> heap;
+        for (size_t i = 0; i < affected.size(); ++i) {
+            if (seeds[i].via < 0) continue;
+            int x = affected[i];
+            d[x] = seeds[i].distance;
+            par[x] = seeds[i].via;
+            nodes[source]->setRoutePort(x, seeds[i].port);
+            heap.push({d[x], x});
+        }
+        propagate(source, heap);
+        return affected.size();
+    }
+
+    // Выполняет work(source) для источников sources и суммирует результат. Больших наборов
+    // хватает на постоянные потоки pool, мелкие считаются в вызывающем потоке.
+    // Строки dist/parent и таблица устройства source пишутся только одним потоком
+    template <typename Work>
+    uint64_t forEachSource(const vector<int>& sources, Work work) {
+        uint64_t total = 0;
+        if (threads <= 1 || sources.size() < parallelSources) {
+            for (int source : sources) total += work(source);
+            return total;
+        }
+        if (!pool || pool->size() != threads) pool = make_unique<WorkerPool>(threads);
+        unsigned workers = pool->size();
+        vector<uint64_t> touched(workers, 0);
+        pool->run([&](unsigned first) {
+            for (size_t i = first; i < sources.size(); i += workers) {
+                touched[first] += work(sources[i]);
+            }
+        });
+        return accumulate(touched.begin(), touched.end(), total);
+    }
+
+    // Находит дуги соединения; возвращает индексы концов или {-1, -1}
+    pair<int, int> endpoints(const NetworkConnection& link) const {
+        return {indexOfDevice(link.getEnd(0)), indexOfDevice(link.getEnd(1))};
+    }
+
+    Arc* findArc(int from, int linkId) {
+        for (Arc& arc : adjacency[from]) {
+            if (arc.link == linkId) return &arc;
+        }
+        return nullptr;
+    }
+
+    // Улучшает ли дуга from -> arc.to путь от source (см. insertArc)
+    bool improves(int source, int from, const Arc& arc) const {
+        const vector<int64_t>& d = dist[source];
+        return d[from] != unreachable && expands(source, from) && d[from] + arc.cost < d[arc.to];
+    }
+
+    void applyChange(const Arc& forward, const Arc& backward, int u, int v, bool up) {
+        Arc uv = forward;
+        Arc vu = backward;
+        // Источники, которых изменение не касается, отсеиваются за O(1) каждый
+        vector<int> sources;
+        for (int source = 0; source < static_cast<int>(nodes.size()); ++source) {
+            bool affected = up ? improves(source, u, uv) || improves(source, v, vu) : cutBelow(source, u, v) >= 0;
+            if (affected) sources.push_back(source);
+        }
+        lastTouched = forEachSource(sources, [&](int source) {
+            if (up) {
+                return insertArc(source, u, uv) + insertArc(source, v, vu);
+            }
+            return removeEdge(source, u, v);
+        });
+        totalTouched += lastTouched;
+    }
+
+    void addArcs(const NetworkConnection& link) {
+        auto [u, v] = endpoints(link);
+        if (u < 0 || v < 0) {
+            throw runtime_error("Соединение " + to_string(link.getId()) + " ведёт к неизвестному устройству");
+        }
+        if (link.getPort(0) > numeric_limits<int16_t>::max() || link.getPort(1) > numeric_limits<int16_t>::max()) {
+            throw runtime_error("Слишком много портов у устройства для таблицы маршрутов");
+        }
+        int64_t cost = linkCost(link);
+        adjacency[u].push_back({v, link.getPort(0), link.getPort(1), cost, link.getId(), link.isUp()});
+        adjacency[v].push_back({u, link.getPort(1), link.getPort(0), cost, link.getId(), link.isUp()});
+    }
+public:
+    explicit RoutingService(RouteMetric metric = RouteMetric::LatencyAndBandwidth)
+        : metric(metric), threads(max(1u, thread::hardware_concurrency())), built(false),
+          lastTouched(0), totalTouched(0) {}
+
+    void setMetric(RouteMetric newMetric) { metric = newMetric; }
+    RouteMetric getMetric() const { return metric; }
+    void setThreads(unsigned count) { threads = max(1u, count); }
+
+    // Стоимость всегда положительна: при равной задержке выигрывает путь с меньшим числом переходов
+    int64_t linkCost(SimTime latency, float bandwidth) const {
+        switch (metric) {
+            case RouteMetric::Latency:
+                return latency + 1;
+            case RouteMetric::InverseBandwidth:
+                return max<int64_t>(1, static_cast<int64_t>(referenceBandwidth / bandwidth));
+            case RouteMetric::LatencyAndBandwidth:
+            default:
+                return latency + NetworkConnection::serializationDelay(referenceFrameBytes, bandwidth) + 1;
+        }
+    }
+
+    int64_t linkCost(const NetworkConnection& link) const {
+        return linkCost(fromMilliseconds(link.getLatency()), link.getBandwidth());
+    }
+
+    // Полный пересчёт таблиц всех устройств; граф берётся из снимка topology,
+    // построенного по тому же списку devices
+    void rebuild(const vector<shared_ptr<NetworkDevice>>& devices, const TopologySnapshot& topology) {
+        built = false;
+        dist.clear();
+        parent.clear();
+        nodes.clear();
+        indexOf.clear();
+        adjacency.clear();
+        transit.clear();
+        for (const auto& device : devices) {
+            addNode(device);
+        }
+        for (uint32_t v = 0; v < topology.deviceCount(); ++v) {
+            if (topology.degree(v) > static_cast<uint32_t>(numeric_limits<int16_t>::max())) {
+                throw runtime_error("Слишком много портов у устройства " + nodes[v]->getName());
+            }
+            adjacency[v].reserve(topology.degree(v));
+            for (uint32_t e = topology.rowBegin(v); e < topology.rowEnd(v); ++e) {
+                uint32_t l = topology.linkAt(e);
+                int remotePort = topology.linkSource(l) == v ? topology.linkTargetPort(l) : topology.linkSourcePort(l);
+                adjacency[v].push_back({static_cast<int>(topology.neighborAt(e)), static_cast<int>(e - topology.rowBegin(v)),
+                                        remotePort, linkCost(topology.latency(l), topology.bandwidth(l)),
+                                        static_cast<int>(l), topology.isUp(l)});
+            }
+        }
+        dist.assign(nodes.size(), {});
+        parent.assign(nodes.size(), {});
+        vector<int> sources(nodes.size());
+        iota(sources.begin(), sources.end(), 0);
+        forEachSource(sources, [this](int source) {
+            computeFull(source);
+            return uint64_t(0);
+        });
+        built = true;
+        lastTouched = nodes.size() * nodes.size();
+        totalTouched += lastTouched;
+    }
+
+    // Забывает граф и снимает таблицы с устройств
+    void clear() {
+        for (const auto& node : nodes) {
+            node->setRoutingIndex(-1);
+            node->installRoutes({});
+        }
+        built = false;
+        nodes.clear();
+        indexOf.clear();
+        adjacency.clear();
+        transit.clear();
+        dist.clear();
+        parent.clear();
+        lastTouched = 0;
+    }
+
+    // Новое устройство без соединений: у всех источников появляется недостижимый получатель
+    void addNode(const shared_ptr<NetworkDevice>& device) {
+        int index = static_cast<int>(nodes.size());
+        nodes.push_back(device);
+        indexOf[device.get()] = index;
+        adjacency.emplace_back();
+        transit.push_back(device->canTransit());
+        device->setRoutingIndex(index);
+        if (built) {
+            for (auto& row : dist) row.push_back(unreachable);
+            for (auto& row : parent) row.push_back(-1);
+            dist.emplace_back(nodes.size(), unreachable);
+            parent.emplace_back(nodes.size(), -1);
+            dist.back()[index] = 0;
+            device->installRoutes(vector<int16_t>(nodes.size(), -1));
+        }
+        lastTouched = 0;
+    }
+
+    // Добавляет соединение в граф; если оно включено, обновляет пути инкрементально.
+    // Возвращает число изменённых записей таблиц
+    uint64_t addLink(const NetworkConnection& link) {
+        addArcs(link);
+        lastTouched = 0;
+        if (built && link.isUp()) {
+            auto [u, v] = endpoints(link);
+            applyChange(*findArc(u, link.getId()), *findArc(v, link.getId()), u, v, true);
+        }
+        return lastTouched;
+    }
+
+    // Включение или отключение соединения; возвращает число изменённых записей таблиц
+    uint64_t setLinkUp(const NetworkConnection& link, bool up) {
+        lastTouched = 0;
+        auto [u, v] = endpoints(link);
+        if (u < 0 || v < 0) return 0;
+        Arc* forward = findArc(u, link.getId());
+        Arc* backward = findArc(v, link.getId());
+        if (!forward || !backward || forward->up == up) return 0;
+        forward->up = up;
+        backward->up = up;
+        if (built) {
+            applyChange(*forward, *backward, u, v, up);
+        }
+        return lastTouched;
+    }
+
+    int64_t distance(int from, int to) const {
+        int64_t d = built ? dist[from][to] : unreachable;
+        return d == unreachable ? -1 : d;
+    }
+
+    bool isBuilt() const { return built; }
+    size_t nodeCount() const { return nodes.size(); }
+    uint64_t getLastTouched() const { return lastTouched; }
+    uint64_t getTotalTouched() const { return totalTouched; }
+
+    // Контрольная точка. Расстояния при восстановлении пересчитываются (кратчайшие
+    // расстояния однозначны), а деревья путей и таблицы устройств берутся записанные:
+    // после инкрементальных обновлений из равных путей могли быть выбраны другие
+    void saveState(CheckpointWriter& out) const {
+        out.put(static_cast<uint8_t>(metric));
+        out.put(lastTouched);
+        out.put(totalTouched);
+        out.put<uint8_t>(built);
+        if (!built) return;
+        for (size_t source = 0; source < nodes.size(); ++source) {
+            out.putVector(parent[source]);
+            out.putVector(nodes[source]->getRouteTable());
+        }
+    }
+
+    // devices и topology - сеть, для которой записывалось состояние
+    void loadState(CheckpointReader& in, const vector<shared_ptr<NetworkDevice>>& devices,
+                   const TopologySnapshot& topology) {
+        uint8_t savedMetric = in.get<uint8_t>();
+        if (savedMetric > static_cast<uint8_t>(RouteMetric::LatencyAndBandwidth)) {
+            CheckpointReader::corrupted("неизвестная метрика маршрутов");
+        }
+        uint64_t last = in.get<uint64_t>();
+        uint64_t total = in.get<uint64_t>();
+        bool savedBuilt = in.get<uint8_t>() != 0;
+        metric = static_cast<RouteMetric>(savedMetric);
+        clear();
+        if (savedBuilt) {
+            rebuild(devices, topology);
+            for (size_t source = 0; source < nodes.size(); ++source) {
+                parent[source] = in.getVector<int32_t>();
+                vector<int16_t> table = in.getVector<int16_t>();
+                bool valid = parent[source].size() == nodes.size() && table.size() == nodes.size();
+                int ports = static_cast<int>(nodes[source]->getConnectionCount());
+                for (size_t x = 0; valid && x < nodes.size(); ++x) {
+                    valid = parent[source][x] >= -1 && parent[source][x] < static_cast<int32_t>(nodes.size()) &&
+                            table[x] >= -1 && table[x] < ports;
+                }
+                if (!valid) CheckpointReader::corrupted("таблица маршрутов не совпадает с сетью");
+                nodes[source]->installRoutes(move(table));
+            }
+        }
+        lastTouched = last;
+        totalTouched = total;
+    }
+};
+
+// Описания устройства и соединения для массового построения сети
+struct DeviceSpec {
+    string type;
+    int id;
+    string name;
+    MacAddress mac;
+    string ip;
+    int ports = 0;
+};
+
+struct LinkSpec {
+    int id1;
+    int id2;
+    float bandwidth;
+    int latency;
+    size_t queueCapacity = 64;
+    DropPolicy policy = DropPolicy::DropTail;
+};
+
+// Выполняет work(i) для всех i из [0, count) на threads потоках. Потоки разбирают
+// индексы порциями по grain через общий счётчик, поэтому неравномерная по стоимости
+// работа распределяется сама; каждый i обрабатывается ровно одним потоком
+template <typename Work>
+void parallelFor(size_t count, unsigned threads, size_t grain, Work work) {
+    atomic<size_t> next(0);
+    auto worker = [&] {
+        while (true) {
+            size_t first = next.fetch_add(grain);
+            if (first >= count) return;
+            size_t last = min(count, first + grain);
+            for (size_t i = first; i < last; ++i) {
+                work(i);
+            }
+        }
+    };
+    size_t chunks = (count + grain - 1) / grain;
+    unsigned workers = static_cast<unsigned>(min<size_t>(max(1u, threads), max<size_t>(chunks, 1)));
+    vector<thread> pool;
+    for (unsigned t = 1; t < workers; ++t) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& th : pool) {
+        th.join();
+    }
+}
+
+// Вид генерируемой топологии (см. TopologyGenerator)
+enum class TopologyKind { FatTree, LeafSpine, Ring, Torus, ErdosRenyi, BarabasiAlbert };
+
+// Параметры генератора. Коммутаторы соединяются по выбранной схеме, к каждому коммутатору
+// нижнего уровня подключается hostsPerSwitch компьютеров (в fat-tree всегда k/2)
+struct TopologyParams {
+    TopologyKind kind = TopologyKind::Ring;
+    int nodes = 0;            // Ring, ErdosRenyi, BarabasiAlbert: число коммутаторов
+    int rows = 0;             // Torus
+    int columns = 0;          // Torus
+    int k = 0;                // FatTree: число портов коммутатора, чётное
+    int spines = 0;           // LeafSpine
+    int leaves = 0;           // LeafSpine
+    int hostsPerSwitch = 0;   // LeafSpine - на каждом leaf, остальные виды кроме FatTree - на каждом узле
+    double averageDegree = 0; // ErdosRenyi: ожидаемая степень, p = averageDegree / (nodes - 1)
+    int attachLinks = 0;      // BarabasiAlbert: соединений у каждого нового узла
+    float bandwidth = 1000;   // Мбит/с
+    int latency = 1;          // мс
+    size_t queueCapacity = 64;
+    uint64_t seed = 1;
+};
+
+// Граф сгенерированной сети: устройства 0..switchCount-1 - коммутаторы, за ними компьютеры.
+// Порты устройства нумеруются в порядке его рёбер в edges
+struct GeneratedTopology {
+    uint32_t switchCount = 0;
+    uint32_t hostCount = 0;
+    vector<pair<uint32_t, uint32_t>> edges;
+
+    size_t deviceCount() const { return static_cast<size_t>(switchCount) + hostCount; }
+};
+
+// Генераторы графов для масштабных экспериментов. Регулярные схемы строятся по формулам,
+// случайный граф Эрдёша-Реньи - параллельно блоками узлов; у каждого блока свой генератор
+// от (seed, номер блока), так что граф не зависит от числа потоков. Модель Барабаши-Альберт
+// последовательна по своей природе (узел присоединяется к уже построенному графу), но линейна
+// по числу рёбер
+class TopologyGenerator {
+private:
+    static constexpr uint32_t erBlockSize = 4096;
+
+    // Компьютерам выдаются адреса 10.0.0.1 и далее, поэтому их не больше 2^24 - 2
+    static constexpr uint64_t maxHosts = (1ULL << 24) - 2;
+    static constexpr uint64_t maxDevices = static_cast<uint64_t>(numeric_limits<int>::max()) - 1;
+    static constexpr uint64_t maxEdges = static_cast<uint64_t>(numeric_limits<int>::max());
+
+    static void checkSize(uint64_t switches, uint64_t hosts, uint64_t edges) {
+        if (hosts > maxHosts) {
+            throw runtime_error("Слишком много компьютеров: " + to_string(hosts) + ", предел " + to_string(maxHosts));
+        }
+        if (switches + hosts > maxDevices || edges + hosts > maxEdges) {
+            throw runtime_error("Слишком большая топология");
+        }
+    }
+
+    static void attachHosts(GeneratedTopology& g, uint32_t firstSwitch, uint32_t switches, int hostsPerSwitch) {
+        g.edges.reserve(g.edges.size() + static_cast<size_t>(switches) * hostsPerSwitch);
+        for (uint32_t s = firstSwitch; s < firstSwitch + switches; ++s) {
+            for (int j = 0; j < hostsPerSwitch; ++j) {
+                g.edges.emplace_back(s, g.switchCount + g.hostCount++);
+            }
+        }
+    }
+
+    // Три уровня коммутаторов по k портов: (k/2)^2 ядра, в каждом из k подов по k/2
+    // агрегации и доступа; к коммутатору доступа подключено k/2 компьютеров
+    static GeneratedTopology fatTree(const TopologyParams& p) {
+        if (p.k < 2 || p.k % 2 != 0) {
+            throw runtime_error("Fat-tree: число портов k должно быть чётным и не меньше 2");
+        }
+        uint64_t half = static_cast<uint64_t>(p.k) / 2;
+        uint64_t core = half * half;
+        uint64_t pods = static_cast<uint64_t>(p.k);
+        checkSize(core + 2 * pods * half, pods * half * half, 2 * pods * half * half);
+
+        GeneratedTopology g;
+        uint32_t h = static_cast<uint32_t>(half);
+        uint32_t aggFirst = static_cast<uint32_t>(core);
+        uint32_t edgeFirst = aggFirst + static_cast<uint32_t>(pods * half);
+        g.switchCount = edgeFirst + static_cast<uint32_t>(pods * half);
+        g.edges.reserve(2 * pods * half * half);
+        for (uint32_t pod = 0; pod < pods; ++pod) {
+            for (uint32_t e = 0; e < h; ++e) {
+                for (uint32_t a = 0; a < h; ++a) {
+                    g.edges.emplace_back(edgeFirst + pod * h + e, aggFirst + pod * h + a);
+                }
+            }
+        }
+        for (uint32_t pod = 0; pod < pods; ++pod) {
+            for (uint32_t a = 0; a < h; ++a) {
+                for (uint32_t c = 0; c < h; ++c) {
+                    g.edges.emplace_back(aggFirst + pod * h + a, a * h + c);
+                }
+            }
+        }
+        attachHosts(g, edgeFirst, static_cast<uint32_t>(pods * half), p.k / 2);
+        return g;
+    }
+
+    // Каждый leaf соединён с каждым spine
+    static GeneratedTopology leafSpine(const TopologyParams& p) {
+        if (p.spines < 1 || p.leaves < 1 || p.hostsPerSwitch < 0) {
+            throw runtime_error("Leaf-spine: нужны хотя бы один spine и один leaf");
+        }
+        uint64_t spines = static_cast<uint64_t>(p.spines);
+        uint64_t leaves = static_cast<uint64_t>(p.leaves);
+        checkSize(spines + leaves, leaves * static_cast<uint64_t>(p.hostsPerSwitch), spines * leaves);
+
+        GeneratedTopology g;
+        uint32_t leafFirst = static_cast<uint32_t>(spines);
+        g.switchCount = static_cast<uint32_t>(spines + leaves);
+        g.edges.reserve(spines * leaves);
+        for (uint32_t l = 0; l < leaves; ++l) {
+            for (uint32_t s = 0; s < spines; ++s) {
+                g.edges.emplace_back(leafFirst + l, s);
+            }
+        }
+        attachHosts(g, leafFirst, static_cast<uint32_t>(leaves), p.hostsPerSwitch);
+        return g;
+    }
+
+    static GeneratedTopology ring(const TopologyParams& p) {
+        if (p.nodes < 3 || p.hostsPerSwitch < 0) {
+            throw runtime_error("Кольцо: нужно не меньше 3 узлов");
+        }
+        uint32_t n = static_cast<uint32_t>(p.nodes);
+        checkSize(n, static_cast<uint64_t>(n) * p.hostsPerSwitch, n);
+
+        GeneratedTopology g;
+        g.switchCount = n;
+        g.edges.reserve(n);
+        for (uint32_t i = 0; i < n; ++i) {
+            g.edges.emplace_back(i, (i + 1) % n);
+        }
+        attachHosts(g, 0, n, p.hostsPerSwitch);
+        return g;
+    }
+
+    // Решётка rows x columns, замкнутая по обоим измерениям
+    static GeneratedTopology torus(const TopologyParams& p) {
+        if (p.rows < 3 || p.columns < 3 || p.hostsPerSwitch < 0) {
+            throw runtime_error("Тор: число строк и столбцов должно быть не меньше 3");
+        }
+        uint64_t n = static_cast<uint64_t>(p.rows) * static_cast<uint64_t>(p.columns);
+        checkSize(n, n * p.hostsPerSwitch, 2 * n);
+
+        GeneratedTopology g;
+        uint32_t rows = static_cast<uint32_t>(p.rows);
+        uint32_t cols = static_cast<uint32_t>(p.columns);
+        g.switchCount = static_cast<uint32_t>(n);
+        g.edges.reserve(2 * n);
+        for (uint32_t r = 0; r < rows; ++r) {
+            for (uint32_t c = 0; c < cols; ++c) {
+                uint32_t node = r * cols + c;
+                g.edges.emplace_back(node, r * cols + (c + 1) % cols);
+                g.edges.emplace_back(node, ((r + 1) % rows) * cols + c);
+            }
+        }
+        attachHosts(g, 0, g.switchCount, p.hostsPerSwitch);
+        return g;
+    }
+
+    // G(n, p): для узла v рёбра к w < v перебираются геометрическими скачками
+    // (Batagelj, Brandes), поэтому работа пропорциональна числу рёбер, а не n^2
+    static GeneratedTopology erdosRenyi(const TopologyParams& p, unsigned threads) {
+        if (p.nodes < 2 || p.averageDegree <= 0 || p.averageDegree > p.nodes - 1 || p.hostsPerSwitch < 0) {
+            throw runtime_error("Эрдёш-Реньи: нужно не меньше 2 узлов и средняя степень в (0, n-1]");
+        }
+        uint32_t n = static_cast<uint32_t>(p.nodes);
+        double probability = p.averageDegree / (n - 1);
+        uint64_t hosts = static_cast<uint64_t>(n) * p.hostsPerSwitch;
+        checkSize(n, hosts, 0);
+
+        size_t blocks = (n + erBlockSize - 1) / erBlockSize;
+        vector<vector<pair<uint32_t, uint32_t>>> blockEdges(blocks);
+        double logMiss = probability < 1.0 ? log(1.0 - probability) : 0.0;
+        parallelFor(blocks, threads, 1, [&](size_t block) {
+            mt19937_64 blockRng(mixSeed(p.seed, block));
+            uniform_real_distribution<double> uniform(0.0, 1.0);
+            auto& out = blockEdges[block];
+            uint32_t first = static_cast<uint32_t>(block * erBlockSize);
+            uint32_t last = min(n, first + erBlockSize);
+            for (uint32_t v = first; v < last; ++v) {
+                if (probability >= 1.0) {
+                    for (uint32_t w = 0; w < v; ++w) out.emplace_back(w, v);
+                    continue;
+                }
+                int64_t w = -1;
+                while (true) {
+                    w += 1 + static_cast<int64_t>(floor(log(1.0 - uniform(blockRng)) / logMiss));
+                    if (w >= v) break;
+                    out.emplace_back(static_cast<uint32_t>(w), v);
+                }
+            }
+        });
+
+        GeneratedTopology g;
+        g.switchCount = n;
+        size_t total = 0;
+        for (const auto& part : blockEdges) total += part.size();
+        checkSize(n, hosts, total);
+        g.edges.reserve(total);
+        for (auto& part : blockEdges) {
+            g.edges.insert(g.edges.end(), part.begin(), part.end());
+            vector<pair<uint32_t, uint32_t>>().swap(part);
+        }
+        attachHosts(g, 0, n, p.hostsPerSwitch);
+        return g;
+    }
+
+    // Предпочтительное присоединение: начальная клика из attachLinks + 1 узлов, затем каждый
+    // узел соединяется с attachLinks разными узлами, выбранными с вероятностью, пропорциональной
+    // степени (равномерный выбор из списка концов всех рёбер)
+    static GeneratedTopology barabasiAlbert(const TopologyParams& p) {
+        if (p.attachLinks < 1 || p.nodes <= p.attachLinks || p.hostsPerSwitch < 0) {
+            throw runtime_error("Барабаши-Альберт: нужно attachLinks >= 1 и узлов больше attachLinks");
+        }
+        uint32_t n = static_cast<uint32_t>(p.nodes);
+        uint32_t m = static_cast<uint32_t>(p.attachLinks);
+        uint64_t edgeCount = static_cast<uint64_t>(m) * (m + 1) / 2 + static_cast<uint64_t>(n - m - 1) * m;
+        checkSize(n, static_cast<uint64_t>(n) * p.hostsPerSwitch, edgeCount);
+
+        GeneratedTopology g;
+        g.switchCount = n;
+        g.edges.reserve(edgeCount);
+        vector<uint32_t> endpoints;
+        endpoints.reserve(2 * edgeCount);
+        for (uint32_t v = 1; v <= m; ++v) {
+            for (uint32_t w = 0; w < v; ++w) {
+                g.edges.emplace_back(w, v);
+                endpoints.push_back(w);
+                endpoints.push_back(v);
+            }
+        }
+        mt19937_64 rng(mixSeed(p.seed, 0));
+        vector<uint32_t> chosen;
+        for (uint32_t v = m + 1; v < n; ++v) {
+            chosen.clear();
+            uniform_int_distribution<size_t> pick(0, endpoints.size() - 1);
+            while (chosen.size() < m) {
+                uint32_t target = endpoints[pick(rng)];
+                if (find(chosen.begin(), chosen.end(), target) == chosen.end()) chosen.push_back(target);
+            }
+            for (uint32_t target : chosen) {
+                g.edges.emplace_back(target, v);
+                endpoints.push_back(target);
+                endpoints.push_back(v);
+            }
+        }
+        attachHosts(g, 0, n, p.hostsPerSwitch);
+        return g;
+    }
+
+public:
+    // Независимое зерно для потока номер stream (splitmix64)
+    static uint64_t mixSeed(uint64_t seed, uint64_t stream) {
+        uint64_t z = seed + 0x9E3779B97F4A7C15ULL * (stream + 1);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    static GeneratedTopology generate(const TopologyParams& params, unsigned threads) {
+        if (params.bandwidth <= 0) {
+            throw runtime_error("Пропускная способность должна быть положительной");
+        }
+        if (params.latency < 0) {
+            throw runtime_error("Задержка не может быть отрицательной");
+        }
+        if (params.queueCapacity == 0) {
+            throw runtime_error("Ёмкость очереди соединения должна быть больше нуля");
+        }
+        switch (params.kind) {
+            case TopologyKind::FatTree: return fatTree(params);
+            case TopologyKind::LeafSpine: return leafSpine(params);
+            case TopologyKind::Ring: return ring(params);
+            case TopologyKind::Torus: return torus(params);
+            case TopologyKind::ErdosRenyi: return erdosRenyi(params, threads);
+            case TopologyKind::BarabasiAlbert: return barabasiAlbert(params);
+        }
+        throw runtime_error("Неизвестный вид топологии");
+    }
+};
+
+// Нагрузка описывается потоками: в момент start источник начинает отправлять bytes байт
+// получателю (см. NetworkManager::scheduleWorkload). start отсчитывается от запуска нагрузки
+struct FlowSpec {
+    SimTime start;
+    int source;
+    int destination;
+    uint64_t bytes;
+};
+
+// Кто с кем обменивается: AllToAll - каждый поток между случайной парой компьютеров,
+// Incast - в момент появления incastFanIn отправителей одновременно шлют по потоку
+// одному случайному получателю (схема partition/aggregate)
+enum class TrafficPattern { AllToAll, Incast };
+
+// Poisson - экспоненциальные промежутки между потоками; OnOff - потоки появляются
+// только в периодах активности, чередующихся с молчанием (длительности экспоненциальные)
+enum class ArrivalProcess { Poisson, OnOff };
+
+// Pareto - тяжёлый хвост: большинство потоков короткие, а основной объём несут редкие
+// длинные, как в трафике центров обработки данных
+enum class FlowSizeDistribution { Fixed, Exponential, Pareto };
+
+struct WorkloadParams {
+    TrafficPattern pattern = TrafficPattern::AllToAll;
+    ArrivalProcess arrivals = ArrivalProcess::Poisson;
+    FlowSizeDistribution sizes = FlowSizeDistribution::Pareto;
+    double flowsPerSecond = 1000; // средняя интенсивность по всей сети (для Incast - событий incast)
+    double durationMs = 1000;     // на этом интервале модельного времени появляются потоки
+    double meanFlowBytes = 100000;
+    double paretoShape = 1.2;     // больше 1; чем ближе к 1, тем тяжелее хвост
+    double onMs = 10;             // OnOff: средняя длительность активности
+    double offMs = 90;            // OnOff: средняя длительность молчания
+    int incastFanIn = 16;
+    int packetBytes = 1000;
+    double flowRateMbps = 100;    // темп отправки пакетов внутри потока
+    uint64_t seed = 1;
+};
+
+// Итог прогона нагрузки: сколько пакетов запланировано и доставлено компьютерам,
+// сколько событий обработано и сколько заняло (от планирования до конца прогона)
+struct WorkloadResult {
+    uint64_t packets;
+    uint64_t delivered;
+    uint64_t events;
+    double seconds;
+};
+
+// Генерация потоков нагрузки и запись/чтение их трассы. Трасса - текст, по потоку в
+// строке: "<начало, мс> <ID источника> <ID получателя> <байт>"; так же записываются
+// и снятые с реальной сети трассы, которые нужно воспроизвести
+class WorkloadGenerator {
+private:
+    // Размер Парето ограничен сверху: иначе единичные потоки с бесконечной
+    // дисперсией растягивали бы прогон без предела
+    static constexpr double paretoCapMeans = 10000;
+
+    static uint64_t drawSize(const WorkloadParams& p, mt19937_64& rng) {
+        double size = p.meanFlowBytes;
+        if (p.sizes == FlowSizeDistribution::Exponential) {
+            size = exponential_distribution<double>(1.0 / p.meanFlowBytes)(rng);
+        } else if (p.sizes == FlowSizeDistribution::Pareto) {
+            double scale = p.meanFlowBytes * (p.paretoShape - 1.0) / p.paretoShape;
+            double u = 1.0 - uniform_real_distribution<double>(0.0, 1.0)(rng); // (0, 1]
+            size = min(scale / pow(u, 1.0 / p.paretoShape), p.meanFlowBytes * paretoCapMeans);
+        }
+        return max<uint64_t>(1, static_cast<uint64_t>(size));
+    }
+
+    static void validate(const WorkloadParams& p, size_t hostCount) {
+        if (hostCount < 2) {
+            throw runtime_error("Для нагрузки нужно хотя бы два компьютера");
+        }
+        if (!(p.flowsPerSecond > 0) || !(p.durationMs > 0) || !(p.meanFlowBytes >= 1)) {
+            throw runtime_error("Интенсивность, длительность и средний размер потока должны быть положительными");
+        }
+        if (p.sizes == FlowSizeDistribution::Pareto && !(p.paretoShape > 1.0)) {
+            throw runtime_error("Параметр формы Парето должен быть больше 1");
+        }
+        if (p.arrivals == ArrivalProcess::OnOff && (!(p.onMs > 0) || p.offMs < 0)) {
+            throw runtime_error("Периоды активности должны быть положительными");
+        }
+        if (p.pattern == TrafficPattern::Incast && p.incastFanIn < 1) {
+            throw runtime_error("В incast нужен хотя бы один отправитель");
+        }
+    }
+
+public:
+    // Потоки в порядке начала; hosts - ID компьютеров, между которыми идёт обмен
+    static vector<FlowSpec> generate(const WorkloadParams& p, const vector<int>& hosts) {
+        validate(p, hosts.size());
+        mt19937_64 rng(p.seed);
+        uniform_int_distribution<size_t> pickHost(0, hosts.size() - 1);
+        SimTime end = fromMilliseconds(p.durationMs);
+
+        // В OnOff интенсивность внутри активного периода повышена так, чтобы средняя
+        // по времени совпала с flowsPerSecond
+        double rate = p.flowsPerSecond;
+        if (p.arrivals == ArrivalProcess::OnOff) rate *= (p.onMs + p.offMs) / p.onMs;
+        exponential_distribution<double> gapMs(rate / 1000.0);
+        exponential_distribution<double> onMs(1.0 / p.onMs);
+        exponential_distribution<double> offMs(p.offMs > 0 ? 1.0 / p.offMs : 1.0);
+
+        vector<FlowSpec> flows;
+        size_t fanIn = min(static_cast<size_t>(p.incastFanIn), hosts.size() - 1);
+        vector<size_t> senders;
+        double nowMs = 0.0;
+        double periodEndMs = p.arrivals == ArrivalProcess::OnOff ? onMs(rng) : numeric_limits<double>::infinity();
+        while (true) {
+            nowMs += gapMs(rng);
+            // Промежуток, перешедший конец активности, продолжается после паузы:
+            // экспоненциальное распределение не имеет памяти
+            while (nowMs >= periodEndMs) {
+                double silence = p.offMs > 0 ? offMs(rng) : 0.0;
+                nowMs += silence;
+                periodEndMs += silence + onMs(rng);
+            }
+            SimTime start = fromMilliseconds(nowMs);
+            if (start >= end) break;
+
+            if (p.pattern == TrafficPattern::AllToAll) {
+                size_t src = pickHost(rng);
+                size_t dst = pickHost(rng);
+                while (dst == src) dst = pickHost(rng);
+                flows.push_back({start, hosts[src], hosts[dst], drawSize(p, rng)});
+            } else {
+                size_t receiver = pickHost(rng);
+                senders.clear();
+                while (senders.size() < fanIn) {
+                    size_t sender = pickHost(rng);
+                    if (sender != receiver && find(senders.begin(), senders.end(), sender) == senders.end()) {
+                        senders.push_back(sender);
+                    }
+                }
+                for (size_t sender : senders) {
+                    flows.push_back({start, hosts[sender], hosts[receiver], drawSize(p, rng)});
+                }
+            }
+        }
+        return flows;
+    }
+
+    // Читает трассу потоком; строки с # и пустые пропускаются. Потоки упорядочиваются по началу
+    static vector<FlowSpec> readTrace(istream& in) {
+        vector<FlowSpec> flows;
+        string line;
+        size_t lineNumber = 0;
+        while (getline(in, line)) {
+            ++lineNumber;
+            size_t first = line.find_first_not_of(" \t\r");
+            if (first == string::npos || line[first] == '#') continue;
+            istringstream fields(line);
+            double startMs;
+            FlowSpec flow;
+            if (!(fields >> startMs >> flow.source >> flow.destination >> flow.bytes) || startMs < 0) {
+                throw runtime_error("Строка " + to_string(lineNumber) +
+                                    " трассы: ожидается <мс> <ID источника> <ID получателя> <байт>");
+            }
+            flow.start = static_cast<SimTime>(llround(startMs * 1000000.0)); // округление: в трассе 6 знаков
+            flows.push_back(flow);
+        }
+        stable_sort(flows.begin(), flows.end(), [](const FlowSpec& a, const FlowSpec& b) { return a.start < b.start; });
+        return flows;
+    }
+
+    static void writeTrace(const vector<FlowSpec>& flows, ostream& out) {
+        out << "# <начало, мс> <ID источника> <ID получателя> <байт>\n" << fixed << setprecision(6);
+        for (const FlowSpec& flow : flows) {
+            out << toMilliseconds(flow.start) << ' ' << flow.source << ' ' << flow.destination << ' ' << flow.bytes << '\n';
+        }
+    }
+};
+
+// Итог прогона потоковой модели: время завершения каждого потока (FCT - от начала
+// потока до прихода последнего байта получателю, -1 - поток не дошёл) и затраты на расчёт
+struct FluidResult {
+    vector<SimTime> completion;
+    uint64_t events = 0;        // моментов, когда потоки начинались или заканчивались
+    uint64_t reallocations = 0; // пересчётов долей
+    uint64_t rateChanges = 0;   // изменений скорости потоков при пересчётах
+    uint64_t unroutable = 0;
+    double seconds = 0;
+};
+
+// Потоковая (fluid) модель нагрузки для сетей, где пакетный прогон слишком долог.
+// Поток - непрерывная жидкость: каждое направление соединения делит свою полосу между
+// идущими через него потоками по справедливости max-min, а скорость потока ограничена
+// ещё и темпом источника. Доли меняются только в моменты начала и конца потоков, и
+// пересчитываются лишь у потоков, связанных с изменившимся через общие соединения;
+// между событиями остаток потока убывает линейно, поэтому момент окончания известен
+// заранее. Стоимость прогона зависит от числа потоков, а не пакетов.
+// Путь потока тот же, по которому пошли бы его пакеты: прямое соединение, таблицы
+// RoutingService, FIB роутеров, шлюз. Где таблиц нет (сеть больше maxRoutedDevices),
+// берётся кратчайший по переходам путь - пакетный режим такие пакеты рассылает или теряет.
+// К времени передачи добавляются задержки распространения и store-and-forward последнего
+// пакета на переходах после первого; очереди и потери не моделируются
+class FluidSimulator {
+private:
+    static constexpr size_t maxCachedTrees = 256;
+    static constexpr double saturationTolerance = 1e-6; // доля полосы, меньше которой свободной не считается
+    static constexpr double rateTolerance = 1e-9;       // относительное изменение скорости, которое не учитывается
+
+    struct FlowState {
+        vector<uint32_t> path; // направления соединений: 2 * соединение + направление
+        double rate = 0;       // текущая доля, Мбит/с
+        double share = 0;      // доля, найденная при пересчёте
+        double remaining = 0;  // байт осталось на момент updated
+        SimTime updated = 0;
+        SimTime start = 0;
+        SimTime extra = 0;     // добавка к времени передачи
+        uint32_t version = 0;  // меняется с каждым новым прогнозом окончания
+        uint32_t visited = 0;  // метка обхода при пересчёте
+        bool frozen = false;   // доля уже зафиксирована при пересчёте
+    };
+
+    struct Completion {
+        SimTime time;
+        uint32_t flow;
+        uint32_t version;
+
+        bool operator>(const Completion& other) const {
+            return time != other.time ? time > other.time : flow > other.flow;
+        }
+    };
+
+    const vector<shared_ptr<NetworkDevice>>& devices;
+    const TopologySnapshot& topology;
+    unordered_map<int, uint32_t> indexOf;
+    vector<vector<uint32_t>> flowsOn; // активные потоки каждого направления соединения
+    vector<double> load;              // сумма их скоростей, Мбит/с
+    vector<double> capacityLeft;      // рабочие массивы пересчёта по направлениям
+    vector<uint32_t> unfrozen;
+    vector<uint32_t> touched;         // метки пересчёта epoch: направление затронуто
+    vector<uint32_t> expanded;        // и его потоки вошли в компоненту
+    uint32_t epoch;
+    vector<FlowState> flows;
+    vector<uint32_t> component;
+    vector<uint32_t> resources;
+    vector<uint32_t> pending;
+    double flowLimit;                 // темп источников, Мбит/с
+    vector<Completion> completions; // куча прогнозов окончания; записи устаревших версий пропускаются
+    size_t activeFlows;
+    unordered_map<uint32_t, vector<int32_t>> trees; // получатель -> порт к нему на каждом устройстве
+
+    double capacity(uint32_t resource) const { return topology.bandwidth(resource >> 1); }
+
+    // Для каждого устройства - порт, ведущий к target кратчайшим по переходам путём
+    // через транзитные устройства; -1 - target недостижим
+    const vector<int32_t>& treeTo(uint32_t target) {
+        auto it = trees.find(target);
+        if (it != trees.end()) return it->second;
+        if (trees.size() >= maxCachedTrees) trees.clear();
+        vector<int32_t> port(topology.deviceCount(), -1);
+        vector<uint8_t> seen(topology.deviceCount(), 0);
+        vector<uint32_t> frontier{target};
+        seen[target] = 1;
+        for (size_t head = 0; head < frontier.size(); ++head) {
+            uint32_t v = frontier[head];
+            if (v != target && !topology.canTransit(v)) continue;
+            for (uint32_t link : topology.linksOf(v)) {
+                if (!topology.isUp(link)) continue;
+                uint32_t u = topology.otherEnd(link, v);
+                if (seen[u]) continue;
+                seen[u] = 1;
+                port[u] = topology.linkSource(link) == u ? topology.linkSourcePort(link) : topology.linkTargetPort(link);
+                frontier.push_back(u);
+            }
+        }
+        return trees.emplace(target, move(port)).first->second;
+    }
+
+    // Порт, которым device отправил бы пакет для target (см. Computer::transmit,
+    // Switch::forwardFrame, Router::routeIp)
+    int egressPort(uint32_t device, uint32_t target) {
+        const NetworkDevice& from = *devices[device];
+        const NetworkDevice& to = *devices[target];
+        bool host = from.getKind() == DeviceKind::Computer;
+        if (host) {
+            auto neighbors = topology.neighborsOf(device);
+            for (size_t port = 0; port < neighbors.size(); ++port) {
+                if (neighbors.begin()[port] == target) return static_cast<int>(port);
+            }
+        } else if (from.getKind() == DeviceKind::Router && to.getIpAddress() != 0) {
+            int64_t port = static_cast<const Router&>(from).lookupRoute(to.getIpAddress());
+            if (port >= 0) return static_cast<int>(port);
+        }
+        int port = from.routePort(to.getRoutingIndex());
+        if (port >= 0) return port;
+        if (host && to.getIpAddress() != 0) {
+            auto neighbors = topology.neighborsOf(device);
+            for (size_t gateway = 0; gateway < neighbors.size(); ++gateway) {
+                if (devices[neighbors.begin()[gateway]]->forwardsIp()) return static_cast<int>(gateway);
+            }
+        }
+        return treeTo(target)[device];
+    }
+
+    // Путь потока от source до target; false - пакеты потока не дошли бы
+    bool resolvePath(uint32_t source, uint32_t target, int lastPacketBytes, FlowState& flow) {
+        uint32_t device = source;
+        for (int hops = 0; device != target; ++hops) {
+            if (hops >= DataPacket::defaultTtl) return false; // петля в таблицах
+            int port = egressPort(device, target);
+            if (port < 0 || static_cast<uint32_t>(port) >= topology.degree(device)) return false;
+            uint32_t link = topology.linksOf(device).begin()[port];
+            if (!topology.isUp(link)) return false;
+            uint32_t next = topology.otherEnd(link, device);
+            if (next != target && !topology.canTransit(next)) return false;
+            flow.path.push_back(2 * link + (topology.linkSource(link) == device ? 0 : 1));
+            flow.extra += topology.latency(link);
+            if (hops > 0) flow.extra += NetworkConnection::serializationDelay(lastPacketBytes, topology.bandwidth(link));
+            device = next;
+        }
+        return !flow.path.empty();
+    }
+
+    // Списывает переданное с момента прошлого пересчёта; Мбит/с - это rate / 8000 байт за нс
+    static void settle(FlowState& flow, SimTime now) {
+        flow.remaining = max(0.0, flow.remaining - flow.rate * static_cast<double>(now - flow.updated) / 8000.0);
+        flow.updated = now;
+    }
+
+    // Направление насыщено: его полоса занята целиком, и оно ограничивает идущие через
+    // него потоки. Через ненасыщенное направление изменение одного потока на другие не влияет
+    bool saturated(uint32_t resource) const {
+        return load[resource] >= capacity(resource) * (1.0 - saturationTolerance);
+    }
+
+    void touch(uint32_t resource) {
+        if (touched[resource] != epoch) {
+            touched[resource] = epoch;
+            resources.push_back(resource);
+        }
+    }
+
+    void expand(uint32_t resource) {
+        touch(resource);
+        if (expanded[resource] != epoch) {
+            expanded[resource] = epoch;
+            pending.push_back(resource);
+        }
+    }
+
+    // Добавляет к пересчёту потоки направлений из pending и, через насыщенные
+    // направления их путей, всех, кто с ними связан
+    void collectComponent() {
+        while (!pending.empty()) {
+            uint32_t resource = pending.back();
+            pending.pop_back();
+            for (uint32_t f : flowsOn[resource]) {
+                FlowState& flow = flows[f];
+                if (flow.visited == epoch) continue;
+                flow.visited = epoch;
+                component.push_back(f);
+                for (uint32_t r : flow.path) {
+                    if (saturated(r)) {
+                        expand(r);
+                    } else {
+                        touch(r);
+                    }
+                }
+            }
+        }
+    }
+
+    // Заполнение (progressive filling) для потоков компоненты; остальные потоки на её
+    // направлениях сохраняют скорость и занимают свою часть полосы. На каждом шаге
+    // фиксируются потоки самого узкого направления - с наименьшей равной долей на
+    // оставшиеся потоки; когда доля дорастает до темпа источника, он достаётся всем остальным
+    void fillComponent() {
+        using Share = pair<double, uint32_t>;
+        priority_queue<Share, vector<Share>, greater<Share>> bottlenecks; // по записи на направление
+        auto fairShare = [&](uint32_t r) { return max(0.0, capacityLeft[r]) / unfrozen[r]; };
+        auto freeze = [&](FlowState& flow, double share) {
+            flow.frozen = true;
+            flow.share = share;
+            for (uint32_t r : flow.path) {
+                capacityLeft[r] -= share;
+                unfrozen[r]--;
+            }
+        };
+        for (uint32_t r : resources) {
+            capacityLeft[r] = capacity(r) - load[r];
+            unfrozen[r] = 0;
+        }
+        for (uint32_t f : component) {
+            FlowState& flow = flows[f];
+            flow.frozen = false;
+            for (uint32_t r : flow.path) {
+                capacityLeft[r] += flow.rate;
+                unfrozen[r]++;
+            }
+        }
+        for (uint32_t r : resources) {
+            if (unfrozen[r]) bottlenecks.push({fairShare(r), r});
+        }
+        while (!bottlenecks.empty()) {
+            Share bottleneck = bottlenecks.top();
+            bottlenecks.pop();
+            uint32_t r = bottleneck.second;
+            if (unfrozen[r] == 0) continue;
+            // Пока запись ждала в очереди, часть потоков направления зафиксирована на
+            // меньших долях, и его доля выросла
+            double share = fairShare(r);
+            if (share != bottleneck.first) {
+                bottlenecks.push({share, r});
+                continue;
+            }
+            if (share >= flowLimit) break;
+            for (uint32_t f : flowsOn[r]) {
+                if (flows[f].visited == epoch && !flows[f].frozen) freeze(flows[f], share);
+            }
+        }
+        for (uint32_t f : component) {
+            if (!flows[f].frozen) freeze(flows[f], flowLimit);
+        }
+    }
+
+    // Пересчёт долей max-min после начала или окончания потоков на направлениях seeds.
+    // Пересчитываются только потоки, связанные с seeds через насыщенные направления;
+    // если после пересчёта насытилось направление, не вошедшее в компоненту, его потоки
+    // добавляются и расчёт повторяется - доли за пределами компоненты не меняются
+    void reallocate(const vector<uint32_t>& seeds, SimTime now, FluidResult& result) {
+        ++epoch;
+        resources.clear();
+        component.clear();
+        for (uint32_t r : seeds) expand(r);
+        while (true) {
+            collectComponent();
+            if (component.empty()) return;
+            fillComponent();
+            result.reallocations++;
+            for (size_t i = 0, n = resources.size(); i < n; ++i) {
+                uint32_t r = resources[i];
+                if (expanded[r] != epoch && capacityLeft[r] <= capacity(r) * saturationTolerance) expand(r);
+            }
+            if (pending.empty()) break;
+        }
+
+        // Прогноз окончания меняется только у потоков, чья скорость изменилась
+        for (uint32_t f : component) {
+            FlowState& flow = flows[f];
+            if (fabs(flow.share - flow.rate) <= flow.rate * rateTolerance) continue;
+            settle(flow, now);
+            for (uint32_t r : flow.path) load[r] += flow.share - flow.rate;
+            flow.rate = flow.share;
+            flow.version++;
+            result.rateChanges++;
+            if (flow.rate > 0) {
+                SimTime left = static_cast<SimTime>(ceil(flow.remaining * 8000.0 / flow.rate));
+                completions.push_back({now + left, f, flow.version});
+                push_heap(completions.begin(), completions.end(), greater<Completion>());
+            }
+        }
+
+        // В загруженной сети скорости меняются часто, и устаревшие прогнозы копились бы в куче
+        if (completions.size() > 4 * activeFlows + 1024) {
+            completions.erase(remove_if(completions.begin(), completions.end(),
+                                        [&](const Completion& c) { return c.version != flows[c.flow].version; }),
+                              completions.end());
+            make_heap(completions.begin(), completions.end(), greater<Completion>());
+        }
+    }
+
+    void popCompletion() {
+        pop_heap(completions.begin(), completions.end(), greater<Completion>());
+        completions.pop_back();
+    }
+
+    static void removeFlow(vector<uint32_t>& list, uint32_t flow) {
+        auto it = find(list.begin(), list.end(), flow);
+        if (it != list.end()) {
+            *it = list.back();
+            list.pop_back();
+        }
+    }
+
+public:
+    FluidSimulator(const vector<shared_ptr<NetworkDevice>>& devices, const TopologySnapshot& topology)
+        : devices(devices), topology(topology), flowsOn(2 * topology.linkCount()),
+          load(2 * topology.linkCount(), 0.0), capacityLeft(2 * topology.linkCount(), 0.0),
+          unfrozen(2 * topology.linkCount(), 0), touched(2 * topology.linkCount(), 0),
+          expanded(2 * topology.linkCount(), 0), epoch(0), flowLimit(0), activeFlows(0) {
+        indexOf.reserve(topology.deviceCount());
+        for (uint32_t v = 0; v < topology.deviceCount(); ++v) {
+            indexOf[topology.deviceId(v)] = v;
+        }
+    }
+
+    // Потоки flows (как для NetworkManager::scheduleWorkload) от модельного времени 0
+    FluidResult run(const vector<FlowSpec>& specs, int packetBytes, double rateMbps) {
+        if (packetBytes <= 0 || !(rateMbps > 0)) {
+            throw runtime_error("Размер пакета и скорость потока должны быть положительными");
+        }
+        if (specs.size() >= numeric_limits<uint32_t>::max()) {
+            throw runtime_error("Слишком много потоков для потоковой модели");
+        }
+        auto wallStart = chrono::steady_clock::now();
+        vector<pair<uint32_t, uint32_t>> ends(specs.size());
+        for (size_t i = 0; i < specs.size(); ++i) {
+            auto src = indexOf.find(specs[i].source);
+            auto dst = indexOf.find(specs[i].destination);
+            if (src == indexOf.end() || dst == indexOf.end()) {
+                throw runtime_error("Поток " + to_string(i) + ": устройство " +
+                                    to_string(src == indexOf.end() ? specs[i].source : specs[i].destination) +
+                                    " не найдено");
+            }
+            if (devices[src->second]->getKind() != DeviceKind::Computer) {
+                throw runtime_error("Поток " + to_string(i) + ": только компьютеры могут отправлять пакеты");
+            }
+            ends[i] = {src->second, dst->second};
+        }
+
+        FluidResult result;
+        result.completion.assign(specs.size(), -1);
+        flows.assign(specs.size(), FlowState());
+        flowLimit = rateMbps;
+        completions.clear();
+        activeFlows = 0;
+        for (auto& list : flowsOn) list.clear();
+        fill(load.begin(), load.end(), 0.0);
+        vector<uint32_t> order(specs.size());
+        iota(order.begin(), order.end(), 0U);
+        stable_sort(order.begin(), order.end(),
+                    [&](uint32_t a, uint32_t b) { return specs[a].start < specs[b].start; });
+
+        vector<uint32_t> seeds;
+        size_t next = 0;
+        while (true) {
+            while (!completions.empty() && completions.front().version != flows[completions.front().flow].version) {
+                popCompletion();
+            }
+            SimTime arrival = next < order.size() ? specs[order[next]].start : SIM_TIME_INFINITY;
+            SimTime finish = completions.empty() ? SIM_TIME_INFINITY : completions.front().time;
+            SimTime now = min(arrival, finish);
+            if (now == SIM_TIME_INFINITY) break;
+            result.events++;
+            seeds.clear();
+
+            // Все окончания и начала одного момента - один пересчёт
+            while (!completions.empty() && completions.front().time == now) {
+                Completion done = completions.front();
+                popCompletion();
+                FlowState& flow = flows[done.flow];
+                if (done.version != flow.version) continue;
+                result.completion[done.flow] = now - flow.start + flow.extra;
+                flow.version++;
+                activeFlows--;
+                for (uint32_t r : flow.path) {
+                    removeFlow(flowsOn[r], done.flow);
+                    load[r] -= flow.rate;
+                    seeds.push_back(r);
+                }
+                vector<uint32_t>().swap(flow.path);
+            }
+            while (next < order.size() && specs[order[next]].start == now) {
+                uint32_t f = order[next++];
+                const FlowSpec& spec = specs[f];
+                if (spec.bytes == 0) continue; // пакетов у такого потока нет (см. Computer::startFlow)
+                FlowState& flow = flows[f];
+                flow.start = flow.updated = now;
+                flow.remaining = static_cast<double>(spec.bytes);
+                int lastPacket = static_cast<int>(spec.bytes % static_cast<uint64_t>(packetBytes));
+                if (!resolvePath(ends[f].first, ends[f].second, lastPacket ? lastPacket : packetBytes, flow)) {
+                    vector<uint32_t>().swap(flow.path);
+                    result.unroutable++;
+                    continue;
+                }
+                for (uint32_t r : flow.path) {
+                    flowsOn[r].push_back(f);
+                    seeds.push_back(r);
+                }
+                activeFlows++;
+            }
+            reallocate(seeds, now, result);
+        }
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - wallStart).count();
+        return result;
+    }
+};
+
+// Файл, отображённый в память только для чтения. Страницы подгружаются системой по
+// мере обращения, поэтому открытие не зависит от размера файла
+class MappedFile {
+private:
+    const char* bytes;
+    size_t length;
+
+public:
+    explicit MappedFile(const string& path) : bytes(nullptr), length(0) {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw runtime_error("Не удалось открыть файл " + path);
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+            CloseHandle(file);
+            throw runtime_error("Файл " + path + " пуст или недоступен");
+        }
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping) {
+            throw runtime_error("Не удалось отобразить файл " + path);
+        }
+        const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (!view) {
+            throw runtime_error("Не удалось отобразить файл " + path);
+        }
+        bytes = static_cast<const char*>(view);
+        length = static_cast<size_t>(size.QuadPart);
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw runtime_error("Не удалось открыть файл " + path);
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            close(fd);
+            throw runtime_error("Файл " + path + " пуст или недоступен");
+        }
+        void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (view == MAP_FAILED) {
+            throw runtime_error("Не удалось отобразить файл " + path);
+        }
+        bytes = static_cast<const char*>(view);
+        length = static_cast<size_t>(info.st_size);
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        UnmapViewOfFile(bytes);
+#else
+        munmap(const_cast<char*>(bytes), length);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+// Двоичный формат топологии (см. NetworkManager::saveNetwork). За заголовком идут секции
+// устройств, соединений и маршрутов FIB - массивы записей фиксированного размера,
+// выровненные по 8 байтам, - и секция строк. Отображённый в память файл используется как
+// есть, без разбора. Числа записаны в порядке байтов машины (x86 и ARM - little-endian)
+struct TopologyFileHeader {
+    static constexpr char magicValue[8] = {'N', 'E', 'T', 'T', 'O', 'P', '0', '1'};
+    static constexpr uint32_t currentVersion = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t headerBytes;
+    uint64_t deviceCount;
+    uint64_t linkCount;
+    uint64_t routeCount;
+    uint64_t stringBytes;
+    uint64_t deviceOffset;
+    uint64_t linkOffset;
+    uint64_t routeOffset;
+    uint64_t stringOffset;
+    uint64_t fileBytes;
+};
+
+// Имя и атрибут устройства лежат в секции строк подряд с позиции stringOffset.
+// Атрибут: номер телефона, модель принтера, тип сервера или IP-диапазон роутера
+struct DeviceRecord {
+    uint64_t mac;
+    int32_t id;
+    uint32_t ip;    // IPv4-адрес компьютера
+    int32_t ports;  // число портов коммутатора или роутера
+    uint8_t kind;   // DeviceKind
+    uint8_t reserved[3];
+    uint32_t nameBytes;
+    uint32_t attributeBytes;
+    uint64_t stringOffset;
+};
+
+// Соединения записаны в порядке ID, концы - номера устройств в секции устройств.
+// Порты устройства назначаются в этом же порядке, поэтому записанные номера портов
+// служат проверкой целостности
+struct LinkRecord {
+    static constexpr uint32_t noDevice = ~0U; // конец соединения удалён (см. removeDevice)
+
+    uint32_t from;
+    uint32_t to;
+    int32_t portFrom;
+    int32_t portTo;
+    float bandwidth;
+    int32_t latency;
+    uint32_t queueCapacity;
+    uint8_t policy; // DropPolicy
+    uint8_t up;
+    uint8_t reserved[2];
+};
+
+struct RouteRecord {
+    uint32_t device; // номер роутера в секции устройств
+    uint32_t prefix;
+    uint32_t port;
+    uint8_t length;
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(TopologyFileHeader) % 8 == 0 && sizeof(DeviceRecord) == 40 &&
+              sizeof(LinkRecord) == 32 && sizeof(RouteRecord) == 16,
+              "формат файла топологии зависит от размеров записей");
+
+// Проверенное представление отображённого файла топологии: секции доступны как массивы.
+// Тот же образ может лежать и внутри другого файла (полный сегмент контрольной точки)
+class TopologyFile {
+private:
+    unique_ptr<MappedFile> mapped; // nullptr - образ принадлежит вызывающему
+    string_view image;
+    const TopologyFileHeader* header;
+
+    template <typename T>
+    const T* section(uint64_t offset, uint64_t count) const {
+        if (offset % alignof(T) != 0 || offset > image.size() || count > (image.size() - offset) / sizeof(T)) {
+            throw runtime_error("Файл топологии повреждён: секция выходит за границы файла");
+        }
+        return reinterpret_cast<const T*>(image.data() + offset);
+    }
+
+    void open(const string& path) {
+        if (image.size() < sizeof(TopologyFileHeader) ||
+            reinterpret_cast<uintptr_t>(image.data()) % alignof(TopologyFileHeader) != 0) {
+            throw runtime_error("Файл " + path + " не является файлом топологии");
+        }
+        header = reinterpret_cast<const TopologyFileHeader*>(image.data());
+        if (memcmp(header->magic, TopologyFileHeader::magicValue, sizeof(header->magic)) != 0) {
+            throw runtime_error("Файл " + path + " не является файлом топологии");
+        }
+        if (header->version != TopologyFileHeader::currentVersion || header->headerBytes != sizeof(TopologyFileHeader)) {
+            throw runtime_error("Неподдерживаемая версия файла топологии: " + to_string(header->version));
+        }
+        if (header->fileBytes != image.size()) {
+            throw runtime_error("Файл топологии повреждён: неверный размер");
+        }
+        section<DeviceRecord>(header->deviceOffset, header->deviceCount);
+        section<LinkRecord>(header->linkOffset, header->linkCount);
+        section<RouteRecord>(header->routeOffset, header->routeCount);
+        section<char>(header->stringOffset, header->stringBytes);
+    }
+
+public:
+    explicit TopologyFile(const string& path) : mapped(make_unique<MappedFile>(path)), header(nullptr) {
+        image = string_view(mapped->data(), mapped->size());
+        open(path);
+    }
+
+    // Образ в памяти, выровненный по 8 байтам; origin - откуда он взят (для сообщений)
+    TopologyFile(string_view bytes, const string& origin) : image(bytes), header(nullptr) {
+        open(origin);
+    }
+
+    // Начинается ли файл с сигнатуры двоичного формата (в отличие от текстового описания)
+    static bool isBinary(const string& path) {
+        ifstream in(path, ios::binary);
+        char magic[sizeof(TopologyFileHeader::magicValue)] = {};
+        in.read(magic, sizeof(magic));
+        return in && memcmp(magic, TopologyFileHeader::magicValue, sizeof(magic)) == 0;
+    }
+
+    size_t deviceCount() const { return header->deviceCount; }
+    size_t linkCount() const { return header->linkCount; }
+    size_t routeCount() const { return header->routeCount; }
+
+    const DeviceRecord* devices() const { return section<DeviceRecord>(header->deviceOffset, header->deviceCount); }
+    const LinkRecord* links() const { return section<LinkRecord>(header->linkOffset, header->linkCount); }
+    const RouteRecord* routes() const { return section<RouteRecord>(header->routeOffset, header->routeCount); }
+
+    string_view text(uint64_t offset, uint32_t bytes) const {
+        if (offset > header->stringBytes || bytes > header->stringBytes - offset) {
+            throw runtime_error("Файл топологии повреждён: строка выходит за границы секции");
+        }
+        return string_view(image.data() + header->stringOffset + offset, bytes);
+    }
+
+    string_view name(const DeviceRecord& r) const { return text(r.stringOffset, r.nameBytes); }
+    string_view attribute(const DeviceRecord& r) const {
+        return text(r.stringOffset + r.nameBytes, r.attributeBytes);
+    }
+};
+
+// Строка JSON в кавычках с экранированием
+inline void writeJsonString(ostream& out, string_view s) {
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out << "\\u00" << hex << setw(2) << setfill('0') << static_cast<int>(c) << dec << setfill(' ');
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+enum class MetricsFormat { Json, Csv };
+
+// Выгрузка метрик: счётчики соединений по направлениям, счётчики устройств и гистограмма
+// задержек доставки. Соединения и устройства без единого события не выводятся. JSON
+// пишется по объекту на снимок в строке (JSON Lines), CSV - в длинном формате
+// "time_ms,scope,id,metric,value", поэтому снимки через равные интервалы модельного
+// времени дописываются в один файл. Счётчики накопительные: величины за интервал -
+// разность соседних снимков; интервалы, в которых не было событий, пропускаются
+class MetricsExporter {
+private:
+    ofstream out;
+    MetricsFormat format;
+    SimTime interval;     // 0 - снимки только в конце прогона
+    SimTime nextSnapshot;
+    uint64_t snapshots;
+
+    static constexpr double reportedPercentiles[] = {50.0, 90.0, 99.0, 99.9};
+
+    static string percentileName(double p) {
+        ostringstream name;
+        name << "p" << p << "_ns";
+        string s = name.str();
+        replace(s.begin(), s.end(), '.', '_');
+        return s;
+    }
+
+    static int deviceId(const NetworkDevice* device) { return device ? device->getId() : -1; }
+
+    static bool active(const LinkStats& st) {
+        return st.transmittedPackets || st.dropped() || st.queueDepth;
+    }
+
+    static bool active(const DeviceCounters& c) {
+        return c.received || c.sent || c.forwarded || c.flooded || c.filtered || c.dropped;
+    }
+
+    static double utilization(const LinkStats& st, SimTime time) {
+        return time > 0 ? static_cast<double>(st.busyTime) / time : 0.0;
+    }
+
+    void writeJson(SimTime time, const vector<shared_ptr<NetworkDevice>>& devices,
+                   const vector<shared_ptr<NetworkConnection>>& connections, const LatencyHistogram& latency) {
+        out << "{\"time_ms\": " << toMilliseconds(time) << ", \"links\": [";
+        bool first = true;
+        for (const auto& conn : connections) {
+            for (int dir = 0; dir < 2; ++dir) {
+                const LinkStats& st = conn->getStats(dir);
+                if (!active(st)) continue;
+                out << (first ? "" : ", ") << "{\"id\": " << conn->getId() << ", \"direction\": " << dir
+                    << ", \"from\": " << deviceId(conn->getSender(dir)) << ", \"to\": " << deviceId(conn->getSender(1 - dir))
+                    << ", \"packets\": " << st.transmittedPackets << ", \"bytes\": " << st.transmittedBytes
+                    << ", \"busy_ns\": " << st.busyTime << ", \"utilization\": " << utilization(st, time)
+                    << ", \"queue_depth\": " << st.queueDepth << ", \"max_queue_depth\": " << st.maxQueueDepth
+                    << ", \"dropped_tail\": " << st.droppedTail << ", \"dropped_red\": " << st.droppedRed
+                    << ", \"dropped_down\": " << st.droppedDown << "}";
+                first = false;
+            }
+        }
+        out << "], \"devices\": [";
+        first = true;
+        for (const auto& device : devices) {
+            DeviceCounters c = device->getCounters();
+            if (!active(c)) continue;
+            out << (first ? "" : ", ") << "{\"id\": " << device->getId() << ", \"name\": ";
+            writeJsonString(out, device->getName());
+            out << ", \"received\": " << c.received << ", \"sent\": " << c.sent << ", \"forwarded\": " << c.forwarded
+                << ", \"flooded\": " << c.flooded << ", \"filtered\": " << c.filtered << ", \"dropped\": " << c.dropped << "}";
+            first = false;
+        }
+        out << "], \"latency\": {\"count\": " << latency.getCount() << ", \"min_ns\": " << latency.getMin()
+            << ", \"mean_ns\": " << latency.getMean();
+        for (double p : reportedPercentiles) {
+            out << ", \"" << percentileName(p) << "\": " << latency.percentile(p);
+        }
+        out << ", \"max_ns\": " << latency.getMax() << ", \"buckets\": [";
+        first = true;
+        latency.forEachBucket([&](uint64_t low, uint64_t high, uint64_t count) {
+            out << (first ? "" : ", ") << "[" << low << ", " << high << ", " << count << "]";
+            first = false;
+        });
+        out << "]}}\n";
+    }
+
+    void writeCsv(SimTime time, const vector<shared_ptr<NetworkDevice>>& devices,
+                  const vector<shared_ptr<NetworkConnection>>& connections, const LatencyHistogram& latency) {
+        double ms = toMilliseconds(time);
+        auto row = [&](const char* scope, const string& id, const string& metric, auto value) {
+            out << ms << ',' << scope << ',' << id << ',' << metric << ',' << value << '\n';
+        };
+        for (const auto& conn : connections) {
+            for (int dir = 0; dir < 2; ++dir) {
+                const LinkStats& st = conn->getStats(dir);
+                if (!active(st)) continue;
+                string id = to_string(conn->getId()) + ":" + to_string(dir);
+                row("link", id, "packets", st.transmittedPackets);
+                row("link", id, "bytes", st.transmittedBytes);
+                row("link", id, "busy_ns", st.busyTime);
+                row("link", id, "utilization", utilization(st, time));
+                row("link", id, "queue_depth", st.queueDepth);
+                row("link", id, "max_queue_depth", st.maxQueueDepth);
+                row("link", id, "dropped_tail", st.droppedTail);
+                row("link", id, "dropped_red", st.droppedRed);
+                row("link", id, "dropped_down", st.droppedDown);
+            }
+        }
+        for (const auto& device : devices) {
+            DeviceCounters c = device->getCounters();
+            if (!active(c)) continue;
+            string id = to_string(device->getId());
+            row("device", id, "received", c.received);
+            row("device", id, "sent", c.sent);
+            row("device", id, "forwarded", c.forwarded);
+            row("device", id, "flooded", c.flooded);
+            row("device", id, "filtered", c.filtered);
+            row("device", id, "dropped", c.dropped);
+        }
+        row("latency", "all", "count", latency.getCount());
+        row("latency", "all", "min_ns", latency.getMin());
+        row("latency", "all", "mean_ns", latency.getMean());
+        for (double p : reportedPercentiles) {
+            row("latency", "all", percentileName(p), latency.percentile(p));
+        }
+        row("latency", "all", "max_ns", latency.getMax());
+        latency.forEachBucket([&](uint64_t low, uint64_t high, uint64_t count) {
+            row("latency", "all", "bucket_" + to_string(low) + "_" + to_string(high), count);
+        });
+    }
+
+public:
+    MetricsExporter(const string& path, MetricsFormat format, SimTime interval, SimTime now)
+        : out(path, ios::trunc), format(format), interval(interval), nextSnapshot(SIM_TIME_INFINITY), snapshots(0) {
+        if (!out) {
+            throw runtime_error("Не удалось создать файл " + path);
+        }
+        if (interval < 0) {
+            throw runtime_error("Интервал метрик не может быть отрицательным");
+        }
+        out << setprecision(12);
+        if (format == MetricsFormat::Csv) {
+            out << "time_ms,scope,id,metric,value\n";
+        }
+        skipTo(now + 1);
+    }
+
+    // Момент следующего периодического снимка; SIM_TIME_INFINITY - снимки только в конце прогона
+    SimTime nextSnapshotTime() const { return nextSnapshot; }
+
+    // Следующий снимок - на первой границе интервала не раньше time
+    void skipTo(SimTime time) {
+        if (interval > 0) nextSnapshot = (time + interval - 1) / interval * interval;
+    }
+
+    void write(SimTime time, const vector<shared_ptr<NetworkDevice>>& devices,
+               const vector<shared_ptr<NetworkConnection>>& connections, const LatencyHistogram& latency) {
+        if (format == MetricsFormat::Json) {
+            writeJson(time, devices, connections, latency);
+        } else {
+            writeCsv(time, devices, connections, latency);
+        }
+        out.flush();
+        snapshots++;
+    }
+
+    uint64_t getSnapshots() const { return snapshots; }
+};
+
+// Заменяет файл to файлом from одной операцией: при сбое на диске остаётся либо
+// старый файл, либо новый целиком
+inline void replaceFile(const string& from, const string& to) {
+#ifdef _WIN32
+    bool replaced = MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    bool replaced = std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+    if (!replaced) {
+        std::remove(from.c_str());
+        throw runtime_error("Не удалось заменить файл " + to);
+    }
+}
+
+// Заголовок сегмента журнала контрольных точек. Размер кратен 8, поэтому образ топологии
+// в теле полного сегмента лежит по выровненному смещению и читается из отображённого
+// файла как есть (см. TopologyFile)
+struct CheckpointSegmentHeader {
+    static constexpr char magicValue[8] = {'N', 'E', 'T', 'C', 'K', 'P', '0', '1'};
+    static constexpr uint32_t currentVersion = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t full;      // 1 - полный сегмент, 0 - изменения после предыдущего
+    uint64_t sequence;  // номер сегмента в журнале, полный - 0
+    int64_t time;       // модельное время точки
+    uint64_t bodyBytes;
+    uint64_t checksum;  // FNV-1a тела
+};
+
+static_assert(sizeof(CheckpointSegmentHeader) == 48, "формат журнала контрольных точек зависит от размера заголовка");
+
+// Журнал контрольных точек. Первый сегмент файла полный: образ топологии (формат
+// saveNetwork), таблицы маршрутов и всё изменяемое состояние модели. За ним дописываются
+// сегменты изменений: часы и счётчики симулятора, устройства и соединения, которые
+// менялись, и связанные с ними события (см. Simulator::saveEvents); очередь событий
+// целиком - только если её очищали после прошлой точки. Полный сегмент
+// пишется во временный файл и заменяет журнал - при смене топологии и когда изменений
+// накопилось больше самого полного сегмента, чтобы восстановление не читало лишнего.
+// Сегмент, дописанный не до конца (сбой во время записи), при чтении отбрасывается
+class CheckpointStore {
+public:
+    // Сегмент прочитанного журнала; body указывает в отображённый файл
+    struct Segment {
+        bool full;
+        SimTime time;
+        string_view body;
+    };
+
+private:
+    string path;
+    ofstream journal;
+    SimTime interval;         // 0 - точки только в конце прогона и по запросу
+    SimTime nextCheckpoint;
+    uint64_t sequence;        // номер следующего сегмента
+    uint64_t fullBytes;       // размер полного сегмента в начале журнала
+    uint64_t journalBytes;
+    uint64_t topologyVersion; // версия топологии NetworkManager в полном сегменте
+    bool needFull;            // журнал ещё не начат или последняя запись не удалась
+    mt19937 writtenRng;       // генератор менеджера на момент последней записи
+    uint64_t written;
+    uint64_t fullWrites;      // из них полных
+    uint64_t changeBytes;     // всего записано в сегментах изменений
+    uint64_t lastBytes;
+    bool lastFull;
+
+    static void writeSegment(ostream& out, bool full, uint64_t sequence, SimTime time, const string& body) {
+        CheckpointSegmentHeader header{};
+        memcpy(header.magic, CheckpointSegmentHeader::magicValue, sizeof(header.magic));
+        header.version = CheckpointSegmentHeader::currentVersion;
+        header.full = full;
+        header.sequence = sequence;
+        header.time = time;
+        header.bodyBytes = body.size();
+        header.checksum = checksum(body);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(body.data(), body.size());
+    }
+
+    void recordWrite(size_t bodyBytes, const mt19937& rng, bool full) {
+        writtenRng = rng;
+        written++;
+        lastBytes = sizeof(CheckpointSegmentHeader) + bodyBytes;
+        lastFull = full;
+        if (full) {
+            fullWrites++;
+        } else {
+            changeBytes += lastBytes;
+        }
+    }
+
+public:
+    CheckpointStore(const string& path, SimTime interval, SimTime now)
+        : path(path), interval(interval), nextCheckpoint(SIM_TIME_INFINITY), sequence(0), fullBytes(0),
+          journalBytes(0), topologyVersion(0), needFull(true), written(0), fullWrites(0), changeBytes(0), lastBytes(0), lastFull(false) {
+        if (interval < 0) {
+            throw runtime_error("Интервал контрольных точек не может быть отрицательным");
+        }
+        skipTo(now + 1);
+    }
+
+    static uint64_t checksum(string_view bytes) {
+        uint64_t hash = 1469598103934665603ULL;
+        for (char c : bytes) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    // Момент следующей периодической точки; SIM_TIME_INFINITY - только в конце прогона
+    SimTime nextCheckpointTime() const { return nextCheckpoint; }
+
+    // Следующая точка - на первой границе интервала не раньше time
+    void skipTo(SimTime time) {
+        if (interval > 0) nextCheckpoint = (time + interval - 1) / interval * interval;
+    }
+
+    // Нужен ли полный сегмент вместо сегмента изменений
+    bool needsFull(uint64_t version) const {
+        return needFull || version != topologyVersion || journalBytes - fullBytes > fullBytes;
+    }
+
+    bool rngChanged(const mt19937& rng) const { return needFull || !(rng == writtenRng); }
+
+    // Полный сегмент начинает журнал заново
+    void writeFull(const string& body, SimTime time, uint64_t version, const mt19937& rng) {
+        needFull = true;
+        string temporary = path + ".tmp";
+        ofstream out(temporary, ios::binary | ios::trunc);
+        if (!out) {
+            throw runtime_error("Не удалось создать файл " + temporary);
+        }
+        writeSegment(out, true, 0, time, body);
+        out.close();
+        if (!out) {
+            std::remove(temporary.c_str());
+            throw runtime_error("Ошибка записи файла " + temporary);
+        }
+        journal.close();
+        replaceFile(temporary, path);
+        journal.open(path, ios::binary | ios::app);
+        if (!journal) {
+            throw runtime_error("Не удалось открыть файл " + path);
+        }
+        sequence = 1;
+        fullBytes = journalBytes = sizeof(CheckpointSegmentHeader) + body.size();
+        topologyVersion = version;
+        needFull = false;
+        recordWrite(body.size(), rng, true);
+    }
+
+    // Сегмент изменений дописывается в конец журнала. При ошибке записи хвост журнала
+    // мог остаться недописанным, поэтому следующая точка будет полной
+    void append(const string& body, SimTime time, const mt19937& rng) {
+        writeSegment(journal, false, sequence, time, body);
+        journal.flush();
+        if (!journal) {
+            needFull = true;
+            journal.clear();
+            throw runtime_error("Ошибка записи файла " + path);
+        }
+        sequence++;
+        journalBytes += sizeof(CheckpointSegmentHeader) + body.size();
+        recordWrite(body.size(), rng, false);
+    }
+
+    // Сегменты журнала по порядку, начиная с полного. Чтение останавливается на первом
+    // повреждённом или недописанном сегменте; discarded - сколько байт отброшено
+    static vector<Segment> readJournal(const MappedFile& file, const string& path, size_t& discarded) {
+        vector<Segment> segments;
+        size_t offset = 0;
+        while (file.size() - offset >= sizeof(CheckpointSegmentHeader)) {
+            CheckpointSegmentHeader header;
+            memcpy(&header, file.data() + offset, sizeof(header));
+            bool valid = memcmp(header.magic, CheckpointSegmentHeader::magicValue, sizeof(header.magic)) == 0 &&
+                         header.version == CheckpointSegmentHeader::currentVersion &&
+                         header.sequence == segments.size() && (header.full != 0) == segments.empty() &&
+                         header.bodyBytes <= file.size() - offset - sizeof(header);
+            if (!valid) break;
+            string_view body(file.data() + offset + sizeof(header), static_cast<size_t>(header.bodyBytes));
+            if (checksum(body) != header.checksum) break;
+            segments.push_back({header.full != 0, header.time, body});
+            offset += sizeof(header) + body.size();
+        }
+        if (segments.empty()) {
+            throw runtime_error("Файл " + path + " не является журналом контрольных точек или повреждён");
+        }
+        discarded = file.size() - offset;
+        return segments;
+    }
+
+    const string& getPath() const { return path; }
+    uint64_t getWritten() const { return written; }
+    uint64_t getLastBytes() const { return lastBytes; }
+    bool isLastFull() const { return lastFull; }
+    uint64_t getJournalBytes() const { return journalBytes; }
+    uint64_t getFullBytes() const { return fullBytes; }
+    uint64_t getFullWrites() const { return fullWrites; }
+    uint64_t getChangeBytes() const { return changeBytes; }
+};
+
+class NetworkManager {
+private:
+    // Пулы пакетов объявлены первыми: они должны пережить устройства, соединения и события
+    PacketPool packetPool;
+    vector<unique_ptr<PacketPool>> partitionPools;
+    unique_ptr<PcapWriter> capture; // захват трафика; устройства и соединения хранят указатель на него
+    unique_ptr<MetricsExporter> metrics; // выгрузка метрик, nullptr - не ведётся
+    unique_ptr<CheckpointStore> checkpoints; // журнал контрольных точек, nullptr - не ведётся
+    NetworkRegistry registry; // владеет устройствами и соединениями по дескрипторам
+    vector<shared_ptr<NetworkDevice>> devices;
+    vector<shared_ptr<NetworkConnection>> connections;
+    unordered_map<int, size_t> deviceIndex;     // ID устройства -> позиция в devices
+    unordered_map<uint64_t, size_t> linkIndex;  // пара ID (см. linkKey) -> позиция в connections
+    Simulator simulator;
+    shared_ptr<const TopologySnapshot> topologySnapshot; // nullptr - топология менялась после снимка
+    RoutingService routing;
+    bool routesStale; // нужен полный расчёт маршрутов (ещё не считались или сменилась метрика)
+    uint64_t topologyVersion; // растёт при каждом изменении топологии, FIB и таблиц маршрутов
+    mt19937 rng;
+    int simulationThreads;
+    // Разбиение на ЛП и их потоки переживают прогон, пока не сменились топология или число
+    // потоков; parallelTopology - снимок, по которому разбиение построено
+    unique_ptr<ParallelSimulator> parallel;
+    shared_ptr<const TopologySnapshot> parallelTopology;
+
+    // Предел событий на один прогон: защищает от бесконечного flooding в топологиях с петлями
+    static constexpr uint64_t maxEventsPerRun = 1000000;
+
+    // Добавка к пределу на каждый пакет нагрузки (таймер, передачи и приёмы на пути)
+    static constexpr uint64_t eventsPerPacketBudget = 64;
+
+    // Таблицы маршрутов всех пар занимают O(V^2) памяти; в сетях крупнее этого предела
+    // они не строятся, и пакеты пересылаются по изученным MAC-адресам и FIB роутеров
+    static constexpr size_t maxRoutedDevices = 8192;
+
+    int findDeviceById(int id) const {
+        auto it = deviceIndex.find(id);
+        return it != deviceIndex.end() ? static_cast<int>(it->second) : -1;
+    }
+
+    // Ключ неупорядоченной пары устройств: соединение 1-2 и 2-1 - одно и то же
+    static uint64_t linkKey(int id1, int id2) {
+        uint32_t a = static_cast<uint32_t>(min(id1, id2));
+        uint32_t b = static_cast<uint32_t>(max(id1, id2));
+        return (static_cast<uint64_t>(a) << 32) | b;
+    }
+
+    shared_ptr<NetworkConnection> findConnection(int id1, int id2) const {
+        auto it = linkIndex.find(linkKey(id1, id2));
+        return it != linkIndex.end() ? connections[it->second] : nullptr;
+    }
+
+    bool connectionExists(int id1, int id2) const { return linkIndex.count(linkKey(id1, id2)) != 0; }
+
+    PcapWriter& requireCapture() const {
+        if (!capture) {
+            throw runtime_error("Захват трафика не начат");
+        }
+        return *capture;
+    }
+
+    // Топология, FIB или таблицы маршрутов изменились: снимок устарел, а следующая
+    // контрольная точка должна быть полной
+    void topologyChanged() {
+        topologySnapshot.reset();
+        topologyVersion++;
+    }
+
+    void invalidateRoutes() {
+        topologyChanged();
+        routing.clear();
+        routesStale = true;
+    }
+
+    // Создаёт и регистрирует устройство без вывода в консоль
+    shared_ptr<NetworkDevice> createDevice(const string& type, int id, const string& name,
+                                           MacAddress mac, const string& ip, int ports) {
+        if (findDeviceById(id) != -1) {
+            throw runtime_error("Устройство с таким ID уже существует");
+        }
+
+        shared_ptr<NetworkDevice> newDevice;
+        if (type == "Computer") {
+            newDevice = make_shared<Computer>(id, name, mac, ip);
+        } else if (type == "Switch") {
+            if (ports <= 0) {
+                throw runtime_error("Количество портов коммутатора должно быть больше нуля");
+            }
+            newDevice = make_shared<Switch>(id, name, mac, ports);
+        } else if (type == "Phone") {
+            string phoneNumber = "+7-" + to_string(uniform_int_distribution<int>(1000000, 9999999)(rng));
+            newDevice = make_shared<Phone>(id, name, mac, phoneNumber);
+        } else if (type == "Router") {
+            // Диапазон и число портов необязательны: по умолчанию 192.168.1.0/24 и 24 порта
+            newDevice = make_shared<Router>(id, name, mac, ip.empty() ? "192.168.1.0/24" : ip, ports > 0 ? ports : 24);
+        } else if (type == "Printer") {
+            static const vector<string> models = {"HP LaserJet", "Canon Pixma", "Epson WorkForce", "Brother HL"};
+            string model = models[uniform_int_distribution<int>(0, models.size()-1)(rng)];
+            newDevice = make_shared<Printer>(id, name, mac, model);
+        } else if (type == "Server") {
+            static const vector<string> serverTypes = {"Web", "Database", "File", "Mail"};
+            string serverType = serverTypes[uniform_int_distribution<int>(0, serverTypes.size()-1)(rng)];
+            newDevice = make_shared<Server>(id, name, mac, serverType);
+        } else {
+            throw runtime_error("Неизвестный тип устройства");
+        }
+
+        newDevice->attachSimulator(&simulator);
+        newDevice->setHandle(registry.devices.insert(newDevice));
+        if (TraceLog::active()) TraceLog::instance().describeDevice(id, name);
+        deviceIndex[id] = devices.size();
+        devices.push_back(newDevice);
+        topologyChanged();
+        if (!routesStale) {
+            if (devices.size() > maxRoutedDevices) {
+                invalidateRoutes();
+            } else {
+                routing.addNode(newDevice);
+            }
+        }
+        return newDevice;
+    }
+
+    // Создаёт соединение со всеми проверками, без вывода в консоль
+    shared_ptr<NetworkConnection> createConnection(int id1, int id2, float bw, int lat,
+                                                   size_t queueCapacity, DropPolicy policy) {
+        if (bw <= 0) {
+            throw runtime_error("Пропускная способность должна быть положительной");
+        }
+        if (lat < 0) {
+            throw runtime_error("Задержка не может быть отрицательной");
+        }
+        
+        int idx1 = findDeviceById(id1);
+        int idx2 = findDeviceById(id2);
+        
+        if (idx1 == -1 || idx2 == -1) {
+            throw runtime_error("Одно или оба устройства не найдены");
+        }
+        if (idx1 == idx2) {
+            throw runtime_error("Нельзя соединить устройство с самим собой");
+        }
+
+        if (connectionExists(id1, id2)) {
+            throw runtime_error("Соединение уже существует");
+        }
+
+        for (int idx : {idx1, idx2}) {
+            if (!devices[idx]->hasFreePort()) {
+                throw runtime_error("У устройства " + devices[idx]->getName() + " нет свободных портов");
+            }
+        }
+
+        auto conn = make_shared<NetworkConnection>(static_cast<int>(connections.size()), devices[idx1], devices[idx2],
+                                                   bw, lat, queueCapacity, policy, rng());
+        conn->setHandle(registry.links.insert(conn));
+        linkIndex[linkKey(id1, id2)] = connections.size();
+        connections.push_back(conn);
+        int port1 = devices[idx1]->addConnection(conn);
+        int port2 = devices[idx2]->addConnection(conn);
+        conn->setPorts(port1, port2);
+        topologyChanged();
+        if (!routesStale) routing.addLink(*conn);
+
+        // Маршрутизатор сразу знает маршрут к непосредственно подключённому узлу с IP
+        if (auto router = deviceCast<Router>(devices[idx1])) {
+            if (devices[idx2]->getIpAddress()) router->addRoute(devices[idx2]->getIpAddress(), 32, port1);
+        }
+        if (auto router = deviceCast<Router>(devices[idx2])) {
+            if (devices[idx1]->getIpAddress()) router->addRoute(devices[idx1]->getIpAddress(), 32, port2);
+        }
+        return conn;
+    }
+
+    // Удаляет все устройства, соединения и запланированные события
+    void clearNetwork() {
+        simulator.reset();
+        devices.clear();
+        connections.clear();
+        registry.devices.clear();
+        registry.links.clear();
+        deviceIndex.clear();
+        linkIndex.clear();
+        invalidateRoutes();
+    }
+
+    // Устройство по записи файла топологии (запись уже проверена в loadBinary)
+    static shared_ptr<NetworkDevice> makeDevice(const DeviceRecord& r, const string& name, const string& attribute) {
+        MacAddress mac(r.mac);
+        switch (static_cast<DeviceKind>(r.kind)) {
+            case DeviceKind::Computer: return make_shared<Computer>(r.id, name, mac, r.ip);
+            case DeviceKind::Switch: return make_shared<Switch>(r.id, name, mac, r.ports);
+            case DeviceKind::Phone: return make_shared<Phone>(r.id, name, mac, attribute);
+            case DeviceKind::Router: return make_shared<Router>(r.id, name, mac, attribute, r.ports);
+            case DeviceKind::Printer: return make_shared<Printer>(r.id, name, mac, attribute);
+            case DeviceKind::Server: return make_shared<Server>(r.id, name, mac, attribute);
+        }
+        return nullptr;
+    }
+
+    // Записи проверяются до создания объектов: исключение в рабочем потоке parallelFor
+    // завершило бы программу. Возвращает число соединений каждого устройства
+    static vector<uint32_t> validate(const TopologyFile& file) {
+        const DeviceRecord* records = file.devices();
+        for (size_t i = 0; i < file.deviceCount(); ++i) {
+            const DeviceRecord& r = records[i];
+            if (r.kind >= deviceKindCount) {
+                throw runtime_error("Файл топологии повреждён: неизвестный тип устройства " + to_string(r.kind));
+            }
+            if (static_cast<DeviceKind>(r.kind) == DeviceKind::Switch && r.ports <= 0) {
+                throw runtime_error("Файл топологии повреждён: у коммутатора нет портов");
+            }
+            file.name(r);
+            file.attribute(r);
+        }
+        const LinkRecord* links = file.links();
+        for (size_t e = 0; e < file.linkCount(); ++e) {
+            const LinkRecord& r = links[e];
+            bool endsValid = (r.from == LinkRecord::noDevice || r.from < file.deviceCount()) &&
+                             (r.to == LinkRecord::noDevice || r.to < file.deviceCount()) &&
+                             (r.from != r.to || r.from == LinkRecord::noDevice);
+            if (!endsValid || r.queueCapacity == 0 || !(r.bandwidth > 0) || r.latency < 0 ||
+                r.policy > static_cast<uint8_t>(DropPolicy::RED)) {
+                throw runtime_error("Файл топологии повреждён: неверная запись соединения " + to_string(e));
+            }
+        }
+
+        // Порты устройства назначаются по порядку соединений, поэтому записанный номер
+        // порта должен совпасть с числом уже встреченных соединений этого устройства
+        vector<uint32_t> degree(file.deviceCount(), 0);
+        for (size_t e = 0; e < file.linkCount(); ++e) {
+            const LinkRecord& r = links[e];
+            bool portsMatch = (r.from == LinkRecord::noDevice || r.portFrom == static_cast<int32_t>(degree[r.from]++)) &&
+                              (r.to == LinkRecord::noDevice || r.portTo == static_cast<int32_t>(degree[r.to]++));
+            if (!portsMatch) {
+                throw runtime_error("Файл топологии повреждён: порты соединения " + to_string(e) + " не совпадают");
+            }
+        }
+        for (size_t i = 0; i < file.deviceCount(); ++i) {
+            DeviceKind kind = static_cast<DeviceKind>(records[i].kind);
+            bool limited = kind == DeviceKind::Switch || kind == DeviceKind::Router;
+            if (limited && degree[i] > static_cast<uint32_t>(max(records[i].ports, 0))) {
+                throw runtime_error("Файл топологии повреждён: у устройства " + to_string(records[i].id) +
+                                    " соединений больше, чем портов");
+            }
+        }
+        return degree;
+    }
+
+    // Загрузка двоичного файла (или образа из контрольной точки, origin - откуда он).
+    // Повреждённый файл обнаруживается до замены текущей сети; если ошибка найдена
+    // позже (повтор ID или соединения), сеть остаётся пустой
+    void loadBinary(const TopologyFile& file, const string& origin) {
+        auto start = chrono::steady_clock::now();
+        vector<uint32_t> degree = validate(file);
+        clearNetwork();
+        try {
+            unsigned threads = max(1u, thread::hardware_concurrency());
+            size_t deviceCount = file.deviceCount();
+            size_t linkCount = file.linkCount();
+            const DeviceRecord* deviceRecords = file.devices();
+            const LinkRecord* linkRecords = file.links();
+
+            devices.resize(deviceCount);
+            parallelFor(deviceCount, threads, 1024, [&](size_t i) {
+                const DeviceRecord& r = deviceRecords[i];
+                devices[i] = makeDevice(r, string(file.name(r)), string(file.attribute(r)));
+                devices[i]->reserveConnections(degree[i]);
+            });
+
+            bool describe = TraceLog::active();
+            registry.devices.reserve(deviceCount);
+            deviceIndex.reserve(deviceCount);
+            for (size_t i = 0; i < deviceCount; ++i) {
+                if (!deviceIndex.emplace(devices[i]->getId(), i).second) {
+                    throw runtime_error("Файл топологии повреждён: повторяется ID устройства " +
+                                        to_string(devices[i]->getId()));
+                }
+                devices[i]->attachSimulator(&simulator);
+                devices[i]->setHandle(registry.devices.insert(devices[i]));
+                if (describe) TraceLog::instance().describeDevice(devices[i]->getId(), devices[i]->getName());
+            }
+
+            unsigned linkSeed = static_cast<unsigned>(rng());
+            connections.resize(linkCount);
+            parallelFor(linkCount, threads, 4096, [&](size_t e) {
+                const LinkRecord& r = linkRecords[e];
+                connections[e] = make_shared<NetworkConnection>(
+                    static_cast<int>(e), r.from != LinkRecord::noDevice ? devices[r.from] : nullptr,
+                    r.to != LinkRecord::noDevice ? devices[r.to] : nullptr, r.bandwidth, r.latency, r.queueCapacity,
+                    static_cast<DropPolicy>(r.policy), static_cast<unsigned>(TopologyGenerator::mixSeed(linkSeed, e)));
+            });
+
+            // portLinks[offsets[i] + порт] - соединение на этом порту устройства i. Соединение
+            // с удалённым концом занимает порт уцелевшего соседа, но в реестр и индекс не
+            // попадает - так же, как после removeDevice
+            vector<size_t> offsets(deviceCount + 1, 0);
+            for (size_t i = 0; i < deviceCount; ++i) {
+                offsets[i + 1] = offsets[i] + degree[i];
+            }
+            vector<uint32_t> portLinks(offsets[deviceCount]);
+            for (size_t e = 0; e < linkCount; ++e) {
+                const LinkRecord& r = linkRecords[e];
+                if (r.from != LinkRecord::noDevice) portLinks[offsets[r.from] + r.portFrom] = static_cast<uint32_t>(e);
+                if (r.to != LinkRecord::noDevice) portLinks[offsets[r.to] + r.portTo] = static_cast<uint32_t>(e);
+            }
+            parallelFor(deviceCount, threads, 1024, [&](size_t i) {
+                for (size_t k = offsets[i]; k < offsets[i + 1]; ++k) {
+                    devices[i]->addConnection(connections[portLinks[k]]);
+                }
+            });
+            parallelFor(linkCount, threads, 4096, [&](size_t e) {
+                connections[e]->setPorts(linkRecords[e].portFrom, linkRecords[e].portTo);
+                connections[e]->setUp(linkRecords[e].up != 0);
+            });
+
+            registry.links.reserve(linkCount);
+            linkIndex.reserve(linkCount);
+            for (size_t e = 0; e < linkCount; ++e) {
+                const LinkRecord& r = linkRecords[e];
+                if (r.from == LinkRecord::noDevice || r.to == LinkRecord::noDevice) continue;
+                uint64_t key = linkKey(devices[r.from]->getId(), devices[r.to]->getId());
+                if (!linkIndex.emplace(key, e).second) {
+                    throw runtime_error("Файл топологии повреждён: повторяется соединение " + to_string(e));
+                }
+                connections[e]->setHandle(registry.links.insert(connections[e]));
+            }
+
+            // Маршруты записаны по роутерам подряд и вставляются в FIB пачками
+            const RouteRecord* routeRecords = file.routes();
+            size_t routeCount = file.routeCount();
+            for (size_t first = 0; first < routeCount;) {
+                uint32_t owner = routeRecords[first].device;
+                auto router = owner < deviceCount ? deviceCast<Router>(devices[owner]) : nullptr;
+                if (!router) {
+                    throw runtime_error("Файл топологии повреждён: маршрут принадлежит не роутеру");
+                }
+                vector<tuple<uint32_t, int, uint32_t>> batch;
+                size_t last = first;
+                for (; last < routeCount && routeRecords[last].device == owner; ++last) {
+                    batch.emplace_back(routeRecords[last].prefix, routeRecords[last].length, routeRecords[last].port);
+                }
+                router->addRoutes(move(batch));
+                first = last;
+            }
+
+            cout << "Сеть загружена из " << origin << ": устройств: " << deviceCount << ", соединений: " << linkCount
+                 << ", маршрутов FIB: " << routeCount << ", за "
+                 << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " мс" << endl;
+        } catch (...) {
+            clearNetwork();
+            throw;
+        }
+    }
+
+    // Статический маршрут без вывода в консоль; возвращает следующий узел
+    shared_ptr<NetworkDevice> installRoute(int routerId, const string& cidr, int nextHopId) {
+        int routerIdx = findDeviceById(routerId);
+        int hopIdx = findDeviceById(nextHopId);
+        if (routerIdx == -1 || hopIdx == -1) {
+            throw runtime_error("Роутер или следующий узел не найдены");
+        }
+        auto router = deviceCast<Router>(devices[routerIdx]);
+        if (!router) {
+            throw runtime_error("Устройство " + devices[routerIdx]->getName() + " не является роутером");
+        }
+
+        auto routerConnections = router->getConnections();
+        for (size_t port = 0; port < routerConnections.size(); ++port) {
+            if (routerConnections[port]->getOtherDevice(router) == devices[hopIdx]) {
+                router->addRoute(cidr, static_cast<int>(port));
+                topologyChanged();
+                return devices[hopIdx];
+            }
+        }
+        throw runtime_error("Роутер не соединён с устройством " + devices[hopIdx]->getName());
+    }
+
+    // Что пишет writeModelState: всё без снятия отметок изменений (сверка состояний),
+    // всё со снятием (полная контрольная точка) или только изменившееся (сегмент изменений)
+    enum class StateScope { Everything, Checkpoint, Changes };
+
+    // Изменяемое состояние модели: генератор менеджера, симулятор, устройства, соединения
+    // и запланированные события. В сегмент изменений попадают только события, связанные
+    // с изменившимися объектами (см. Simulator::saveEvents)
+    void writeModelState(CheckpointWriter& out, StateScope scope) {
+        bool changes = scope == StateScope::Changes;
+        bool writeRng = !changes || !checkpoints || checkpoints->rngChanged(rng);
+        out.put<uint8_t>(writeRng);
+        if (writeRng) out.putEngine(rng);
+        simulator.saveState(out);
+        unordered_set<uint64_t> changedSources;
+        for (const auto& device : devices) {
+            bool changed = scope == StateScope::Everything || device->takeChanged();
+            if (changes && !changed) continue;
+            if (changes) changedSources.insert(device->getEventSource().uid);
+            out.put<uint8_t>(1);
+            out.put<int32_t>(device->getId());
+            out.put(static_cast<uint8_t>(device->getKind()));
+            device->saveState(out);
+        }
+        out.put<uint8_t>(0);
+        for (const auto& conn : connections) {
+            bool changed = scope == StateScope::Everything || conn->takeChanged();
+            if (changes && !changed) continue;
+            if (changes) {
+                changedSources.insert(conn->getEventSource(0).uid);
+                changedSources.insert(conn->getEventSource(1).uid);
+            }
+            out.put<uint8_t>(1);
+            out.put<int32_t>(conn->getId());
+            conn->saveState(out);
+        }
+        out.put<uint8_t>(0);
+        bool wholeQueue = true;
+        bool externalChanged = true;
+        if (scope != StateScope::Everything) {
+            wholeQueue = simulator.takePendingCleared() || !changes;
+            externalChanged = simulator.takeExternalChanged();
+        }
+        out.put<uint8_t>(wholeQueue);
+        if (!wholeQueue) {
+            out.put<uint8_t>(externalChanged);
+            if (externalChanged) changedSources.insert(simulator.getExternalSourceUid());
+        }
+        simulator.saveEvents(out, wholeQueue ? nullptr : &changedSources);
+    }
+
+    void readModelState(CheckpointReader& in) {
+        if (in.get<uint8_t>()) in.getEngine(rng);
+        simulator.loadState(in);
+        unordered_set<uint64_t> changedSources;
+        while (in.get<uint8_t>()) {
+            int32_t id = in.get<int32_t>();
+            uint8_t kind = in.get<uint8_t>();
+            int idx = findDeviceById(id);
+            if (idx == -1 || static_cast<uint8_t>(devices[idx]->getKind()) != kind) {
+                CheckpointReader::corrupted("устройство " + to_string(id) + " не совпадает с сетью");
+            }
+            devices[idx]->loadState(in);
+            changedSources.insert(devices[idx]->getEventSource().uid);
+        }
+        while (in.get<uint8_t>()) {
+            int32_t id = in.get<int32_t>();
+            if (id < 0 || static_cast<size_t>(id) >= connections.size()) {
+                CheckpointReader::corrupted("соединение " + to_string(id) + " не совпадает с сетью");
+            }
+            connections[id]->loadState(in);
+            changedSources.insert(connections[id]->getEventSource(0).uid);
+            changedSources.insert(connections[id]->getEventSource(1).uid);
+        }
+        bool wholeQueue = in.get<uint8_t>() != 0;
+        if (!wholeQueue && in.get<uint8_t>()) changedSources.insert(simulator.getExternalSourceUid());
+        simulator.loadEvents(in, wholeQueue ? nullptr : &changedSources);
+    }
+
+    void writeRouting(CheckpointWriter& out) const {
+        out.put<uint8_t>(routesStale);
+        routing.saveState(out);
+    }
+
+    void readRouting(CheckpointReader& in) {
+        bool stale = in.get<uint8_t>() != 0;
+        routing.loadState(in, devices, *getTopologySnapshot());
+        routesStale = stale;
+    }
+
+    // Пишет контрольную точку: полную, если журнал не начат, сменилась топология или
+    // изменений накопилось слишком много, иначе - только изменения
+    void saveCheckpoint() {
+        CheckpointWriter out;
+        bool full = checkpoints->needsFull(topologyVersion);
+        if (full) {
+            out.putString(topologyImage());
+            writeRouting(out);
+        }
+        writeModelState(out, full ? StateScope::Checkpoint : StateScope::Changes);
+        if (full) {
+            checkpoints->writeFull(out.data(), simulator.now(), topologyVersion, rng);
+        } else {
+            checkpoints->append(out.data(), simulator.now(), rng);
+        }
+    }
+
+    uint64_t countReceivedPackets() const {
+        uint64_t total = 0;
+        for (const auto& device : devices) {
+            if (auto computer = deviceCast<Computer>(device)) total += computer->getReceivedPackets();
+        }
+        return total;
+    }
+
+    // Случайный локально администрируемый unicast-адрес
+    MacAddress generateRandomMac() {
+        uint64_t raw = uniform_int_distribution<uint64_t>(0, MacAddress::mask)(rng);
+        raw &= ~(0x01ULL << 40); // сбрасываем бит групповой рассылки
+        raw |= 0x02ULL << 40;    // и ставим бит локального администрирования
+        return MacAddress(raw);
+    }
+
+    string generateRandomIP() {
+        uniform_int_distribution<int> dist(1, 254);
+        return "192.168.1." + to_string(dist(rng));
+    }
+
+public:
+    NetworkManager()
+        : simulator(packetPool, registry), routesStale(true), topologyVersion(0),
+          rng(chrono::steady_clock::now().time_since_epoch().count()), simulationThreads(1) {}
+
+    // Фиксированное зерно: одинаковые действия дают одинаковую сеть и одинаковый результат
+    // моделирования, в том числе при любом числе потоков
+    explicit NetworkManager(unsigned seed)
+        : simulator(packetPool, registry), routesStale(true), topologyVersion(0), rng(seed), simulationThreads(1) {}
+
+    // Число потоков моделирования; больше 1 - параллельный режим с разбиением сети
+    void setSimulationThreads(int threads) {
+        if (threads < 1) {
+            throw runtime_error("Число потоков должно быть не меньше 1");
+        }
+        simulationThreads = threads;
+    }
+
+    int getSimulationThreads() const { return simulationThreads; }
+
+    // Пишет журнал трассировки в двоичный файл (разбирается через --decode) вместо консоли
+    void startTrace(const string& path) {
+        TraceLog& trace = TraceLog::instance();
+        trace.openFile(path);
+        for (const auto& device : devices) {
+            trace.describeDevice(device->getId(), device->getName());
+        }
+    }
 
-public:
-    Switch(int id, const string& name, const string& mac, int ports)
-        : NetworkDevice(id, name, mac), portCount(ports) {}
+    void stopTrace() { TraceLog::instance().closeFile(); }
 
-    void processPacket(shared_ptr<DataPacket> packet) override {
-        macTable[packet->getSourceMac()] = connections[0];
-        
-        auto it = macTable.find(packet->getDestinationMac());
-        if (it != macTable.end()) {
-            cout << name << " пересылает пакет на известный MAC: " << packet->getDestinationMac() << endl;
-            it->second->transferPacket(packet, shared_from_this());
-        } else {
-            cout << name << " выполняет flooding (MAC " << packet->getDestinationMac() << " неизвестен)" << endl;
-            for (auto& conn : connections) {
-                auto otherDev = conn->getOtherDevice(shared_from_this());
-                if (otherDev && otherDev->getMac() != packet->getSourceMac()) {
-                    conn->transferPacket(packet, shared_from_this());
-                }
+    // Вывод журнала на консоль; при выключенном и без файла журнал не пишется вовсе
+    void setTraceConsole(bool enabled) {
+        TraceLog& trace = TraceLog::instance();
+        trace.setConsole(enabled);
+        if (enabled) {
+            for (const auto& device : devices) {
+                trace.describeDevice(device->getId(), device->getName());
             }
         }
     }
 
-    void displayInfo() const override {
-        NetworkDevice::displayInfo();
-        std::cout << "Портов: " << portCount 
-             << "\nИзучено MAC-адресов: " << macTable.size() << std::endl;
+    // Пакетная обработка доставок по типам устройств (см. Simulator::setBatchDispatch)
+    void setBatchDispatch(bool enabled) { simulator.setBatchDispatch(enabled); }
+    bool isBatchDispatch() const { return simulator.isBatchDispatch(); }
+
+    // Открывает файл захвата. Какие кадры в него попадут, задают setLinkCapture,
+    // setAllLinksCapture и setIngressCapture; прежний захват при этом закрывается
+    void startCapture(const string& path, uint32_t snapLength = 256) {
+        stopCapture();
+        capture = make_unique<PcapWriter>(path, snapLength);
+        cout << "Захват трафика в файл " << path << " начат" << endl;
     }
-};
 
-class Phone : public NetworkDevice {
-private:
-    string phoneNumber;
-    bool isConnected;
-    vector<shared_ptr<DataPacket>> receivedPackets;
+    // Снимает все точки захвата и дописывает файл
+    void stopCapture() {
+        if (!capture) return;
+        for (auto& conn : connections) conn->setCapture(nullptr);
+        for (auto& device : devices) device->setIngressCapture(nullptr);
+        capture->close();
+        cout << "Захват трафика остановлен, записано кадров: " << capture->getFrames() << endl;
+        capture.reset();
+    }
 
-public:
-    Phone(int id, const string& name, const string& mac, const string& number)
-        : NetworkDevice(id, name, mac), phoneNumber(number), isConnected(true) {}
+    bool isCapturing() const { return capture != nullptr; }
 
-    void sendPacket(const string& content, shared_ptr<NetworkDevice> target) {
-        if (!target) {
-            cout << "Ошибка: Неверное целевое устройство" << endl;
-            return;
-        }
+    // Начинает выгрузку метрик в path: снимок пишется в конце каждого прогона, а при
+    // intervalMs > 0 - ещё и на каждой границе интервала модельного времени
+    void startMetrics(const string& path, MetricsFormat format, double intervalMs = 0) {
+        stopMetrics();
+        metrics = make_unique<MetricsExporter>(path, format, fromMilliseconds(intervalMs), simulator.now());
+        cout << "Метрики выгружаются в файл " << path << endl;
+    }
 
-        auto packet = make_shared<DataPacket>(content, content.size(), macAddress, target->getMac());
-        
-        for (auto& conn : connections) {
-            if (conn->connects(target)) {
-                cout << name << " отправляет сообщение на " << target->getName() << endl;
-                conn->transferPacket(packet, shared_from_this());
-                return;
-            }
+    // Снимок метрик на текущий момент модельного времени
+    void writeMetrics() {
+        if (!metrics) {
+            throw runtime_error("Выгрузка метрик не начата");
         }
-        cout << "Нет связи с " << target->getName() << endl;
+        metrics->write(simulator.now(), devices, connections, simulator.getLatency());
     }
 
-    void processPacket(shared_ptr<DataPacket> packet) override {
-        cout << name << " получил сообщение: " << packet->getContent() << endl;
-        receivedPackets.push_back(packet);
+    void stopMetrics() {
+        if (!metrics) return;
+        cout << "Выгрузка метрик завершена, снимков: " << metrics->getSnapshots() << endl;
+        metrics.reset();
     }
 
-    void displayInfo() const override {
-        NetworkDevice::displayInfo();
-        cout << "Номер: " << phoneNumber 
-             << "\nСтатус: " << (isConnected ? "Подключен" : "Отключен")
-             << "\nПолучено сообщений: " << receivedPackets.size() << endl;
+    // Начинает периодические контрольные точки в журнал path: сразу пишется полная точка,
+    // дальше при intervalMs > 0 - на каждой границе интервала модельного времени и в конце
+    // каждого прогона. После первой точки пишутся только изменившиеся устройства и соединения
+    void startCheckpoints(const string& path, double intervalMs = 0) {
+        stopCheckpoints();
+        checkpoints = make_unique<CheckpointStore>(path, fromMilliseconds(intervalMs), simulator.now());
+        try {
+            ensureRoutes();
+            saveCheckpoint();
+        } catch (...) {
+            checkpoints.reset();
+            throw;
+        }
+        cout << "Контрольные точки пишутся в файл " << path << ", полная точка: "
+             << checkpoints->getLastBytes() << " байт" << endl;
     }
 
-    string getPhoneNumber() const { return phoneNumber; }
-};
+    // Внеочередная контрольная точка на текущий момент модельного времени
+    void writeCheckpoint() {
+        if (!checkpoints) {
+            throw runtime_error("Контрольные точки не включены");
+        }
+        auto start = chrono::steady_clock::now();
+        saveCheckpoint();
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << "Контрольная точка записана (" << (checkpoints->isLastFull() ? "полная" : "изменения")
+             << "): " << checkpoints->getLastBytes() << " байт, за " << ms << " мс" << endl;
+    }
 
-class Router : public NetworkDevice {
-private:
-    string ipRange;
-    map<string, shared_ptr<NetworkConnection>> routingTable;
-    int maxConnections;
+    void stopCheckpoints() {
+        if (!checkpoints) return;
+        cout << "Контрольные точки остановлены, записано: " << checkpoints->getWritten() << endl;
+        checkpoints.reset();
+    }
 
-public:
-    Router(int id, const string& name, const string& mac, const string& range, int maxConn)
-        : NetworkDevice(id, name, mac), ipRange(range), maxConnections(maxConn) {}
+    bool isCheckpointing() const { return checkpoints != nullptr; }
+    const CheckpointStore* getCheckpointStore() const { return checkpoints.get(); }
 
-    void processPacket(shared_ptr<DataPacket> packet) override {
-        routingTable[packet->getSourceMac()] = connections[0];
-        
-        cout << name << " маршрутизирует пакет от " << packet->getSourceMac() 
-             << " к " << packet->getDestinationMac() << endl;
-             
-        auto it = routingTable.find(packet->getDestinationMac());
-        if (it != routingTable.end()) {
-            it->second->transferPacket(packet, shared_from_this());
-        } else {
-            // Пересылаем на все порты кроме источника
-            for (auto& conn : connections) {
-                auto otherDev = conn->getOtherDevice(shared_from_this());
-                if (otherDev && otherDev->getMac() != packet->getSourceMac()) {
-                    conn->transferPacket(packet, shared_from_this());
+    // Восстанавливает сеть и состояние модели из журнала контрольных точек: полная точка,
+    // затем по порядку все целые сегменты изменений. Текущая сеть заменяется; после
+    // восстановления моделирование продолжается runSimulation с того же места
+    void restoreCheckpoint(const string& path) {
+        MappedFile file(path);
+        size_t discarded = 0;
+        vector<CheckpointStore::Segment> segments = CheckpointStore::readJournal(file, path, discarded);
+        stopCheckpoints();
+        try {
+            for (size_t i = 0; i < segments.size(); ++i) {
+                CheckpointReader in(segments[i].body, packetPool);
+                in.device = [this](int32_t id) {
+                    int idx = findDeviceById(id);
+                    return idx == -1 ? DeviceHandle() : devices[idx]->getHandle();
+                };
+                in.link = [this](int32_t id) {
+                    return id >= 0 && static_cast<size_t>(id) < connections.size() ? connections[id]->getHandle()
+                                                                                     : LinkHandle();
+                };
+                if (i == 0) {
+                    string_view image = in.getBytes();
+                    loadBinary(TopologyFile(image, path), path);
+                    readRouting(in);
+                }
+                readModelState(in);
+                if (!in.done()) {
+                    CheckpointReader::corrupted("лишние данные в сегменте " + to_string(i));
                 }
             }
+        } catch (...) {
+            clearNetwork();
+            throw;
+        }
+        if (metrics) metrics->skipTo(simulator.now() + 1);
+        cout << "Восстановлено из " << path << ": сегментов " << segments.size() << ", модельное время "
+             << toMilliseconds(simulator.now()) << " мс, ожидающих событий " << simulator.pendingEvents() << endl;
+        if (discarded > 0) {
+            cout << "Отброшен повреждённый или недописанный хвост журнала: " << discarded << " байт" << endl;
         }
     }
 
-    void displayInfo() const override {
-        NetworkDevice::displayInfo();
-        cout << "IP-диапазон: " << ipRange 
-             << "\nМакс. подключений: " << maxConnections
-             << "\nЗаписей в таблице маршрутизации: " << routingTable.size() << endl;
+    // Контрольная сумма всего состояния сети и модели; у продолжения восстановленного
+    // прогона и у непрерывного прогона она совпадает в одни и те же моменты времени
+    uint64_t stateChecksum() {
+        CheckpointWriter out(false);
+        out.putString(topologyImage());
+        writeRouting(out);
+        writeModelState(out, StateScope::Everything);
+        return CheckpointStore::checksum(out.data());
     }
-};
 
-class Printer : public NetworkDevice {
-private:
-    string printerModel;
-    vector<string> printQueue;
-    bool isOnline;
-
-public:
-    Printer(int id, const string& name, const string& mac, const string& model)
-        : NetworkDevice(id, name, mac), printerModel(model), isOnline(true) {}
+    const LatencyHistogram& getLatencyHistogram() const { return simulator.getLatency(); }
 
-    void processPacket(shared_ptr<DataPacket> packet) override {
-        if (isOnline) {
-            cout << name << " получил задание на печать: " << packet->getContent() << endl;
-            printQueue.push_back(packet->getContent());
-            cout << name << " печатает документ..." << endl;
-        } else {
-            cout << name << " недоступен для печати" << endl;
+    // Сводка: задержки доставки, загрузка и потери соединений
+    void displayMetrics() const {
+        const LatencyHistogram& latency = simulator.getLatency();
+        cout << "\n=== Метрики ===" << endl;
+        cout << "Доставлено пакетов с известным временем отправки: " << latency.getCount() << endl;
+        if (latency.getCount()) {
+            cout << "Задержка, мс: мин. " << toMilliseconds(latency.getMin())
+                 << ", среднее " << latency.getMean() / 1e6
+                 << ", p50 " << toMilliseconds(latency.percentile(50))
+                 << ", p99 " << toMilliseconds(latency.percentile(99))
+                 << ", макс. " << toMilliseconds(latency.getMax()) << endl;
+        }
+        uint64_t transmitted = 0, dropped = 0;
+        double busiest = 0.0;
+        int busiestLink = -1;
+        SimTime now = simulator.now();
+        for (const auto& conn : connections) {
+            for (int dir = 0; dir < 2; ++dir) {
+                const LinkStats& st = conn->getStats(dir);
+                transmitted += st.transmittedPackets;
+                dropped += st.dropped();
+                double utilization = now > 0 ? static_cast<double>(st.busyTime) / now : 0.0;
+                if (utilization > busiest) {
+                    busiest = utilization;
+                    busiestLink = conn->getId();
+                }
+            }
+        }
+        cout << "Передано по соединениям: " << transmitted << ", отброшено: " << dropped << endl;
+        if (busiestLink != -1) {
+            cout << "Самое загруженное соединение: " << busiestLink << " (" << busiest * 100.0 << "%)" << endl;
         }
     }
 
-    void displayInfo() const override {
-        NetworkDevice::displayInfo();
-        cout << "Модель: " << printerModel 
-             << "\nСтатус: " << (isOnline ? "Онлайн" : "Офлайн")
-             << "\nВ очереди печати: " << printQueue.size() << " документов" << endl;
+    // Кадры, выданные на соединение в обоих направлениях
+    void setLinkCapture(int id1, int id2, bool enabled) {
+        PcapWriter& writer = requireCapture();
+        auto conn = findConnection(id1, id2);
+        if (!conn) {
+            throw runtime_error("Соединение между " + to_string(id1) + " и " + to_string(id2) + " не найдено");
+        }
+        conn->setCapture(enabled ? &writer : nullptr);
     }
 
-    void setOnline(bool status) { isOnline = status; }
-};
+    void setAllLinksCapture(bool enabled) {
+        PcapWriter* writer = enabled ? &requireCapture() : nullptr;
+        for (auto& conn : connections) conn->setCapture(writer);
+    }
 
-class Server : public NetworkDevice {
-private:
-    string serverType;
-    vector<string> services;
-    int cpuLoad;
+    // Кадры, принятые устройством на любом порту
+    void setIngressCapture(int deviceId, bool enabled) {
+        PcapWriter& writer = requireCapture();
+        int idx = findDeviceById(deviceId);
+        if (idx == -1) {
+            throw runtime_error("Устройство с ID " + to_string(deviceId) + " не найдено");
+        }
+        devices[idx]->setIngressCapture(enabled ? &writer : nullptr);
+    }
 
-public:
-    Server(int id, const string& name, const string& mac, const string& type)
-        : NetworkDevice(id, name, mac), serverType(type), cpuLoad(0) {
-        // Добавляем базовые сервисы
-        services.push_back("HTTP");
-        services.push_back("FTP");
-        if (type == "Database") {
-            services.push_back("MySQL");
-        } else if (type == "Web") {
-            services.push_back("Apache");
+    // Снимок графа для обходов и аналитики; строится заново только после изменения
+    // топологии, а уже выданные снимки остаются неизменными
+    shared_ptr<const TopologySnapshot> getTopologySnapshot() {
+        if (!topologySnapshot) {
+            topologySnapshot = make_shared<const TopologySnapshot>(TopologySnapshot::build(devices, connections));
         }
+        return topologySnapshot;
     }
 
-    void processPacket(shared_ptr<DataPacket> packet) override {
-        cpuLoad = min(100, cpuLoad + 5);
-        cout << name << " обрабатывает запрос: " << packet->getContent() 
-             << " (Загрузка CPU: " << cpuLoad << "%)" << endl;
-        
-        // Имитируем ответ
-        this_thread::sleep_for(chrono::milliseconds(50));
-        cpuLoad = max(0, cpuLoad - 3);
+    void setRouteMetric(RouteMetric metric) {
+        routing.setMetric(metric);
+        routesStale = true;
+        topologyChanged();
     }
 
-    void displayInfo() const override {
-        NetworkDevice::displayInfo();
-        cout << "Тип сервера: " << serverType 
-             << "\nЗагрузка CPU: " << cpuLoad << "%"
-             << "\nСервисы: ";
-        for (size_t i = 0; i < services.size(); ++i) {
-            cout << services[i];
-            if (i < services.size() - 1) cout << ", ";
+    // Полный пересчёт таблиц следующих переходов всех устройств на всех ядрах.
+    // После него добавление устройств и соединений обновляет таблицы инкрементально
+    void computeRoutes() {
+        if (devices.size() > maxRoutedDevices) {
+            invalidateRoutes();
+            cout << "Таблицы маршрутов не строятся: устройств " << devices.size()
+                 << " больше предела " << maxRoutedDevices << endl;
+            return;
         }
-        cout << endl;
+        auto start = chrono::steady_clock::now();
+        routing.rebuild(devices, *getTopologySnapshot());
+        routesStale = false;
+        topologyVersion++;
+        cout << "Маршруты рассчитаны: устройств: " << routing.nodeCount()
+             << ", за " << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count()
+             << " мс" << endl;
     }
-};
 
-class NetworkManager {
-private:
-    vector<shared_ptr<NetworkDevice>> devices;
-    vector<shared_ptr<NetworkConnection>> connections;
-    mt19937 rng;
+    // Маршруты считаются лениво: перед отправкой пакета и перед прогоном модели
+    void ensureRoutes() {
+        if (routesStale && devices.size() <= maxRoutedDevices) computeRoutes();
+    }
 
-    int findDeviceById(int id) const {
-        auto it = find_if(devices.begin(), devices.end(), 
-            [id](const shared_ptr<NetworkDevice>& dev) { return dev->getId() == id; });
-        return it != devices.end() ? distance(devices.begin(), it) : -1;
+    // Включает или отключает соединение; таблицы маршрутов обновляются только там, где
+    // кратчайший путь изменился. Возвращает число изменённых записей таблиц
+    uint64_t setLinkState(int id1, int id2, bool up) {
+        auto conn = findConnection(id1, id2);
+        if (!conn) {
+            throw runtime_error("Соединение между устройствами " + to_string(id1) + " и " + to_string(id2) + " не найдено");
+        }
+        conn->setUp(up);
+        topologyChanged();
+        uint64_t touched = routesStale ? 0 : routing.setLinkUp(*conn, up);
+        cout << "Соединение " << id1 << " - " << id2 << (up ? " включено" : " отключено")
+             << ", обновлено записей маршрутов: " << touched << endl;
+        return touched;
     }
 
-    bool connectionExists(int id1, int id2) const {
-        for (const auto& conn : connections) {
-            // Получаем устройства из соединения более безопасным способом
-            auto dev1_ptr = conn->getOtherDevice(nullptr);
-            if (!dev1_ptr) continue;
-            
-            auto dev2_ptr = conn->getOtherDevice(dev1_ptr);
-            if (!dev2_ptr) continue;
-            
-            int dev1_id = dev1_ptr->getId();
-            int dev2_id = dev2_ptr->getId();
-            
-            if ((dev1_id == id1 && dev2_id == id2) || (dev1_id == id2 && dev2_id == id1)) {
-                return true;
+    // Отказ или восстановление устройства - это смена состояния всех его соединений
+    uint64_t setDeviceState(int id, bool up) {
+        int idx = findDeviceById(id);
+        if (idx == -1) {
+            throw runtime_error("Устройство с ID " + to_string(id) + " не найдено");
+        }
+        uint64_t touched = 0;
+        for (const auto& conn : devices[idx]->getConnections()) {
+            if (NetworkDevice* other = conn->otherEnd(devices[idx].get())) {
+                touched += setLinkState(id, other->getId(), up);
             }
         }
-        return false;
+        return touched;
     }
 
-    string generateRandomMac() {
-        uniform_int_distribution<int> dist(0, 255);
-        stringstream ss;
-        ss << hex << uppercase;
-        for (int i = 0; i < 6; ++i) {
-            if (i > 0) ss << ":";
-            ss << setfill('0') << setw(2) << dist(rng);
+    // Удаляет устройство. Его соединения отключаются и выходят из реестра, поэтому
+    // запланированные для них и для устройства события отбрасываются при извлечении.
+    // Порты соседей остаются заняты отключёнными соединениями (номера портов не сдвигаются)
+    void removeDevice(int id) {
+        int idx = findDeviceById(id);
+        if (idx == -1) {
+            throw runtime_error("Устройство с ID " + to_string(id) + " не найдено");
         }
-        return ss.str();
-    }
+        shared_ptr<NetworkDevice> device = devices[idx];
+        for (const auto& conn : device->getConnections()) {
+            if (NetworkDevice* other = conn->otherEnd(device.get())) {
+                linkIndex.erase(linkKey(id, other->getId()));
+            }
+            conn->detach(device.get());
+            registry.links.erase(conn->getHandle());
+        }
+        registry.devices.erase(device->getHandle());
 
-    string generateRandomIP() {
-        uniform_int_distribution<int> dist(1, 254);
-        return "192.168.1." + to_string(dist(rng));
+        devices.erase(devices.begin() + idx);
+        deviceIndex.erase(id);
+        for (size_t i = idx; i < devices.size(); ++i) {
+            deviceIndex[devices[i]->getId()] = i;
+        }
+        invalidateRoutes();
+        cout << "Устройство " << device->getName() << " удалено" << endl;
     }
 
-public:
-    NetworkManager() : rng(chrono::steady_clock::now().time_since_epoch().count()) {}
+    // Число записей таблиц маршрутов, изменённых последним изменением топологии и за всё время
+    uint64_t getLastRouteUpdateSize() const { return routing.getLastTouched(); }
+    uint64_t getTotalRouteUpdates() const { return routing.getTotalTouched(); }
 
-    shared_ptr<NetworkDevice> addDevice(const string& type, int id, const string& name, 
-                                      const string& mac, const string& ip = "", int ports = 0) {
-        cout << "Добавление устройства: " << name << " (ID: " << id << ")" << endl;
-        
-        if (findDeviceById(id) != -1) {
-            throw runtime_error("Устройство с таким ID уже существует");
+    // Обрабатывает запланированные события модели до момента pauseAt включительно, но не
+    // больше maxEvents. События позже pauseAt остаются в очереди - следующий вызов продолжит
+    // с того же места. Возвращает число обработанных событий
+    uint64_t runSimulation(uint64_t maxEvents = maxEventsPerRun, SimTime pauseAt = SIM_TIME_INFINITY) {
+        ensureRoutes();
+        SimTime startTime = simulator.now();
+        uint64_t handled = 0;
+        TraceLog& trace = TraceLog::instance();
+        bool console = trace.isConsole();
+        ParallelSimulator* lps = nullptr;
+        if (simulationThreads > 1 && devices.size() > 1) {
+            // Сообщения потоков перемешались бы на консоли, поэтому параллельный
+            // прогон пишет журнал только в файл
+            trace.setConsole(false);
+            shared_ptr<const TopologySnapshot> snapshot = getTopologySnapshot();
+            if (!parallel || parallelTopology != snapshot || parallel->getThreads() != simulationThreads) {
+                parallel.reset();
+                parallel = make_unique<ParallelSimulator>(devices, connections, *snapshot, registry,
+                                                          simulationThreads, partitionPools);
+                parallelTopology = snapshot;
+            }
+            lps = parallel.get();
         }
-
-        shared_ptr<NetworkDevice> newDevice;
-        if (type == "Computer") {
-            newDevice = make_shared<Computer>(id, name, mac, ip);
-        } else if (type == "Switch") {
-            newDevice = make_shared<Switch>(id, name, mac, ports);
-        } else if (type == "Phone") {
-            string phoneNumber = "+7-" + to_string(uniform_int_distribution<int>(1000000, 9999999)(rng));
-            newDevice = make_shared<Phone>(id, name, mac, phoneNumber);
-        } else if (type == "Router") {
-            newDevice = make_shared<Router>(id, name, mac, "192.168.1.0/24", 24);
-        } else if (type == "Printer") {
-            vector<string> models = {"HP LaserJet", "Canon Pixma", "Epson WorkForce", "Brother HL"};
-            string model = models[uniform_int_distribution<int>(0, models.size()-1)(rng)];
-            newDevice = make_shared<Printer>(id, name, mac, model);
-        } else if (type == "Server") {
-            vector<string> serverTypes = {"Web", "Database", "File", "Mail"};
-            string serverType = serverTypes[uniform_int_distribution<int>(0, serverTypes.size()-1)(rng)];
-            newDevice = make_shared<Server>(id, name, mac, serverType);
-        } else {
-            throw runtime_error("Неизвестный тип устройства");
+        // С периодическими метриками и контрольными точками модель идёт отрезками до
+        // очередной границы интервала
+        auto pending = [&] { return !simulator.empty() && simulator.nextEventTime() <= pauseAt; };
+        while (handled < maxEvents && pending()) {
+            SimTime metricsAt = metrics ? metrics->nextSnapshotTime() : SIM_TIME_INFINITY;
+            SimTime checkpointAt = checkpoints ? checkpoints->nextCheckpointTime() : SIM_TIME_INFINITY;
+            SimTime until = min({pauseAt, metricsAt, checkpointAt});
+            handled += lps ? lps->run(simulator, maxEvents - handled, until)
+                                : simulator.run(until, maxEvents - handled);
+            bool passed = handled < maxEvents && (simulator.empty() || simulator.nextEventTime() > until);
+            if (!passed || simulator.empty()) continue;
+            if (until == metricsAt) {
+                metrics->write(until, devices, connections, simulator.getLatency());
+                metrics->skipTo(simulator.nextEventTime());
+            }
+            if (until == checkpointAt) {
+                saveCheckpoint();
+                checkpoints->skipTo(simulator.nextEventTime());
+            }
+        }
+        if (lps) {
+            trace.setConsole(console);
+            cout << "Параллельный прогон: логических процессов: " << lps->getPartitionCount()
+                 << ", разрезано соединений: " << lps->getCutLinks() << endl;
+        }
+        trace.flush();
+        if (capture) capture->flush();
+        if (pending()) {
+            cout << "Превышен лимит событий моделирования (" << maxEvents
+                 << "), возможна петля в топологии. Оставшиеся события отброшены" << endl;
+            simulator.clearPending();
+            for (auto& conn : connections) {
+                conn->resetQueues();
+            }
+            for (auto& device : devices) {
+                if (auto computer = deviceCast<Computer>(device)) computer->cancelFlows();
+            }
+        } else if (!simulator.empty()) {
+            cout << "Моделирование приостановлено на " << toMilliseconds(pauseAt)
+                 << " мс, ожидающих событий: " << simulator.pendingEvents() << endl;
+        }
+        if (metrics) {
+            metrics->write(simulator.now(), devices, connections, simulator.getLatency());
+            metrics->skipTo(simulator.now() + 1);
+        }
+        if (checkpoints) {
+            saveCheckpoint();
+            checkpoints->skipTo(simulator.now() + 1);
         }
+        cout << "Моделирование завершено: обработано событий: " << handled
+             << ", модельное время: " << toMilliseconds(simulator.now() - startTime) << " мс" << endl;
+        return handled;
+    }
 
-        devices.push_back(newDevice);
+    shared_ptr<NetworkDevice> addDevice(const string& type, int id, const string& name, 
+                                      MacAddress mac, const string& ip = "", int ports = 0) {
+        cout << "Добавление устройства: " << name << " (ID: " << id << ")" << endl;
+        auto newDevice = createDevice(type, id, name, mac, ip, ports);
         cout << "Устройство " << name << " успешно добавлено" << endl;
         return newDevice;
     }
 
-    shared_ptr<NetworkConnection> connectDevices(int id1, int id2, float bw, int lat) {
+    shared_ptr<NetworkConnection> connectDevices(int id1, int id2, float bw, int lat,
+                                                 size_t queueCapacity = 64,
+                                                 DropPolicy policy = DropPolicy::DropTail) {
         cout << "Создание соединения между устройствами " << id1 << " и " << id2 << endl;
-        
-        int idx1 = findDeviceById(id1);
-        int idx2 = findDeviceById(id2);
-        
-        if (idx1 == -1 || idx2 == -1) {
-            throw runtime_error("Одно или оба устройства не найдены");
+        auto conn = createConnection(id1, id2, bw, lat, queueCapacity, policy);
+        cout << "Соединение между " << conn->getFirstDevice()->getName() 
+             << " и " << conn->getSecondDevice()->getName() << " создано" << endl;
+        return conn;
+    }
+
+    // Массовое добавление устройств: без вывода по каждому устройству и с заранее
+    // выделенной памятью. Маршруты после этого пересчитываются целиком
+    void addDevices(const vector<DeviceSpec>& specs) {
+        invalidateRoutes();
+        devices.reserve(devices.size() + specs.size());
+        deviceIndex.reserve(devices.size() + specs.size());
+        for (const auto& spec : specs) {
+            createDevice(spec.type, spec.id, spec.name, spec.mac, spec.ip, spec.ports);
         }
+        cout << "Добавлено устройств: " << specs.size() << endl;
+    }
 
-        if (connectionExists(id1, id2)) {
-            throw runtime_error("Соединение уже существует");
+    // Массовое создание соединений; при ошибке уже созданные соединения остаются
+    void connectMany(const vector<LinkSpec>& specs) {
+        invalidateRoutes();
+        connections.reserve(connections.size() + specs.size());
+        linkIndex.reserve(connections.size() + specs.size());
+        for (const auto& spec : specs) {
+            createConnection(spec.id1, spec.id2, spec.bandwidth, spec.latency, spec.queueCapacity, spec.policy);
         }
+        cout << "Создано соединений: " << specs.size() << endl;
+    }
 
-        auto conn = make_shared<NetworkConnection>(devices[idx1], devices[idx2], bw, lat);
-        connections.push_back(conn);
-        devices[idx1]->addConnection(conn);
-        devices[idx2]->addConnection(conn);
-        
-        cout << "Соединение между " << devices[idx1]->getName() 
-             << " и " << devices[idx2]->getName() << " создано" << endl;
-        return conn;
+    // Статический маршрут: пакеты для cidr роутер routerId отправляет соседу nextHopId
+    void addRoute(int routerId, const string& cidr, int nextHopId) {
+        auto hop = installRoute(routerId, cidr, nextHopId);
+        cout << "Маршрут " << cidr << " через " << hop->getName() << " добавлен" << endl;
     }
 
     void sendPacket(int sourceId, int destId, const string& content) {
+        injectPacket(sourceId, destId, content);
+        runSimulation();
+    }
+
+    // Ставит отправку пакета в модель без запуска моделирования (см. runSimulation)
+    void injectPacket(int sourceId, int destId, const string& content) {
         int srcIdx = findDeviceById(sourceId);
         int dstIdx = findDeviceById(destId);
         
@@ -474,7 +7095,8 @@ public:
             throw runtime_error("Устройство-источник или устройство-назначение не найдены");
         }
 
-        auto computer = dynamic_pointer_cast<Computer>(devices[srcIdx]);
+        ensureRoutes();
+        auto computer = deviceCast<Computer>(devices[srcIdx]);
         if (!computer) {
             throw runtime_error("Только компьютеры могут отправлять пакеты");
         }
@@ -486,8 +7108,7 @@ public:
         cout << "Генерация случайной сети..." << endl;
         
         // Очищаем существующую сеть
-        devices.clear();
-        connections.clear();
+        clearNetwork();
         
         vector<string> deviceTypes = {"Computer", "Phone", "Router", "Printer", "Server", "Switch"};
         vector<string> deviceNames = {
@@ -508,40 +7129,419 @@ public:
         for (int i = 1; i <= deviceCount; ++i) {
             string type = deviceTypes[typeDist(rng)];
             string name = deviceNames[nameDist(rng)] + " " + to_string(i);
-            string mac = generateRandomMac();
+            MacAddress mac = generateRandomMac();
             string ip = generateRandomIP();
             
             try {
                 if (type == "Switch" || type == "Router") {
                     addDevice(type, i, name, mac, "", uniform_int_distribution<int>(4, 24)(rng));
                 } else {
-                    addDevice(type, i, name, mac, ip);
+                    addDevice(type, i, name, mac, ip);
+                }
+            } catch (const exception& e) {
+                cout << "Ошибка создания устройства: " << e.what() << endl;
+            }
+        }
+        
+        // Создаем случайные соединения
+        uniform_int_distribution<int> connectionCountDist(deviceCount - 1, deviceCount + 2);
+        int connectionCount = connectionCountDist(rng);
+        
+        for (int i = 0; i < connectionCount; ++i) {
+            uniform_int_distribution<int> deviceDist(1, deviceCount);
+            int id1 = deviceDist(rng);
+            int id2 = deviceDist(rng);
+            
+            if (id1 != id2) {
+                try {
+                    connectDevices(id1, id2, bandwidthDist(rng), latencyDist(rng));
+                } catch (const exception& e) {
+                    // Игнорируем ошибки дублирования соединений
+                }
+            }
+        }
+        
+        cout << "Случайная сеть создана: " << devices.size() << " устройств, " 
+             << connections.size() << " соединений" << endl;
+    }
+
+    // Заменяет сеть сгенерированной по параметрической модели (см. TopologyGenerator).
+    // Объекты устройств и соединений создаются на всех ядрах, без вывода по каждому
+    // устройству; при одном и том же params.seed сеть одинакова при любом числе потоков.
+    // Коммутаторы получают ровно столько портов, сколько у них соединений, компьютеры -
+    // адреса 10.0.0.1 и далее; ID устройств идут с 1 в порядке графа
+    void generateTopology(const TopologyParams& params) {
+        auto start = chrono::steady_clock::now();
+        unsigned threads = max(1u, thread::hardware_concurrency());
+        GeneratedTopology graph = TopologyGenerator::generate(params, threads);
+        clearNetwork();
+
+        size_t deviceCount = graph.deviceCount();
+        vector<uint32_t> degree(deviceCount, 0);
+        for (const auto& edge : graph.edges) {
+            degree[edge.first]++;
+            degree[edge.second]++;
+        }
+
+        devices.resize(deviceCount);
+        parallelFor(deviceCount, threads, 1024, [&](size_t i) {
+            int id = static_cast<int>(i) + 1;
+            MacAddress mac((0x02ULL << 40) | static_cast<uint64_t>(id)); // локально администрируемый
+            if (i < graph.switchCount) {
+                devices[i] = make_shared<Switch>(id, "Коммутатор " + to_string(id), mac,
+                                                 max(1, static_cast<int>(degree[i])));
+            } else {
+                uint32_t ip = (10u << 24) + static_cast<uint32_t>(i - graph.switchCount) + 1;
+                devices[i] = make_shared<Computer>(id, "Компьютер " + to_string(id), mac, ip);
+            }
+            devices[i]->reserveConnections(degree[i]);
+        });
+
+        bool describe = TraceLog::active();
+        registry.devices.reserve(deviceCount);
+        deviceIndex.reserve(deviceCount);
+        for (size_t i = 0; i < deviceCount; ++i) {
+            devices[i]->attachSimulator(&simulator);
+            devices[i]->setHandle(registry.devices.insert(devices[i]));
+            deviceIndex[devices[i]->getId()] = i;
+            if (describe) TraceLog::instance().describeDevice(devices[i]->getId(), devices[i]->getName());
+        }
+
+        size_t linkCount = graph.edges.size();
+        connections.resize(linkCount);
+        parallelFor(linkCount, threads, 4096, [&](size_t e) {
+            const auto& edge = graph.edges[e];
+            connections[e] = make_shared<NetworkConnection>(static_cast<int>(e), devices[edge.first], devices[edge.second],
+                                                            params.bandwidth, params.latency, params.queueCapacity,
+                                                            DropPolicy::DropTail,
+                                                            static_cast<unsigned>(TopologyGenerator::mixSeed(params.seed, e)));
+        });
+
+        // Порты назначаются по порядку рёбер, поэтому этот проход последовательный
+        registry.links.reserve(linkCount);
+        linkIndex.reserve(linkCount);
+        for (size_t e = 0; e < linkCount; ++e) {
+            const auto& edge = graph.edges[e];
+            const auto& conn = connections[e];
+            conn->setHandle(registry.links.insert(conn));
+            linkIndex[linkKey(static_cast<int>(edge.first) + 1, static_cast<int>(edge.second) + 1)] = e;
+            int port1 = devices[edge.first]->addConnection(conn);
+            int port2 = devices[edge.second]->addConnection(conn);
+            conn->setPorts(port1, port2);
+        }
+
+        cout << "Топология построена: коммутаторов: " << graph.switchCount
+             << ", компьютеров: " << graph.hostCount << ", соединений: " << linkCount << ", за "
+             << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " мс" << endl;
+    }
+
+    // Устройства, соединения и маршруты FIB роутеров в двоичном формате файла топологии
+    // (см. TopologyFileHeader) - содержимое файла saveNetwork и основа контрольной точки
+    string topologyImage() const {
+        vector<DeviceRecord> deviceRecords(devices.size());
+        vector<LinkRecord> linkRecords(connections.size());
+        vector<RouteRecord> routeRecords;
+        string strings;
+        unordered_map<const NetworkDevice*, uint32_t> indexOf;
+        indexOf.reserve(devices.size());
+
+        for (size_t i = 0; i < devices.size(); ++i) {
+            const NetworkDevice& device = *devices[i];
+            DeviceRecord& r = deviceRecords[i];
+            indexOf[&device] = static_cast<uint32_t>(i);
+            r.mac = device.getMac().toUint64();
+            r.id = device.getId();
+            r.ip = device.getIpAddress();
+            r.ports = device.getPortLimit();
+            r.kind = static_cast<uint8_t>(device.getKind());
+
+            string attribute;
+            if (auto phone = deviceCast<Phone>(devices[i])) {
+                attribute = phone->getPhoneNumber();
+            } else if (auto printer = deviceCast<Printer>(devices[i])) {
+                attribute = printer->getModel();
+            } else if (auto server = deviceCast<Server>(devices[i])) {
+                attribute = server->getServerType();
+            } else if (auto router = deviceCast<Router>(devices[i])) {
+                attribute = router->getIpRange();
+                for (const auto& route : router->getFib().getRoutes()) {
+                    routeRecords.push_back({static_cast<uint32_t>(i), route.first.first, route.second,
+                                            static_cast<uint8_t>(route.first.second), {}});
+                }
+            }
+            r.stringOffset = strings.size();
+            r.nameBytes = static_cast<uint32_t>(device.getName().size());
+            r.attributeBytes = static_cast<uint32_t>(attribute.size());
+            strings += device.getName();
+            strings += attribute;
+        }
+
+        for (size_t e = 0; e < connections.size(); ++e) {
+            const NetworkConnection& conn = *connections[e];
+            LinkRecord& r = linkRecords[e];
+            r.from = conn.getEnd(0) ? indexOf.at(conn.getEnd(0)) : LinkRecord::noDevice;
+            r.to = conn.getEnd(1) ? indexOf.at(conn.getEnd(1)) : LinkRecord::noDevice;
+            r.portFrom = conn.getPort(0);
+            r.portTo = conn.getPort(1);
+            r.bandwidth = conn.getBandwidth();
+            r.latency = conn.getLatency();
+            r.queueCapacity = static_cast<uint32_t>(conn.getQueueCapacity());
+            r.policy = static_cast<uint8_t>(conn.getDropPolicy());
+            r.up = conn.isUp();
+        }
+
+        TopologyFileHeader header{};
+        memcpy(header.magic, TopologyFileHeader::magicValue, sizeof(header.magic));
+        header.version = TopologyFileHeader::currentVersion;
+        header.headerBytes = sizeof(TopologyFileHeader);
+        header.deviceCount = deviceRecords.size();
+        header.linkCount = linkRecords.size();
+        header.routeCount = routeRecords.size();
+        header.stringBytes = strings.size();
+        header.deviceOffset = sizeof(TopologyFileHeader);
+        header.linkOffset = header.deviceOffset + deviceRecords.size() * sizeof(DeviceRecord);
+        header.routeOffset = header.linkOffset + linkRecords.size() * sizeof(LinkRecord);
+        header.stringOffset = header.routeOffset + routeRecords.size() * sizeof(RouteRecord);
+        header.fileBytes = header.stringOffset + strings.size();
+
+        string image;
+        image.reserve(header.fileBytes);
+        image.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        image.append(reinterpret_cast<const char*>(deviceRecords.data()), deviceRecords.size() * sizeof(DeviceRecord));
+        image.append(reinterpret_cast<const char*>(linkRecords.data()), linkRecords.size() * sizeof(LinkRecord));
+        image.append(reinterpret_cast<const char*>(routeRecords.data()), routeRecords.size() * sizeof(RouteRecord));
+        image += strings;
+        return image;
+    }
+
+    // Сохраняет сеть в двоичный файл (см. topologyImage). Изученные таблицы коммутации,
+    // очереди и счётчики не сохраняются - они входят в контрольные точки
+    void saveNetwork(const string& path) const {
+        auto start = chrono::steady_clock::now();
+        string image = topologyImage();
+        TopologyFileHeader header;
+        memcpy(&header, image.data(), sizeof(header));
+
+        ofstream out(path, ios::binary | ios::trunc);
+        if (!out) {
+            throw runtime_error("Не удалось создать файл " + path);
+        }
+        out.write(image.data(), image.size());
+        out.close();
+        if (!out) {
+            throw runtime_error("Ошибка записи файла " + path);
+        }
+        cout << "Сеть сохранена в " << path << ": устройств: " << devices.size() << ", соединений: "
+             << connections.size() << ", маршрутов FIB: " << header.routeCount << ", за "
+             << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " мс" << endl;
+    }
+
+    // Загружает сеть вместо текущей: двоичный файл saveNetwork отображается в память и
+    // читается без разбора, иначе файл считается текстовым описанием (см. importText)
+    void loadNetwork(const string& path) {
+        if (TopologyFile::isBinary(path)) {
+            loadBinary(TopologyFile(path), path);
+            return;
+        }
+        ifstream in(path);
+        if (!in) {
+            throw runtime_error("Не удалось открыть файл " + path);
+        }
+        importText(in);
+    }
+
+    // Потоковый импорт текстового описания сети вместо текущей, по строке:
+    //   device <ID> <тип> <MAC|auto> [ip=<IP>] [ports=<N>] [name=<имя до конца строки>]
+    //   link <ID1> <ID2> <Мбит/с> <мс> [queue=<N>] [policy=droptail|red] [down]
+    //   route <ID роутера> <префикс/длина> <ID следующего узла>
+    // Пустые строки и строки с # пропускаются; устройство описывается раньше своих
+    // соединений. При ошибке уже импортированная часть сети остаётся
+    void importText(istream& in) {
+        clearNetwork();
+        size_t lineNumber = 0;
+        size_t deviceCount = 0, linkCount = 0, routeCount = 0;
+        string line;
+        try {
+            while (getline(in, line)) {
+                ++lineNumber;
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                istringstream fields(line);
+                string keyword;
+                if (!(fields >> keyword) || keyword[0] == '#') continue;
+
+                string option;
+                if (keyword == "device") {
+                    int id;
+                    string type, mac;
+                    if (!(fields >> id >> type >> mac)) {
+                        throw runtime_error("ожидается device <ID> <тип> <MAC|auto>");
+                    }
+                    string ip, name;
+                    int ports = 0;
+                    while (fields >> option) {
+                        if (option.compare(0, 3, "ip=") == 0) {
+                            ip = option.substr(3);
+                        } else if (option.compare(0, 6, "ports=") == 0) {
+                            ports = stoi(option.substr(6));
+                        } else if (option.compare(0, 5, "name=") == 0) {
+                            string rest;
+                            getline(fields, rest);
+                            name = option.substr(5) + rest;
+                        } else {
+                            throw runtime_error("неизвестный параметр " + option);
+                        }
+                    }
+                    if (name.empty()) name = type + " " + to_string(id);
+                    createDevice(type, id, name, mac == "auto" ? generateRandomMac() : MacAddress::parse(mac), ip, ports);
+                    deviceCount++;
+                } else if (keyword == "link") {
+                    int id1, id2, latency;
+                    float bandwidth;
+                    if (!(fields >> id1 >> id2 >> bandwidth >> latency)) {
+                        throw runtime_error("ожидается link <ID1> <ID2> <Мбит/с> <мс>");
+                    }
+                    size_t queueCapacity = 64;
+                    DropPolicy policy = DropPolicy::DropTail;
+                    bool up = true;
+                    while (fields >> option) {
+                        if (option.compare(0, 6, "queue=") == 0) {
+                            int capacity = stoi(option.substr(6));
+                            if (capacity <= 0) throw runtime_error("размер очереди должен быть больше нуля");
+                            queueCapacity = static_cast<size_t>(capacity);
+                        } else if (option == "policy=red") {
+                            policy = DropPolicy::RED;
+                        } else if (option == "policy=droptail") {
+                            policy = DropPolicy::DropTail;
+                        } else if (option == "down") {
+                            up = false;
+                        } else {
+                            throw runtime_error("неизвестный параметр " + option);
+                        }
+                    }
+                    auto conn = createConnection(id1, id2, bandwidth, latency, queueCapacity, policy);
+                    conn->setUp(up);
+                    linkCount++;
+                } else if (keyword == "route") {
+                    int routerId, nextHopId;
+                    string cidr;
+                    if (!(fields >> routerId >> cidr >> nextHopId)) {
+                        throw runtime_error("ожидается route <ID роутера> <префикс/длина> <ID следующего узла>");
+                    }
+                    installRoute(routerId, cidr, nextHopId);
+                    routeCount++;
+                } else {
+                    throw runtime_error("неизвестная директива " + keyword);
                 }
-            } catch (const exception& e) {
-                cout << "Ошибка создания устройства: " << e.what() << endl;
             }
+        } catch (const exception& e) {
+            throw runtime_error("Строка " + to_string(lineNumber) + ": " + e.what());
         }
-        
-        // Создаем случайные соединения
-        uniform_int_distribution<int> connectionCountDist(deviceCount - 1, deviceCount + 2);
-        int connectionCount = connectionCountDist(rng);
-        
-        for (int i = 0; i < connectionCount; ++i) {
-            uniform_int_distribution<int> deviceDist(1, deviceCount);
-            int id1 = deviceDist(rng);
-            int id2 = deviceDist(rng);
-            
-            if (id1 != id2) {
-                try {
-                    connectDevices(id1, id2, bandwidthDist(rng), latencyDist(rng));
-                } catch (const exception& e) {
-                    // Игнорируем ошибки дублирования соединений
-                }
+        cout << "Импортировано устройств: " << deviceCount << ", соединений: " << linkCount
+             << ", маршрутов: " << routeCount << endl;
+    }
+
+    // Устройство по ID; nullptr, если его нет
+    shared_ptr<NetworkDevice> getDevice(int id) const {
+        int idx = findDeviceById(id);
+        return idx != -1 ? devices[idx] : nullptr;
+    }
+
+    // ID всех компьютеров - источников и получателей нагрузки
+    vector<int> getHostIds() const {
+        vector<int> hosts;
+        for (const auto& device : devices) {
+            if (device->getKind() == DeviceKind::Computer) hosts.push_back(device->getId());
+        }
+        return hosts;
+    }
+
+    // Запускает потоки нагрузки от текущего модельного времени. Каждый поток ведёт
+    // таймер своего источника, поэтому в очереди событий лежит по одному таймеру на
+    // активный поток, а не по событию на каждый будущий пакет. Возвращает число пакетов
+    uint64_t scheduleWorkload(const vector<FlowSpec>& flows, int packetBytes, double rateMbps) {
+        if (packetBytes <= 0 || !(rateMbps > 0)) {
+            throw runtime_error("Размер пакета и скорость потока должны быть положительными");
+        }
+        ensureRoutes();
+        uint64_t packets = 0;
+        for (size_t i = 0; i < flows.size(); ++i) {
+            const FlowSpec& flow = flows[i];
+            int srcIdx = findDeviceById(flow.source);
+            int dstIdx = findDeviceById(flow.destination);
+            if (srcIdx == -1 || dstIdx == -1) {
+                throw runtime_error("Поток " + to_string(i) + ": устройство " +
+                                    to_string(srcIdx == -1 ? flow.source : flow.destination) + " не найдено");
             }
+            auto computer = deviceCast<Computer>(devices[srcIdx]);
+            if (!computer) {
+                throw runtime_error("Поток " + to_string(i) + ": только компьютеры могут отправлять пакеты");
+            }
+            computer->startFlow(flow.start, *devices[dstIdx], flow.bytes, packetBytes, rateMbps,
+                                Payload("поток " + to_string(i)), static_cast<int>(i));
+            packets += (flow.bytes + packetBytes - 1) / packetBytes;
         }
-        
-        cout << "Случайная сеть создана: " << devices.size() << " устройств, " 
-             << connections.size() << " соединений" << endl;
+        return packets;
+    }
+
+    // Прогон нагрузки. Журнал на консоль не выводится (в файл - выводится), а лимит
+    // событий растёт с числом пакетов: пакет порождает несколько событий на каждом переходе
+    WorkloadResult runWorkload(const vector<FlowSpec>& flows, int packetBytes, double rateMbps) {
+        auto start = chrono::steady_clock::now();
+        uint64_t packets = scheduleWorkload(flows, packetBytes, rateMbps);
+        uint64_t receivedBefore = countReceivedPackets();
+        TraceLog& trace = TraceLog::instance();
+        bool console = trace.isConsole();
+        trace.setConsole(false);
+        uint64_t events = runSimulation(maxEventsPerRun + packets * eventsPerPacketBudget);
+        trace.setConsole(console);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        uint64_t delivered = countReceivedPackets() - receivedBefore;
+        cout << "Нагрузка: потоков: " << flows.size() << ", пакетов: " << packets
+             << ", доставлено компьютерам: " << delivered
+             << ", за " << seconds * 1000.0 << " мс (" << packets / max(seconds, 1e-9) / 1e6
+             << " млн пакетов/с)" << endl;
+        return {packets, delivered, events, seconds};
+    }
+
+    // FCT каждого потока нагрузки в пакетном режиме: от начала потока до прихода его
+    // последнего пакета; -1 - дошли не все байты (потери в очередях, нет маршрута)
+    vector<SimTime> measureFlowCompletion(const vector<FlowSpec>& flows, int packetBytes, double rateMbps) {
+        FlowCompletionLog& log = simulator.getFlowLog();
+        log.resize(flows.size());
+        SimTime startTime = simulator.now();
+        try {
+            runWorkload(flows, packetBytes, rateMbps);
+        } catch (...) {
+            log.clear();
+            throw;
+        }
+        vector<SimTime> completion(flows.size(), -1);
+        for (size_t i = 0; i < flows.size(); ++i) {
+            if (flows[i].bytes > 0 && log.getBytes(i) >= flows[i].bytes) {
+                completion[i] = log.getLastArrival(i) - (startTime + flows[i].start);
+            }
+        }
+        log.clear();
+        return completion;
+    }
+
+    // Та же нагрузка в потоковой модели (см. FluidSimulator). Состояние сети и очередь
+    // событий не меняются, поэтому результат можно сравнивать с пакетным прогоном
+    FluidResult runFluidWorkload(const vector<FlowSpec>& flows, int packetBytes, double rateMbps) {
+        ensureRoutes();
+        FluidSimulator fluid(devices, *getTopologySnapshot());
+        FluidResult result = fluid.run(flows, packetBytes, rateMbps);
+        LatencyHistogram completion;
+        for (SimTime fct : result.completion) {
+            if (fct >= 0) completion.record(fct);
+        }
+        cout << "Потоковая модель: потоков: " << flows.size() << ", завершено: " << completion.getCount()
+             << ", без маршрута: " << result.unroutable
+             << "\nFCT: среднее " << completion.getMean() / 1e6 << " мс, 99% - "
+             << toMilliseconds(completion.percentile(99)) << " мс, макс. " << toMilliseconds(completion.getMax())
+             << " мс\nСобытий: " << result.events << ", пересчётов долей: " << result.reallocations
+             << ", изменений скорости: " << result.rateChanges << ", за " << result.seconds * 1000.0 << " мс" << endl;
+        return result;
     }
 
     void displayNetwork() const {
@@ -559,28 +7559,31 @@ public:
         for (size_t i = 0; i < connections.size(); ++i) {
             const auto& conn = connections[i];
             try {
-                // Проходим по всем устройствам и ищем те, которые связаны этим соединением
-                shared_ptr<NetworkDevice> dev1 = nullptr;
-                shared_ptr<NetworkDevice> dev2 = nullptr;
-                
-                for (const auto& device : devices) {
-                    if (conn->connects(device)) {
-                        if (!dev1) {
-                            dev1 = device;
-                        } else if (!dev2) {
-                            dev2 = device;
-                            break;
-                        }
-                    }
-                }
+                const NetworkDevice* dev1 = conn->getEnd(0);
+                const NetworkDevice* dev2 = conn->getEnd(1);
                 
                 if (dev1 && dev2) {
                     cout << dev1->getName() << " (" << dev1->getId() << ") <---> " 
                          << dev2->getName() << " (" << dev2->getId() << ")"
                          << "\nПропускная способность: " << conn->getBandwidth() << "Мбит/с"
-                         << ", Задержка: " << conn->getLatency() << "мс\n" << endl;
+                         << ", Задержка: " << conn->getLatency() << "мс"
+                         << "\nОчередь: " << conn->getQueueCapacity() << " пакетов ("
+                         << (conn->getDropPolicy() == DropPolicy::RED ? "RED" : "Drop-Tail") << ")"
+                         << (conn->isUp() ? "" : "\nСоединение отключено") << endl;
+                    for (int dir = 0; dir < 2; ++dir) {
+                        const LinkStats& st = conn->getStats(dir);
+                        const NetworkDevice* from = dir == 0 ? dev1 : dev2;
+                        const NetworkDevice* to = dir == 0 ? dev2 : dev1;
+                        cout << "  " << from->getId() << " -> " << to->getId()
+                             << ": передано " << st.transmittedPackets << " пакетов (" << st.transmittedBytes << " байт)"
+                             << ", в очереди " << st.queueDepth << " (макс. " << st.maxQueueDepth << ")"
+                             << ", отброшено " << st.dropped()
+                             << " (переполнение: " << st.droppedTail << ", RED: " << st.droppedRed
+                             << ", отключено: " << st.droppedDown << ")" << endl;
+                    }
+                    cout << endl;
                 } else {
-                    cout << "Соединение " << i << ": Ошибка - не найдены оба устройства" << endl;
+                    cout << "Соединение " << i << ": устройство на одном из концов удалено" << endl;
                 }
             } catch (const exception& e) {
                 cout << "Ошибка отображения соединения " << i << ": " << e.what() << endl;
@@ -589,6 +7592,726 @@ public:
     }
 };
 
+// Поток вывода, который всё отбрасывает: бенчмарки глушат им отчёты NetworkManager
+class NullBuffer : public streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    streamsize xsputn(const char*, streamsize n) override { return n; }
+};
+
+// Глушит cout на время своей жизни
+class SilentCout {
+private:
+    NullBuffer null;
+    streambuf* saved;
+
+public:
+    SilentCout() : saved(cout.rdbuf(&null)) {}
+    ~SilentCout() { cout.rdbuf(saved); }
+
+    SilentCout(const SilentCout&) = delete;
+    SilentCout& operator=(const SilentCout&) = delete;
+};
+
+// Микробенчмарки горячих путей модели. Каждый случай сначала строит состояние (вне
+// замера), затем выполняет тело с заданным числом операций: несколько разогревочных
+// повторений, потом измеряемые. Состояние строится заново перед каждым повторением,
+// поэтому повторения независимы. Вывод NetworkManager на время прогона заглушён
+class BenchmarkSuite {
+public:
+    // prepare строит состояние и возвращает тело, выполняющее operations операций
+    struct Case {
+        string name;
+        uint64_t operations;
+        function<function<void()>()> prepare;
+    };
+
+    struct Result {
+        string name;
+        uint64_t operations;
+        vector<double> nsPerOperation; // по измеряемым повторениям
+
+        double min() const { return *min_element(nsPerOperation.begin(), nsPerOperation.end()); }
+
+        double median() const {
+            vector<double> sorted = nsPerOperation;
+            sort(sorted.begin(), sorted.end());
+            size_t mid = sorted.size() / 2;
+            return sorted.size() % 2 ? sorted[mid] : (sorted[mid - 1] + sorted[mid]) / 2.0;
+        }
+
+        double mean() const {
+            return accumulate(nsPerOperation.begin(), nsPerOperation.end(), 0.0) / nsPerOperation.size();
+        }
+
+        double stddev() const {
+            double m = mean();
+            double sum = 0.0;
+            for (double x : nsPerOperation) sum += (x - m) * (x - m);
+            return nsPerOperation.size() > 1 ? sqrt(sum / (nsPerOperation.size() - 1)) : 0.0;
+        }
+    };
+
+private:
+    vector<Case> cases;
+    int warmup;
+    int repetitions;
+
+public:
+    BenchmarkSuite(int warmup, int repetitions) : warmup(warmup), repetitions(repetitions) {
+        if (warmup < 0 || repetitions < 1) {
+            throw runtime_error("Число повторений бенчмарка должно быть положительным");
+        }
+    }
+
+    void add(const string& name, uint64_t operations, function<function<void()>()> prepare) {
+        cases.push_back({name, operations, move(prepare)});
+    }
+
+    const vector<Case>& getCases() const { return cases; }
+
+    // Прогоняет случаи, имя которых содержит filter (пустой - все), и печатает таблицу в report
+    vector<Result> run(const string& filter, ostream& report) const {
+        vector<Result> results;
+        // Заголовок выровнен вручную: setw считает байты, а кириллица в UTF-8 занимает по два
+        report << "Бенчмарк                    операций  нс/оп (мед.)        мин.   разброс" << endl;
+        for (const Case& c : cases) {
+            if (!filter.empty() && c.name.find(filter) == string::npos) continue;
+            Result result{c.name, c.operations, {}};
+            for (int rep = 0; rep < warmup + repetitions; ++rep) {
+                double seconds;
+                {
+                    SilentCout silent;
+                    function<void()> body = c.prepare();
+                    auto start = chrono::steady_clock::now();
+                    body();
+                    seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                }
+                if (rep >= warmup) result.nsPerOperation.push_back(seconds * 1e9 / c.operations);
+            }
+            report << left << setw(26) << result.name << right << setw(10) << result.operations
+                   << fixed << setprecision(1) << setw(14) << result.median() << setw(12) << result.min()
+                   << setw(9) << 100.0 * result.stddev() / max(result.mean(), 1e-12) << "%" << endl;
+            report << defaultfloat;
+            results.push_back(move(result));
+        }
+        if (results.empty()) {
+            throw runtime_error("Нет бенчмарков, подходящих под фильтр \"" + filter + "\"");
+        }
+        return results;
+    }
+
+    void writeJson(const vector<Result>& results, ostream& out) const {
+        out << "{\n  \"context\": {\"warmup\": " << warmup << ", \"repetitions\": " << repetitions
+            << ", \"hardware_threads\": " << thread::hardware_concurrency()
+#ifdef NDEBUG
+            << ", \"assertions\": false},\n";
+#else
+            << ", \"assertions\": true},\n";
+#endif
+        out << "  \"benchmarks\": [";
+        out << setprecision(6);
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& r = results[i];
+            out << (i ? ",\n" : "\n") << "    {\"name\": ";
+            writeJsonString(out, r.name);
+            out << ", \"operations\": " << r.operations
+                << ", \"ns_per_op\": {\"min\": " << r.min() << ", \"median\": " << r.median()
+                << ", \"mean\": " << r.mean() << ", \"stddev\": " << r.stddev() << "}, \"samples\": [";
+            for (size_t k = 0; k < r.nsPerOperation.size(); ++k) {
+                out << (k ? ", " : "") << r.nsPerOperation[k];
+            }
+            out << "]}";
+        }
+        out << "\n  ]\n}\n";
+    }
+};
+
+// Не даёт компилятору выбросить результат измеряемого цикла
+static atomic<uint64_t> benchmarkSink{0};
+
+// Звезда из коммутатора или пара роутеров с компьютерами: packets случайных пар
+// отправителей и получателей ставятся в модель и прогоняются до доставки
+static function<void()> forwardingBody(shared_ptr<NetworkManager> nm, const vector<int>& senders,
+                                       const vector<int>& receivers, uint64_t packets) {
+    mt19937 rng(1);
+    vector<pair<int, int>> pairs;
+    pairs.reserve(packets);
+    for (uint64_t i = 0; i < packets; ++i) {
+        int src = senders[rng() % senders.size()];
+        int dst;
+        do {
+            dst = receivers[rng() % receivers.size()];
+        } while (dst == src);
+        pairs.emplace_back(src, dst);
+    }
+    return [nm, pairs]() {
+        for (const auto& p : pairs) nm->injectPacket(p.first, p.second, "bench");
+        nm->runSimulation();
+    };
+}
+
+static void registerSimulatorBenchmarks(BenchmarkSuite& suite) {
+    constexpr uint64_t packetBatch = 20000;
+
+    // Выделение пакета из пула и возврат в пул
+    suite.add("packet_create", 1000000, [] {
+        auto pool = make_shared<PacketPool>();
+        Payload payload("bench");
+        return [pool, payload] {
+            uint64_t sum = 0;
+            for (int i = 0; i < 1000000; ++i) {
+                PacketRef packet = pool->acquire(payload, 64, MacAddress(1), MacAddress(static_cast<uint64_t>(i)));
+                sum += static_cast<uint64_t>(packet->getSize());
+            }
+            benchmarkSink += sum;
+        };
+    });
+
+    // Передача по одному соединению: очередь направления, сериализация и доставка
+    suite.add("link_transfer", packetBatch, [] {
+        auto nm = make_shared<NetworkManager>(1);
+        nm->addDevices({{"Computer", 1, "A", MacAddress(1), "10.0.0.1"},
+                        {"Computer", 2, "B", MacAddress(2), "10.0.0.2"}});
+        nm->connectMany({{1, 2, 10000, 0, packetBatch}});
+        return forwardingBody(nm, {1}, {2}, packetBatch);
+    });
+
+    // Коммутатор на 32 порта; таблица MAC-адресов заполнена до замера
+    suite.add("switch_forward", packetBatch, [] {
+        constexpr int hosts = 32;
+        auto nm = make_shared<NetworkManager>(1);
+        vector<DeviceSpec> devices{{"Switch", 1, "sw", MacAddress(1), "", hosts}};
+        vector<LinkSpec> links;
+        vector<int> ids;
+        for (int i = 0; i < hosts; ++i) {
+            ids.push_back(100 + i);
+            devices.push_back({"Computer", 100 + i, "pc", MacAddress(100 + i), "10.0.0." + to_string(i + 1)});
+            links.push_back({1, 100 + i, 10000, 0, packetBatch});
+        }
+        nm->addDevices(devices);
+        nm->connectMany(links);
+        for (int i = 0; i < hosts; ++i) nm->injectPacket(ids[i], ids[(i + 1) % hosts], "learn");
+        nm->runSimulation();
+        return forwardingBody(nm, ids, ids, packetBatch);
+    });
+
+    // Два роутера между подсетями по 16 компьютеров: каждый пакет проходит оба роутера
+    suite.add("router_forward", packetBatch, [] {
+        constexpr int hosts = 16;
+        auto nm = make_shared<NetworkManager>(1);
+        vector<DeviceSpec> devices{{"Router", 1, "R1", MacAddress(1), "10.0.1.0/24", hosts + 1},
+                                   {"Router", 2, "R2", MacAddress(2), "10.0.2.0/24", hosts + 1}};
+        vector<LinkSpec> links{{1, 2, 10000, 0, packetBatch}};
+        vector<int> left, right;
+        for (int i = 0; i < hosts; ++i) {
+            left.push_back(100 + i);
+            right.push_back(200 + i);
+            devices.push_back({"Computer", 100 + i, "a", MacAddress(100 + i), "10.0.1." + to_string(i + 1)});
+            devices.push_back({"Computer", 200 + i, "b", MacAddress(200 + i), "10.0.2." + to_string(i + 1)});
+            links.push_back({1, 100 + i, 10000, 0, packetBatch});
+            links.push_back({2, 200 + i, 10000, 0, packetBatch});
+        }
+        nm->addDevices(devices);
+        nm->connectMany(links);
+        nm->addRoute(1, "10.0.2.0/24", 2);
+        nm->addRoute(2, "10.0.1.0/24", 1);
+        return forwardingBody(nm, left, right, packetBatch);
+    });
+
+    // Соединение пар из 2000 компьютеров через connectDevices
+    suite.add("connect_devices", 1000, [] {
+        auto nm = make_shared<NetworkManager>(1);
+        vector<DeviceSpec> devices;
+        for (int i = 1; i <= 2000; ++i) devices.push_back({"Computer", i, "pc", MacAddress(i), "10.0.0.1"});
+        nm->addDevices(devices);
+        return [nm] {
+            for (int i = 1; i <= 2000; i += 2) nm->connectDevices(i, i + 1, 1000, 1);
+        };
+    });
+
+    // Поиск устройства по ID среди 10000
+    suite.add("find_device", 1000000, [] {
+        constexpr int count = 10000;
+        auto nm = make_shared<NetworkManager>(1);
+        vector<DeviceSpec> devices;
+        for (int i = 1; i <= count; ++i) devices.push_back({"Computer", i, "pc", MacAddress(i), "10.0.0.1"});
+        nm->addDevices(devices);
+        mt19937 rng(1);
+        vector<int> ids(1000000);
+        for (int& id : ids) id = static_cast<int>(rng() % count) + 1;
+        return [nm, ids] {
+            uint64_t sum = 0;
+            for (int id : ids) sum += static_cast<uint64_t>(nm->getDevice(id)->getId());
+            benchmarkSink += sum;
+        };
+    });
+
+    // Случайная сеть из 5-10 устройств, как при запуске программы
+    suite.add("generate_random_network", 200, [] {
+        auto nm = make_shared<NetworkManager>(1);
+        return [nm] {
+            for (int i = 0; i < 200; ++i) nm->generateRandomNetwork();
+        };
+    });
+}
+
+// Режим --bench: [--filter <подстрока>] [--repetitions N] [--warmup N] [--json <файл>] [--list]
+static int runBenchmarks(const vector<string>& args) {
+    string filter, jsonPath;
+    int warmup = 1, repetitions = 5;
+    bool list = false;
+    for (size_t i = 0; i < args.size(); ++i) {
+        const string& arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (arg == "--list") {
+            list = true;
+        } else if (arg == "--filter" && hasValue) {
+            filter = args[++i];
+        } else if (arg == "--json" && hasValue) {
+            jsonPath = args[++i];
+        } else if (arg == "--repetitions" && hasValue) {
+            repetitions = stoi(args[++i]);
+        } else if (arg == "--warmup" && hasValue) {
+            warmup = stoi(args[++i]);
+        } else {
+            throw runtime_error("Неизвестный параметр бенчмарков: " + arg);
+        }
+    }
+
+    BenchmarkSuite suite(warmup, repetitions);
+    registerSimulatorBenchmarks(suite);
+    if (list) {
+        for (const auto& c : suite.getCases()) cout << c.name << endl;
+        return 0;
+    }
+
+    TraceLog::instance().setConsole(false);
+    auto results = suite.run(filter, cout);
+    if (!jsonPath.empty()) {
+        ofstream out(jsonPath);
+        if (!out) {
+            throw runtime_error("Не удалось создать файл " + jsonPath);
+        }
+        suite.writeJson(results, out);
+        cout << "Результаты записаны в " << jsonPath << endl;
+    }
+    return 0;
+}
+
+// Пиковый объём резидентной памяти процесса в байтах
+static uint64_t peakResidentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) return stoull(line.substr(6)) * 1024;
+    }
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+// Сбрасывает пик до текущего объёма, чтобы замер относился к одной конфигурации.
+// Поддерживается только в Linux; в остальных системах пик копится за весь процесс
+static void resetPeakResident() {
+#ifdef __linux__
+    ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+struct ScaleTopology {
+    size_t devices;
+    size_t links;
+    size_t hosts;
+};
+
+// Сеть для замеров масштабируемости: корневой роутер и под ним поды - роутер со своей
+// подсетью и компьютерами. Пакеты идут по FIB роутеров, поэтому сеть маршрутизируется
+// при любом размере, в том числе больше предела таблиц маршрутов NetworkManager
+static ScaleTopology buildRoutedPods(NetworkManager& nm, size_t targetDevices) {
+    int hostsPerPod = max(2, static_cast<int>(sqrt(static_cast<double>(targetDevices))));
+    int pods = max(1, static_cast<int>((targetDevices - 1) / (hostsPerPod + 1)));
+    int hostBits = 1;
+    while ((1 << hostBits) < hostsPerPod + 2) ++hostBits;
+    if (static_cast<uint64_t>(pods) << hostBits >= (1u << 24)) {
+        throw runtime_error("Сеть из " + to_string(targetDevices) + " устройств не помещается в 10.0.0.0/8");
+    }
+
+    constexpr float bandwidth = 100000;
+    constexpr int latency = 1;
+    const uint32_t base = parseIpv4("10.0.0.0");
+    vector<DeviceSpec> devices{{"Router", 1, "core", MacAddress(1), "10.0.0.0/8", pods}};
+    vector<LinkSpec> links;
+    vector<pair<int, string>> podRoutes;
+    devices.reserve(1 + static_cast<size_t>(pods) * (hostsPerPod + 1));
+    links.reserve(static_cast<size_t>(pods) * (hostsPerPod + 1));
+    int nextId = 2;
+    for (int p = 0; p < pods; ++p) {
+        uint32_t subnet = base | (static_cast<uint32_t>(p) << hostBits);
+        string cidr = formatIpv4(subnet) + "/" + to_string(32 - hostBits);
+        int podRouter = nextId++;
+        devices.push_back({"Router", podRouter, "pod" + to_string(p), MacAddress(podRouter), cidr, hostsPerPod + 1});
+        links.push_back({1, podRouter, bandwidth, latency});
+        podRoutes.emplace_back(podRouter, cidr);
+        for (int h = 0; h < hostsPerPod; ++h) {
+            int host = nextId++;
+            devices.push_back({"Computer", host, "pc", MacAddress(host), formatIpv4(subnet + h + 1)});
+            links.push_back({podRouter, host, bandwidth, latency});
+        }
+    }
+    nm.addDevices(devices);
+    nm.connectMany(links);
+    for (const auto& [router, cidr] : podRoutes) {
+        nm.addRoute(1, cidr, router);
+        nm.addRoute(router, "0.0.0.0/0", 1);
+    }
+    nm.ensureRoutes();
+    return {devices.size(), links.size(), static_cast<size_t>(pods) * hostsPerPod};
+}
+
+// Режим --scale: прогон одной и той же нагрузки на сетях от 10 до maxDevices устройств
+// (по порядкам) и на 1, 2, 4 ... maxThreads потоках. Для каждой конфигурации -
+// время построения, пакеты и события в секунду, пиковая память; CSV для сравнения версий.
+// Параметры: [--max-devices N] [--max-threads N] [--flows-per-second X] [--csv <файл>]
+static int runScalingBenchmark(const vector<string>& args) {
+    size_t maxDevices = 1000000;
+    int maxThreads = static_cast<int>(max(1u, thread::hardware_concurrency()));
+    string csvPath;
+    WorkloadParams workload;
+    workload.sizes = FlowSizeDistribution::Fixed;
+    workload.flowsPerSecond = 100000;
+    workload.durationMs = 100;
+    workload.meanFlowBytes = 10000;
+    workload.flowRateMbps = 1000;
+    for (size_t i = 0; i < args.size(); ++i) {
+        const string& arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (arg == "--max-devices" && hasValue) {
+            maxDevices = stoull(args[++i]);
+        } else if (arg == "--max-threads" && hasValue) {
+            maxThreads = stoi(args[++i]);
+        } else if (arg == "--flows-per-second" && hasValue) {
+            workload.flowsPerSecond = stod(args[++i]);
+        } else if (arg == "--csv" && hasValue) {
+            csvPath = args[++i];
+        } else {
+            throw runtime_error("Неизвестный параметр замера масштабируемости: " + arg);
+        }
+    }
+    if (maxDevices < 10 || maxThreads < 1) {
+        throw runtime_error("Нужно не меньше 10 устройств и 1 потока");
+    }
+
+    vector<int> threadCounts;
+    for (int t = 1; t < maxThreads; t *= 2) threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    ofstream csv;
+    if (!csvPath.empty()) {
+        csv.open(csvPath);
+        if (!csv) {
+            throw runtime_error("Не удалось создать файл " + csvPath);
+        }
+        csv << "devices,links,hosts,threads,build_ms,flows,packets,delivered,events,run_ms,"
+               "packets_per_sec,events_per_sec,peak_rss_mb\n";
+    }
+
+    TraceLog::instance().setConsole(false);
+    cout << "Устройств  потоков  постр., мс  пакетов  доставлено     событий  прогон, мс"
+            "    пакетов/с     событий/с  пик, МБ" << endl;
+    for (size_t devices = 10; devices <= maxDevices; devices *= 10) {
+        for (int threads : threadCounts) {
+            resetPeakResident();
+            ScaleTopology topology;
+            WorkloadResult result;
+            vector<FlowSpec> flows;
+            double buildMs;
+            {
+                NetworkManager nm(1);
+                SilentCout silent;
+                auto start = chrono::steady_clock::now();
+                topology = buildRoutedPods(nm, devices);
+                buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+                nm.setSimulationThreads(threads);
+                flows = WorkloadGenerator::generate(workload, nm.getHostIds());
+                result = nm.runWorkload(flows, workload.packetBytes, workload.flowRateMbps);
+            }
+            double runSeconds = max(result.seconds, 1e-9);
+            double peakMb = peakResidentBytes() / (1024.0 * 1024.0);
+            cout << fixed << setprecision(1) << setw(9) << topology.devices << setw(9) << threads
+                 << setw(12) << buildMs << setw(9) << result.packets << setw(12) << result.delivered
+                 << setw(12) << result.events << setw(12) << runSeconds * 1000.0
+                 << setprecision(0) << setw(13) << result.packets / runSeconds
+                 << setw(14) << result.events / runSeconds << setprecision(1) << setw(9) << peakMb
+                 << defaultfloat << endl;
+            if (csv) {
+                csv << fixed << setprecision(3) << topology.devices << ',' << topology.links << ','
+                    << topology.hosts << ',' << threads << ',' << buildMs << ',' << flows.size() << ','
+                    << result.packets << ',' << result.delivered << ',' << result.events << ','
+                    << runSeconds * 1000.0 << ',' << setprecision(0) << result.packets / runSeconds << ','
+                    << result.events / runSeconds << ',' << setprecision(1) << peakMb << '\n';
+            }
+        }
+    }
+    if (csv) {
+        csv.close();
+        cout << "Результаты записаны в " << csvPath << endl;
+    }
+    return 0;
+}
+
+// Сверка потоковой модели с пакетной: на небольших сетях одна и та же нагрузка
+// прогоняется в обоих режимах, и для потоков, завершённых в обоих, сравнивается FCT.
+// Очереди взяты с запасом, чтобы пакетный режим не терял пакеты: потоковая модель
+// потерь не знает. Код возврата 1 - медиана относительной ошибки хотя бы в одном
+// сценарии больше допуска
+static int runFluidValidation(const vector<string>& args) {
+    int flowCount = 300;
+    double tolerancePercent = 10;
+    uint64_t seed = 1;
+    for (size_t i = 0; i < args.size(); ++i) {
+        const string& arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (arg == "--flows" && hasValue) {
+            flowCount = stoi(args[++i]);
+        } else if (arg == "--tolerance" && hasValue) {
+            tolerancePercent = stod(args[++i]);
+        } else if (arg == "--seed" && hasValue) {
+            seed = stoull(args[++i]);
+        } else {
+            throw runtime_error("Неизвестный параметр сверки потоковой модели: " + arg);
+        }
+    }
+    if (flowCount < 1 || tolerancePercent < 0) {
+        throw runtime_error("Нужен хотя бы один поток и неотрицательный допуск");
+    }
+
+    struct Scenario {
+        string name;
+        function<void(NetworkManager&)> build;
+        TrafficPattern pattern;
+    };
+    auto generated = [](TopologyParams params) {
+        params.queueCapacity = 8192;
+        return [params](NetworkManager& nm) { nm.generateTopology(params); };
+    };
+    TopologyParams leafSpine;
+    leafSpine.kind = TopologyKind::LeafSpine;
+    leafSpine.spines = 2;
+    leafSpine.leaves = 4;
+    leafSpine.hostsPerSwitch = 4;
+    TopologyParams fatTree;
+    fatTree.kind = TopologyKind::FatTree;
+    fatTree.k = 4;
+    TopologyParams torus;
+    torus.kind = TopologyKind::Torus;
+    torus.rows = 3;
+    torus.columns = 3;
+    torus.hostsPerSwitch = 2;
+    vector<Scenario> scenarios = {
+        {"leaf-spine 2x4", generated(leafSpine), TrafficPattern::AllToAll},
+        {"leaf-spine incast", generated(leafSpine), TrafficPattern::Incast},
+        {"fat-tree k=4", generated(fatTree), TrafficPattern::AllToAll},
+        {"тор 3x3", generated(torus), TrafficPattern::AllToAll},
+        {"роутеры, 60 устр.", [](NetworkManager& nm) { buildRoutedPods(nm, 60); }, TrafficPattern::AllToAll},
+    };
+
+    WorkloadParams workload;
+    workload.sizes = FlowSizeDistribution::Pareto;
+    workload.meanFlowBytes = 50000;
+    workload.flowRateMbps = 400;
+    workload.incastFanIn = 4;
+    workload.durationMs = 100;
+    workload.seed = seed;
+
+    TraceLog::instance().setConsole(false);
+    cout << "Сценарий                потоков  сравнено  FCT пакет, мс  FCT поток, мс  ошибка: медиана"
+            "   90%  пакет, мс  поток, мс  ускорение" << endl;
+    bool passed = true;
+    for (const Scenario& scenario : scenarios) {
+        workload.pattern = scenario.pattern;
+        workload.flowsPerSecond = flowCount / (workload.durationMs / 1000.0);
+        if (scenario.pattern == TrafficPattern::Incast) workload.flowsPerSecond /= workload.incastFanIn;
+        vector<FlowSpec> flows;
+        vector<SimTime> packet;
+        FluidResult fluid;
+        double packetSeconds;
+        {
+            NetworkManager nm(1);
+            SilentCout silent;
+            scenario.build(nm);
+            flows = WorkloadGenerator::generate(workload, nm.getHostIds());
+            fluid = nm.runFluidWorkload(flows, workload.packetBytes, workload.flowRateMbps);
+            auto start = chrono::steady_clock::now();
+            packet = nm.measureFlowCompletion(flows, workload.packetBytes, workload.flowRateMbps);
+            packetSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+
+        vector<double> errors;
+        double packetSum = 0, fluidSum = 0;
+        for (size_t i = 0; i < flows.size(); ++i) {
+            if (packet[i] <= 0 || fluid.completion[i] < 0) continue;
+            packetSum += toMilliseconds(packet[i]);
+            fluidSum += toMilliseconds(fluid.completion[i]);
+            errors.push_back(fabs(static_cast<double>(fluid.completion[i] - packet[i])) / packet[i] * 100.0);
+        }
+        sort(errors.begin(), errors.end());
+        auto errorAt = [&](double q) { return errors.empty() ? 0.0 : errors[static_cast<size_t>(q * (errors.size() - 1))]; };
+        double median = errorAt(0.5);
+        size_t compared = errors.size();
+        passed = passed && compared > 0 && median <= tolerancePercent;
+        // Ширина колонки по символам: setw считает байты, а название может быть кириллическим
+        string name = scenario.name;
+        size_t width = count_if(name.begin(), name.end(), [](char c) { return (c & 0xC0) != 0x80; });
+        name.append(width < 22 ? 22 - width : 1, ' ');
+        cout << name << fixed << setprecision(2) << setw(9) << flows.size() << setw(10) << compared
+             << setw(15) << (compared ? packetSum / compared : 0.0) << setw(15) << (compared ? fluidSum / compared : 0.0)
+             << setw(16) << median << '%' << setw(6) << errorAt(0.9) << '%'
+             << setw(11) << packetSeconds * 1000.0 << setw(11) << fluid.seconds * 1000.0
+             << setw(10) << setprecision(0) << packetSeconds / max(fluid.seconds, 1e-9) << 'x'
+             << defaultfloat << setprecision(6) << endl;
+    }
+    cout << (passed ? "Потоковая модель в пределах допуска " : "Потоковая модель вне допуска ")
+         << tolerancePercent << "%" << endl;
+    return passed ? 0 : 1;
+}
+
+// Сверка контрольных точек: прогон с периодическими точками останавливается посередине,
+// журнал восстанавливается в новом NetworkManager, и обе копии доигрываются до конца.
+// Контрольные суммы состояния на паузе и в конце должны совпасть побайтно
+static int runCheckpointValidation(const vector<string>& args) {
+    int flowCount = 300;
+    double intervalMs = 5;
+    uint64_t seed = 1;
+    string path = "validate_checkpoint.nckp";
+    for (size_t i = 0; i < args.size(); ++i) {
+        const string& arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (arg == "--flows" && hasValue) {
+            flowCount = stoi(args[++i]);
+        } else if (arg == "--interval" && hasValue) {
+            intervalMs = stod(args[++i]);
+        } else if (arg == "--seed" && hasValue) {
+            seed = stoull(args[++i]);
+        } else if (arg == "--path" && hasValue) {
+            path = args[++i];
+        } else {
+            throw runtime_error("Неизвестный параметр сверки контрольных точек: " + arg);
+        }
+    }
+    if (flowCount < 1 || !(intervalMs > 0)) {
+        throw runtime_error("Нужен хотя бы один поток и положительный интервал");
+    }
+
+    struct Scenario {
+        string name;
+        function<void(NetworkManager&)> build;
+        int threads;
+        bool batch;
+    };
+    TopologyParams leafSpine;
+    leafSpine.kind = TopologyKind::LeafSpine;
+    leafSpine.spines = 2;
+    leafSpine.leaves = 4;
+    leafSpine.hostsPerSwitch = 4;
+    leafSpine.queueCapacity = 16;
+    TopologyParams ring;
+    ring.kind = TopologyKind::Ring;
+    ring.nodes = 6;
+    ring.hostsPerSwitch = 3;
+    TopologyParams fatTree;
+    fatTree.kind = TopologyKind::FatTree;
+    fatTree.k = 8;
+    vector<Scenario> scenarios = {
+        {"leaf-spine, очереди 16", [leafSpine](NetworkManager& nm) { nm.generateTopology(leafSpine); }, 1, false},
+        {"роутеры, 4 потока", [](NetworkManager& nm) { buildRoutedPods(nm, 60); }, 4, false},
+        {"кольцо, пакетно", [ring](NetworkManager& nm) { nm.generateTopology(ring); }, 1, true},
+        {"fat-tree k=8", [fatTree](NetworkManager& nm) { nm.generateTopology(fatTree); }, 1, false},
+        {"роутеры, 1000 устр.", [](NetworkManager& nm) { buildRoutedPods(nm, 1000); }, 1, false},
+    };
+
+    WorkloadParams workload;
+    workload.pattern = TrafficPattern::AllToAll;
+    workload.sizes = FlowSizeDistribution::Pareto;
+    workload.meanFlowBytes = 50000;
+    workload.flowRateMbps = 400;
+    workload.durationMs = 100;
+    workload.flowsPerSecond = flowCount / (workload.durationMs / 1000.0);
+    workload.seed = seed;
+    uint64_t maxEvents = numeric_limits<uint64_t>::max();
+    SimTime pauseAt = fromMilliseconds(workload.durationMs / 2);
+
+    TraceLog::instance().setConsole(false);
+    cout << "Сценарий                точек: полных  изменений  полная, байт  изменения, байт  полная, мс"
+            "  изменения, мс  результат" << endl;
+    bool passed = true;
+    for (const Scenario& scenario : scenarios) {
+        uint64_t pausedSum, finalSum, restoredSum, restoredFinalSum;
+        uint64_t fullWrites, changeWrites, fullBytes, changeBytes;
+        double fullMs, changeMs;
+        {
+            NetworkManager nm(1);
+            SilentCout silent;
+            scenario.build(nm);
+            nm.setSimulationThreads(scenario.threads);
+            nm.setBatchDispatch(scenario.batch);
+            nm.scheduleWorkload(WorkloadGenerator::generate(workload, nm.getHostIds()), workload.packetBytes,
+                                workload.flowRateMbps);
+            auto start = chrono::steady_clock::now();
+            nm.startCheckpoints(path, intervalMs);
+            fullMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            nm.runSimulation(maxEvents, pauseAt);
+            const CheckpointStore& store = *nm.getCheckpointStore();
+            fullWrites = store.getFullWrites();
+            changeWrites = store.getWritten() - fullWrites;
+            fullBytes = store.getFullBytes();
+            changeBytes = changeWrites ? store.getChangeBytes() / changeWrites : 0;
+            pausedSum = nm.stateChecksum();
+            // Ещё одна точка на паузе - отдельно, чтобы засечь время записи изменений
+            start = chrono::steady_clock::now();
+            nm.writeCheckpoint();
+            changeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            nm.stopCheckpoints();
+            nm.runSimulation(maxEvents);
+            finalSum = nm.stateChecksum();
+        }
+        {
+            NetworkManager nm(1);
+            SilentCout silent;
+            nm.setSimulationThreads(scenario.threads);
+            nm.setBatchDispatch(scenario.batch);
+            nm.restoreCheckpoint(path);
+            restoredSum = nm.stateChecksum();
+            nm.runSimulation(maxEvents);
+            restoredFinalSum = nm.stateChecksum();
+        }
+        std::remove(path.c_str());
+
+        bool same = pausedSum == restoredSum && finalSum == restoredFinalSum;
+        passed = passed && same;
+        string name = scenario.name;
+        size_t width = count_if(name.begin(), name.end(), [](char c) { return (c & 0xC0) != 0x80; });
+        name.append(width < 22 ? 22 - width : 1, ' ');
+        cout << name << setw(15) << fullWrites << setw(11) << changeWrites << setw(14) << fullBytes
+             << setw(17) << changeBytes << fixed << setprecision(2) << setw(12) << fullMs << setw(15) << changeMs
+             << defaultfloat
+             << setprecision(6) << "  "
+             << (same ? "совпадает" : pausedSum != restoredSum ? "расходится на паузе" : "расходится в конце")
+             << endl;
+    }
+    cout << (passed ? "Восстановленные прогоны совпадают с непрерывными"
+                    : "Восстановленный прогон разошёлся с непрерывным") << endl;
+    return passed ? 0 : 1;
+}
+
 template<typename T>
 T safeInput(const string& prompt = "") {
     T value;
@@ -612,25 +8335,72 @@ void displayMenu() {
     cout << "3. Отправить пакет" << endl;
     cout << "4. Показать сеть" << endl;
     cout << "5. Сгенерировать случайную сеть" << endl;
-    cout << "6. Выход" << endl;
+    cout << "6. Добавить маршрут на роутер" << endl;
+    cout << "7. Включить/отключить соединение" << endl;
+    cout << "8. Удалить устройство" << endl;
+    cout << "9. Настроить моделирование (потоки, пакетная обработка)" << endl;
+    cout << "10. Сгенерировать крупную топологию" << endl;
+    cout << "11. Сохранить сеть в файл" << endl;
+    cout << "12. Загрузить сеть из файла" << endl;
+    cout << "13. Запустить нагрузку (генератор или трасса)" << endl;
+    cout << "14. Захват трафика (pcap)" << endl;
+    cout << "15. Метрики (сводка, выгрузка JSON/CSV)" << endl;
+    cout << "16. Контрольные точки (запись, восстановление)" << endl;
+    cout << "17. Выход" << endl;
     cout << "Выберите действие: ";
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
     // Установка UTF-8 кодировки для лучшей совместимости
     SetConsoleOutputCP(65001);
     SetConsoleCP(65001);
+#endif
+
+    // Разбор журнала трассировки: --decode <файл>
+    if (argc >= 3 && string(argv[1]) == "--decode") {
+        try {
+            TraceLog::decodeFile(argv[2], cout);
+            return 0;
+        } catch (const exception& e) {
+            cerr << "Ошибка: " << e.what() << endl;
+            return 1;
+        }
+    }
+
+    // Микробенчмарки: --bench [параметры], см. runBenchmarks;
+    // масштабируемость: --scale [параметры], см. runScalingBenchmark;
+    // сверка потоковой модели с пакетной: --validate-fluid [параметры], см. runFluidValidation;
+    // сверка контрольных точек: --validate-checkpoint [параметры], см. runCheckpointValidation
+    string mode = argc >= 2 ? argv[1] : "";
+    if (mode == "--bench" || mode == "--scale" || mode == "--validate-fluid" || mode == "--validate-checkpoint") {
+        try {
+            vector<string> args(argv + 2, argv + argc);
+            if (mode == "--bench") return runBenchmarks(args);
+            if (mode == "--validate-checkpoint") return runCheckpointValidation(args);
+            return mode == "--scale" ? runScalingBenchmark(args) : runFluidValidation(args);
+        } catch (const exception& e) {
+            cerr << "Ошибка: " << e.what() << endl;
+            return 1;
+        }
+    }
     
     cout << "Запуск симулятора сети..." << endl;
     
     NetworkManager nm;
 
+    // Журнал в файл вместо консоли: --trace <файл>
+    if (argc >= 3 && string(argv[1]) == "--trace") {
+        nm.startTrace(argv[2]);
+    }
+
     // Генерируем случайную тестовую сеть
     nm.generateRandomNetwork();
 
     cout << "Переход к главному меню..." << endl;
 
     while (true) {
+        TraceLog::instance().flush();
         displayMenu();
         int choice = safeInput<int>();
 
@@ -661,17 +8431,19 @@ int main() {
                     cout.flush();
                     getline(cin, mac);
                     
+                    MacAddress macAddress = MacAddress::parse(mac);
+                    
                     if (typeChoice == 1) { // Computer
                         string ip;
                         cout << "Введите IP-адрес: "; 
                         cout.flush();
                         getline(cin, ip);
-                        nm.addDevice("Computer", id, name, mac, ip);
+                        nm.addDevice("Computer", id, name, macAddress, ip);
                     } else if (typeChoice == 2) { // Switch
                         int ports = safeInput<int>("Введите количество портов: ");
-                        nm.addDevice("Switch", id, name, mac, "", ports);
+                        nm.addDevice("Switch", id, name, macAddress, "", ports);
                     } else {
-                        nm.addDevice(types[typeChoice], id, name, mac);
+                        nm.addDevice(types[typeChoice], id, name, macAddress);
                     }
                     cout << "Устройство успешно добавлено!" << endl;
                     break;
@@ -684,8 +8456,15 @@ int main() {
                     int id2 = safeInput<int>("Введите ID второго устройства: ");
                     float bw = safeInput<float>("Введите пропускную способность (Мбит/с): ");
                     int lat = safeInput<int>("Введите задержку (мс): ");
+                    int queueCapacity = safeInput<int>("Введите размер очереди (пакетов): ");
+                    int policyChoice = safeInput<int>("Политика отбрасывания (1 - Drop-Tail, 2 - RED): ");
+                    if (queueCapacity <= 0) {
+                        cout << "Размер очереди должен быть больше нуля!" << endl;
+                        break;
+                    }
+                    DropPolicy policy = policyChoice == 2 ? DropPolicy::RED : DropPolicy::DropTail;
                     
-                    nm.connectDevices(id1, id2, bw, lat);
+                    nm.connectDevices(id1, id2, bw, lat, queueCapacity, policy);
                     cout << "Соединение успешно создано!" << endl;
                     break;
                 }
@@ -713,7 +8492,230 @@ int main() {
                     nm.generateRandomNetwork();
                     cout << "Новая сеть создана!" << endl;
                     break;
-                case 6:
+                case 6: {
+                    cout << "\nДобавить маршрут" << endl;
+                    nm.displayNetwork();
+                    
+                    int routerId = safeInput<int>("Введите ID роутера: ");
+                    string cidr;
+                    cout << "Введите префикс (например, 10.0.0.0/8): ";
+                    cout.flush();
+                    getline(cin, cidr);
+                    int nextHopId = safeInput<int>("Введите ID следующего узла: ");
+                    
+                    nm.addRoute(routerId, cidr, nextHopId);
+                    break;
+                }
+                case 7: {
+                    cout << "\nСостояние соединения" << endl;
+                    int id1 = safeInput<int>("Введите ID первого устройства: ");
+                    int id2 = safeInput<int>("Введите ID второго устройства: ");
+                    int state = safeInput<int>("1 - включить, 0 - отключить: ");
+                    nm.setLinkState(id1, id2, state != 0);
+                    break;
+                }
+                case 8: {
+                    nm.displayNetwork();
+                    nm.removeDevice(safeInput<int>("Введите ID удаляемого устройства: "));
+                    break;
+                }
+                case 9: {
+                    cout << "\nТекущее число потоков: " << nm.getSimulationThreads() << endl;
+                    int threads = safeInput<int>("Введите число потоков моделирования (1 - последовательный режим): ");
+                    nm.setSimulationThreads(threads);
+                    cout << "Число потоков установлено: " << threads << endl;
+                    int batch = safeInput<int>("Пакетная обработка по типам устройств (1 - вкл, 0 - выкл): ");
+                    nm.setBatchDispatch(batch != 0);
+                    break;
+                }
+                case 10: {
+                    cout << "\nВид топологии:\n1. Fat-tree\n2. Leaf-spine\n3. Кольцо\n4. Тор"
+                         << "\n5. Случайный граф Эрдёша-Реньи\n6. Барабаши-Альберт" << endl;
+                    int kindChoice = safeInput<int>("Выберите вид: ");
+                    if (kindChoice < 1 || kindChoice > 6) {
+                        cout << "Неверный выбор вида топологии!" << endl;
+                        break;
+                    }
+                    TopologyParams params;
+                    params.kind = static_cast<TopologyKind>(kindChoice - 1);
+                    switch (params.kind) {
+                        case TopologyKind::FatTree:
+                            params.k = safeInput<int>("Введите число портов коммутатора k (чётное): ");
+                            break;
+                        case TopologyKind::LeafSpine:
+                            params.spines = safeInput<int>("Введите число spine-коммутаторов: ");
+                            params.leaves = safeInput<int>("Введите число leaf-коммутаторов: ");
+                            break;
+                        case TopologyKind::Torus:
+                            params.rows = safeInput<int>("Введите число строк: ");
+                            params.columns = safeInput<int>("Введите число столбцов: ");
+                            break;
+                        default:
+                            params.nodes = safeInput<int>("Введите число узлов: ");
+                    }
+                    if (params.kind == TopologyKind::ErdosRenyi) {
+                        params.averageDegree = safeInput<double>("Введите среднюю степень узла: ");
+                    } else if (params.kind == TopologyKind::BarabasiAlbert) {
+                        params.attachLinks = safeInput<int>("Введите число соединений нового узла: ");
+                    }
+                    if (params.kind != TopologyKind::FatTree) {
+                        params.hostsPerSwitch = safeInput<int>("Введите число компьютеров на коммутатор (в leaf-spine - на leaf): ");
+                    }
+                    params.seed = safeInput<uint64_t>("Введите зерно генератора: ");
+                    nm.generateTopology(params);
+                    break;
+                }
+                case 11: {
+                    string path;
+                    cout << "Введите имя файла: ";
+                    cout.flush();
+                    getline(cin, path);
+                    nm.saveNetwork(path);
+                    break;
+                }
+                case 12: {
+                    string path;
+                    cout << "Введите имя файла (двоичный или текстовое описание): ";
+                    cout.flush();
+                    getline(cin, path);
+                    nm.loadNetwork(path);
+                    break;
+                }
+                case 13: {
+                    WorkloadParams params;
+                    vector<FlowSpec> flows;
+                    int source = safeInput<int>("\n1 - сгенерировать потоки, 2 - воспроизвести трассу: ");
+                    if (source == 2) {
+                        string path;
+                        cout << "Введите имя файла трассы: ";
+                        cout.flush();
+                        getline(cin, path);
+                        ifstream in(path);
+                        if (!in) {
+                            cout << "Не удалось открыть файл " << path << endl;
+                            break;
+                        }
+                        flows = WorkloadGenerator::readTrace(in);
+                    } else {
+                        int pattern = safeInput<int>("Схема обмена (1 - все со всеми, 2 - incast): ");
+                        params.pattern = pattern == 2 ? TrafficPattern::Incast : TrafficPattern::AllToAll;
+                        if (params.pattern == TrafficPattern::Incast) {
+                            params.incastFanIn = safeInput<int>("Отправителей на одного получателя: ");
+                        }
+                        int arrivals = safeInput<int>("Появление потоков (1 - пуассоновское, 2 - on/off): ");
+                        params.arrivals = arrivals == 2 ? ArrivalProcess::OnOff : ArrivalProcess::Poisson;
+                        if (params.arrivals == ArrivalProcess::OnOff) {
+                            params.onMs = safeInput<double>("Средняя длительность активности (мс): ");
+                            params.offMs = safeInput<double>("Средняя длительность молчания (мс): ");
+                        }
+                        int sizes = safeInput<int>("Размеры потоков (1 - фиксированный, 2 - экспоненциальный, 3 - Парето): ");
+                        params.sizes = sizes == 1 ? FlowSizeDistribution::Fixed
+                                     : sizes == 2 ? FlowSizeDistribution::Exponential : FlowSizeDistribution::Pareto;
+                        params.meanFlowBytes = safeInput<double>("Средний размер потока (байт): ");
+                        params.flowsPerSecond = safeInput<double>("Потоков в секунду модельного времени: ");
+                        params.durationMs = safeInput<double>("Длительность (мс модельного времени): ");
+                        params.seed = safeInput<uint64_t>("Введите зерно генератора: ");
+                        flows = WorkloadGenerator::generate(params, nm.getHostIds());
+
+                        string path;
+                        cout << "Сохранить трассу в файл (пусто - не сохранять): ";
+                        cout.flush();
+                        getline(cin, path);
+                        if (!path.empty()) {
+                            ofstream out(path);
+                            WorkloadGenerator::writeTrace(flows, out);
+                        }
+                    }
+                    params.packetBytes = safeInput<int>("Размер пакета (байт): ");
+                    params.flowRateMbps = safeInput<double>("Скорость отправки потока (Мбит/с): ");
+                    int mode = safeInput<int>("Режим (1 - пакетный, 2 - потоковый, для больших сетей): ");
+                    if (mode == 2) {
+                        nm.runFluidWorkload(flows, params.packetBytes, params.flowRateMbps);
+                    } else {
+                        nm.runWorkload(flows, params.packetBytes, params.flowRateMbps);
+                    }
+                    break;
+                }
+                case 14: {
+                    cout << "\n1. Начать захват в файл\n2. Захватывать соединение\n3. Захватывать все соединения"
+                         << "\n4. Захватывать приём устройства\n5. Остановить захват" << endl;
+                    int action = safeInput<int>("Выберите действие: ");
+                    if (action == 1) {
+                        string path;
+                        cout << "Введите имя файла: ";
+                        cout.flush();
+                        getline(cin, path);
+                        int snapLength = safeInput<int>("Сохранять байт кадра (не меньше " +
+                                                        to_string(PcapWriter::minSnapLength) + "): ");
+                        nm.startCapture(path, static_cast<uint32_t>(max(snapLength, 0)));
+                    } else if (action == 2) {
+                        int id1 = safeInput<int>("Введите ID первого устройства: ");
+                        int id2 = safeInput<int>("Введите ID второго устройства: ");
+                        bool enabled = safeInput<int>("1 - захватывать, 0 - не захватывать: ") != 0;
+                        nm.setLinkCapture(id1, id2, enabled);
+                    } else if (action == 3) {
+                        nm.setAllLinksCapture(safeInput<int>("1 - захватывать, 0 - не захватывать: ") != 0);
+                    } else if (action == 4) {
+                        int id = safeInput<int>("Введите ID устройства: ");
+                        bool enabled = safeInput<int>("1 - захватывать, 0 - не захватывать: ") != 0;
+                        nm.setIngressCapture(id, enabled);
+                    } else if (action == 5) {
+                        nm.stopCapture();
+                    } else {
+                        cout << "Неверный выбор действия!" << endl;
+                    }
+                    break;
+                }
+                case 15: {
+                    cout << "\n1. Показать сводку\n2. Начать выгрузку в файл\n3. Записать снимок сейчас"
+                         << "\n4. Остановить выгрузку" << endl;
+                    int action = safeInput<int>("Выберите действие: ");
+                    if (action == 1) {
+                        nm.displayMetrics();
+                    } else if (action == 2) {
+                        string path;
+                        cout << "Введите имя файла: ";
+                        cout.flush();
+                        getline(cin, path);
+                        int format = safeInput<int>("Формат (1 - JSON, 2 - CSV): ");
+                        double interval = safeInput<double>("Интервал снимков, мс модельного времени (0 - только в конце прогона): ");
+                        nm.startMetrics(path, format == 2 ? MetricsFormat::Csv : MetricsFormat::Json, interval);
+                    } else if (action == 3) {
+                        nm.writeMetrics();
+                    } else if (action == 4) {
+                        nm.stopMetrics();
+                    } else {
+                        cout << "Неверный выбор действия!" << endl;
+                    }
+                    break;
+                }
+                case 16: {
+                    cout << "\n1. Начать контрольные точки\n2. Записать точку сейчас\n3. Восстановить из файла"
+                         << "\n4. Продолжить моделирование\n5. Остановить контрольные точки" << endl;
+                    int action = safeInput<int>("Выберите действие: ");
+                    if (action == 1 || action == 3) {
+                        string path;
+                        cout << "Введите имя файла: ";
+                        cout.flush();
+                        getline(cin, path);
+                        if (action == 1) {
+                            double interval = safeInput<double>("Интервал точек, мс модельного времени (0 - только в конце прогона): ");
+                            nm.startCheckpoints(path, interval);
+                        } else {
+                            nm.restoreCheckpoint(path);
+                        }
+                    } else if (action == 2) {
+                        nm.writeCheckpoint();
+                    } else if (action == 4) {
+                        nm.runSimulation();
+                    } else if (action == 5) {
+                        nm.stopCheckpoints();
+                    } else {
+                        cout << "Неверный выбор действия!" << endl;
+                    }
+                    break;
+                }
+                case 17:
                     cout << "Завершение работы программы..." << endl;
                     return 0;
                 default:
@@ -742,7 +8744,7 @@ void NetworkDevice::displayInfo() const {
         vector<int> connectedIds;
         
         for (const auto& conn : connections) {
-            auto otherDevice = conn->getOtherDevice(const_pointer_cast<NetworkDevice>(shared_from_this()));
+            const NetworkDevice* otherDevice = conn->otherEnd(this);
             if (otherDevice) {
                 connectedIds.push_back(otherDevice->getId());
             }
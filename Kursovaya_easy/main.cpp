@@ -9,9 +9,12 @@
 #include <thread>
 #include <chrono>
 #include <limits>
-#include <windows.h>
 #include <locale.h>
 #include <cstdlib>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
 
 using namespace std;
 
@@ -331,9 +334,10 @@ void displayMenu() {
 }
 
 int main() {
-
+#ifdef _WIN32
     SetConsoleOutputCP(65001);
     SetConsoleCP(65001);
+#endif
 
     cout << "Запуск симулятора сети..." << endl;
 